@@ -0,0 +1,80 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every allocation is rounded up to this, so the next one stays aligned
+#define ARENA_ALIGN alignof(max_align_t)
+
+// Set up an empty arena that grows block_size bytes at a time
+void arena_init(arena_t* arena, size_t block_size) {
+  arena->first = NULL;
+  arena->current = NULL;
+  arena->block_size = block_size;
+}
+
+// Allocate a block with room for at least size bytes
+static arena_block_t* arena_block_create(arena_t* arena, size_t size) {
+  if (size < arena->block_size) size = arena->block_size;
+  arena_block_t* block = malloc(sizeof(arena_block_t) + size);
+  if (block == NULL) return NULL;
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+  return block;
+}
+
+// Allocate size bytes that live until the next reset
+void* arena_alloc(arena_t* arena, size_t size) {
+  size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+
+  arena_block_t* block = arena->current;
+  if (block == NULL || block->size - block->used < size) {
+    // Move on to the next block kept from before the last reset, if it is big enough.
+    // Otherwise slot a new one in after the current block.
+    arena_block_t* next = block == NULL ? arena->first : block->next;
+    if (next == NULL || next->size < size) {
+      arena_block_t* fresh = arena_block_create(arena, size);
+      if (fresh == NULL) return NULL;
+      fresh->next = next;
+      if (block == NULL) {
+        arena->first = fresh;
+      } else {
+        block->next = fresh;
+      }
+      next = fresh;
+    }
+    next->used = 0;
+    arena->current = block = next;
+  }
+
+  void* result = block->data + block->used;
+  block->used += size;
+  return result;
+}
+
+// Copy a string into the arena
+char* arena_strdup(arena_t* arena, const char* s) {
+  size_t len = strlen(s) + 1;
+  char* copy = arena_alloc(arena, len);
+  if (copy != NULL) memcpy(copy, s, len);
+  return copy;
+}
+
+// Free everything allocated since the last reset. Later blocks are rewound as they are reached.
+void arena_reset(arena_t* arena) {
+  arena->current = arena->first;
+  if (arena->first != NULL) arena->first->used = 0;
+}
+
+// Free the arena's blocks
+void arena_destroy(arena_t* arena) {
+  arena_block_t* block = arena->first;
+  while (block != NULL) {
+    arena_block_t* next = block->next;
+    free(block);
+    block = next;
+  }
+  arena_init(arena, arena->block_size);
+}
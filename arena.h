@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdalign.h>
+#include <stddef.h>
+
+// One block of arena memory. Blocks are kept across resets and reused.
+typedef struct arena_block {
+  struct arena_block* next;
+  size_t size;
+  size_t used;
+  alignas(max_align_t) char data[];
+} arena_block_t;
+
+// A bump allocator for memory that all dies at once. Allocating bumps a pointer in the current
+// block and resetting rewinds to the first block, so once an arena has grown to what a phase
+// needs it never calls malloc again.
+typedef struct arena {
+  arena_block_t* first;
+  arena_block_t* current;
+  size_t block_size;
+} arena_t;
+
+// Set up an empty arena that grows block_size bytes at a time
+void arena_init(arena_t* arena, size_t block_size);
+
+// Allocate size bytes, aligned for any type, that live until the next reset. Returns NULL if
+// the arena cannot grow.
+void* arena_alloc(arena_t* arena, size_t size);
+
+// Copy a string into the arena. Returns NULL if the arena cannot grow.
+char* arena_strdup(arena_t* arena, const char* s);
+
+// Free everything allocated since the last reset, keeping the blocks for reuse
+void arena_reset(arena_t* arena);
+
+// Free the arena's blocks
+void arena_destroy(arena_t* arena);
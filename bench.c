@@ -0,0 +1,331 @@
+// Benchmarks for the framing layer and the broadcast path. Every case prints one line of
+// key=value pairs, so runs can be collected and compared to catch regressions.
+//
+// framing: one thread sends messages with send_message or send_message_v2, another receives them
+//          with receive_message or a msg_reader, over a socketpair or loopback TCP.
+// fanout:  the way user_message relays chat: every line is encoded once into a frame, queued on
+//          each recipient's conn and written out with conn_flush_all, burst lines at a time.
+//
+// Latency is one way, from just before a message is sent to when its receiver has decoded it,
+// while the sender streams as fast as it can. Syscalls are the read and write calls of the whole
+// process as counted in /proc/self/io, per message delivered.
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "conn.h"
+#include "frame.h"
+#include "message.h"
+#include "socket.h"
+
+#define BENCH_DEFAULT_MESSAGES 20000
+#define BENCH_STAMP_DIGITS 20  // send time at the start of every payload, in decimal nanoseconds
+
+static const size_t framing_sizes[] = {32, 64, 256, 1024, MAX_MESSAGE_LENGTH - 1};
+static const int fanout_recipients[] = {6, 64};
+static const int fanout_bursts[] = {1, 16};
+#define FANOUT_SIZE 64
+
+// The receiving end of a case
+typedef struct receiver {
+  pthread_t thread;
+  int fd;
+  bool reader;        // decode with a msg_reader like the server, or with receive_message
+  int version;        // framing the msg_reader starts out in
+  size_t messages;    // messages to receive before stopping
+  uint64_t* latency;  // one-way latency of every message, in nanoseconds
+  bool failed;
+} receiver_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Read and write system calls made by this process so far, or 0 if /proc/self/io is unavailable
+static uint64_t io_syscalls(void) {
+  FILE* f = fopen("/proc/self/io", "r");
+  if (f == NULL) return 0;
+
+  uint64_t total = 0;
+  char key[32];
+  unsigned long long value;
+  while (fscanf(f, "%31[^:]: %llu\n", key, &value) == 2) {
+    if (strcmp(key, "syscr") == 0 || strcmp(key, "syscw") == 0) total += value;
+  }
+  fclose(f);
+  return total;
+}
+
+// Fill buf with a size-byte message that starts with the current time
+static void stamp_payload(char* buf, size_t size) {
+  snprintf(buf, size + 1, "%0*llu", BENCH_STAMP_DIGITS, (unsigned long long)now_ns());
+  memset(buf + BENCH_STAMP_DIGITS, 'x', size - BENCH_STAMP_DIGITS);
+  buf[size] = '\0';
+}
+
+// Time since a payload was stamped
+static uint64_t payload_age(const char* text) {
+  return now_ns() - strtoull(text, NULL, 10);
+}
+
+// Receive messages until the case is done, recording how old each one is on arrival
+static void* receiver_main(void* arg) {
+  receiver_t* rx = arg;
+
+  if (!rx->reader) {
+    for (size_t i = 0; i < rx->messages; i++) {
+      char* text = receive_message(rx->fd);
+      if (text == NULL) {
+        rx->failed = true;
+        return NULL;
+      }
+      rx->latency[i] = payload_age(text);
+      free(text);
+    }
+    return NULL;
+  }
+
+  // Decode the way the server does it: one read, then every complete frame in place
+  msg_reader_t* reader = malloc(sizeof(msg_reader_t));
+  if (reader == NULL) {
+    rx->failed = true;
+    return NULL;
+  }
+  msg_reader_init(reader, rx->fd);
+  reader->version = rx->version;
+
+  size_t got = 0;
+  while (got < rx->messages) {
+    if (msg_reader_fill(reader) <= 0) {
+      rx->failed = true;
+      break;
+    }
+    msg_view_t view;
+    int rc = 0;
+    while (got < rx->messages && (rc = msg_reader_view(reader, &view)) > 0) {
+      if (view.control == 0) rx->latency[got++] = payload_age(view.text);
+    }
+    if (rc < 0) {
+      rx->failed = true;
+      break;
+    }
+  }
+  msg_reader_destroy(reader);
+  free(reader);
+  return NULL;
+}
+
+static int receiver_start(receiver_t* rx, int fd, bool reader, int version, size_t messages) {
+  rx->fd = fd;
+  rx->reader = reader;
+  rx->version = version;
+  rx->messages = messages;
+  rx->failed = false;
+  rx->latency = malloc(messages * sizeof(uint64_t));
+  if (rx->latency == NULL) return -1;
+  return pthread_create(&rx->thread, NULL, receiver_main, rx);
+}
+
+static int compare_u64(const void* a, const void* b) {
+  uint64_t x = *(const uint64_t*)a;
+  uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Percentile p of sorted latencies, in microseconds
+static double percentile_us(const uint64_t* sorted, size_t count, double p) {
+  size_t i = (size_t)(p * (count - 1));
+  return sorted[i] / 1000.0;
+}
+
+// Print the rates and latency percentiles that every case ends with
+static void report(uint64_t* latency, size_t count, uint64_t elapsed_ns, uint64_t syscalls) {
+  qsort(latency, count, sizeof(uint64_t), compare_u64);
+  printf(" messages=%zu msgs_per_sec=%.0f syscalls_per_msg=%.3f p50_us=%.1f p99_us=%.1f p999_us=%.1f\n",
+         count, count / (elapsed_ns / 1e9), (double)syscalls / count, percentile_us(latency, count, 0.5),
+         percentile_us(latency, count, 0.99), percentile_us(latency, count, 0.999));
+  fflush(stdout);
+}
+
+// Connect two ends of a transport. Returns 0, or -1 if an error occurs.
+static int open_pair(const char* transport, int fds[2]) {
+  if (strcmp(transport, "unix") == 0) return socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+
+  unsigned short port = 0;
+  int listener = server_socket_open(&port);
+  if (listener == -1 || listen(listener, 1) != 0) return -1;
+  fds[0] = socket_connect("127.0.0.1", port);
+  fds[1] = fds[0] == -1 ? -1 : server_socket_accept(listener);
+  close(listener);
+  if (fds[1] == -1) {
+    if (fds[0] != -1) close(fds[0]);
+    return -1;
+  }
+  return 0;
+}
+
+// One sender streaming messages of one size to one receiver
+static int bench_framing(const char* transport, int version, size_t size, size_t messages) {
+  int fds[2];
+  if (open_pair(transport, fds) != 0) return -1;
+
+  receiver_t rx;
+  // v1 is received with the blocking call the client uses, v2 with the server's reader
+  if (receiver_start(&rx, fds[1], version == FRAMING_V2, version, messages) != 0) return -1;
+
+  char payload[MAX_MESSAGE_LENGTH];
+  uint64_t syscalls = io_syscalls();
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < messages; i++) {
+    stamp_payload(payload, size);
+    int rc = version == FRAMING_V1 ? send_message(fds[0], payload) : send_message_v2(fds[0], payload);
+    if (rc != 0) break;
+  }
+  pthread_join(rx.thread, NULL);
+  uint64_t elapsed = now_ns() - start;
+  syscalls = io_syscalls() - syscalls;
+
+  close(fds[0]);
+  close(fds[1]);
+  if (!rx.failed) {
+    printf("bench=framing transport=%s version=%d size=%zu", transport, version, size);
+    report(rx.latency, messages, elapsed, syscalls);
+  }
+  free(rx.latency);
+  return rx.failed ? -1 : 0;
+}
+
+// Lines encoded once and queued for every recipient, flushed burst lines at a time
+static int bench_fanout(int version, int recipients, int burst, size_t messages) {
+  conn_t* conns = calloc(recipients, sizeof(conn_t));
+  receiver_t* rxs = calloc(recipients, sizeof(receiver_t));
+  int* peers = calloc(recipients, sizeof(int));
+  if (conns == NULL || rxs == NULL || peers == NULL) return -1;
+
+  // The sending ends stay blocking, so a flush waits for a slow receiver instead of queueing
+  conn_t* dirty = NULL;
+  for (int r = 0; r < recipients; r++) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) return -1;
+    conn_init(&conns[r], fds[0]);
+    conn_attach(&conns[r], &dirty);
+    peers[r] = fds[1];
+    if (receiver_start(&rxs[r], fds[1], true, FRAMING_V1, messages) != 0) return -1;
+  }
+
+  // The switch marker goes out first, just as after a client accepts the offer
+  if (version == FRAMING_V2) {
+    for (int r = 0; r < recipients; r++) conn_upgrade(&conns[r]);
+  }
+
+  char payload[MAX_MESSAGE_LENGTH];
+  uint64_t syscalls = io_syscalls();
+  uint64_t start = now_ns();
+  for (size_t i = 0; i < messages; i++) {
+    stamp_payload(payload, FANOUT_SIZE);
+    frame_t* frame = frame_create(payload);
+    if (frame == NULL) break;
+    for (int r = 0; r < recipients; r++) conn_send_frame(&conns[r], frame);
+    frame_unref(frame);
+
+    if ((i + 1) % burst == 0) conn_flush_all(&dirty);
+  }
+  conn_flush_all(&dirty);
+
+  bool failed = false;
+  for (int r = 0; r < recipients; r++) {
+    pthread_join(rxs[r].thread, NULL);
+    failed |= rxs[r].failed;
+  }
+  uint64_t elapsed = now_ns() - start;
+  syscalls = io_syscalls() - syscalls;
+
+  // Every delivery counts as one message
+  size_t total = messages * recipients;
+  uint64_t* latency = malloc(total * sizeof(uint64_t));
+  for (int r = 0; r < recipients && latency != NULL; r++)
+    memcpy(latency + r * messages, rxs[r].latency, messages * sizeof(uint64_t));
+  if (!failed && latency != NULL) {
+    printf("bench=fanout version=%d recipients=%d burst=%d size=%d", version, recipients, burst, FANOUT_SIZE);
+    report(latency, total, elapsed, syscalls);
+  }
+
+  for (int r = 0; r < recipients; r++) {
+    conn_destroy(&conns[r]);
+    close(conns[r].fd);
+    close(peers[r]);
+    free(rxs[r].latency);
+  }
+  free(latency);
+  free(conns);
+  free(rxs);
+  free(peers);
+  return failed ? -1 : 0;
+}
+
+int main(int argc, char** argv) {
+  size_t messages = BENCH_DEFAULT_MESSAGES;
+  const char* only = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:b:")) != -1) {
+    switch (opt) {
+      case 'n':
+        messages = strtoull(optarg, NULL, 10);
+        break;
+      case 'b':
+        only = optarg;
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n messages per case] [-b framing|fanout]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if (messages == 0) messages = 1;
+
+  // A receiver that goes away must fail the case, not kill the run
+  signal(SIGPIPE, SIG_IGN);
+
+  int failures = 0;
+  if (only == NULL || strcmp(only, "framing") == 0) {
+    const char* transports[] = {"unix", "tcp"};
+    for (int t = 0; t < 2; t++) {
+      for (int version = FRAMING_V1; version <= FRAMING_V2; version++) {
+        for (size_t s = 0; s < sizeof(framing_sizes) / sizeof(framing_sizes[0]); s++) {
+          if (bench_framing(transports[t], version, framing_sizes[s], messages) != 0) {
+            fprintf(stderr, "framing %s v%d size %zu failed: %s\n", transports[t], version, framing_sizes[s],
+                    strerror(errno));
+            failures++;
+          }
+        }
+      }
+    }
+  }
+
+  if (only == NULL || strcmp(only, "fanout") == 0) {
+    for (int version = FRAMING_V1; version <= FRAMING_V2; version++) {
+      for (size_t r = 0; r < sizeof(fanout_recipients) / sizeof(fanout_recipients[0]); r++) {
+        for (size_t b = 0; b < sizeof(fanout_bursts) / sizeof(fanout_bursts[0]); b++) {
+          if (bench_fanout(version, fanout_recipients[r], fanout_bursts[b], messages) != 0) {
+            fprintf(stderr, "fanout v%d to %d, bursts of %d failed\n", version, fanout_recipients[r],
+                    fanout_bursts[b]);
+            failures++;
+          }
+        }
+      }
+    }
+  }
+
+  return failures == 0 ? 0 : EXIT_FAILURE;
+}
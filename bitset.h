@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+// Most members a set can hold
+#define BITSET_CAPACITY 512
+#define BITSET_WORDS ((BITSET_CAPACITY + 63) / 64)
+
+// A fixed-size set of small integers, one bit each. Membership tests are a mask and counts are a
+// popcount per word.
+typedef struct bitset {
+  uint64_t words[BITSET_WORDS];
+} bitset_t;
+
+// Empty a set
+static inline void bitset_clear_all(bitset_t* set) {
+  memset(set, 0, sizeof(bitset_t));
+}
+
+// Add i to a set
+static inline void bitset_set(bitset_t* set, int i) {
+  set->words[i / 64] |= UINT64_C(1) << (i % 64);
+}
+
+// Remove i from a set
+static inline void bitset_clear(bitset_t* set, int i) {
+  set->words[i / 64] &= ~(UINT64_C(1) << (i % 64));
+}
+
+// Whether i is in a set
+static inline bool bitset_test(const bitset_t* set, int i) {
+  return (set->words[i / 64] >> (i % 64)) & 1;
+}
+
+// Number of members of a set
+static inline int bitset_count(const bitset_t* set) {
+  int count = 0;
+  for (int w = 0; w < BITSET_WORDS; w++) count += __builtin_popcountll(set->words[w]);
+  return count;
+}
+
+// Number of members two sets have in common
+static inline int bitset_count_and(const bitset_t* a, const bitset_t* b) {
+  int count = 0;
+  for (int w = 0; w < BITSET_WORDS; w++) count += __builtin_popcountll(a->words[w] & b->words[w]);
+  return count;
+}
+
+// Set out to the members of a that are also in b
+static inline void bitset_and(bitset_t* out, const bitset_t* a, const bitset_t* b) {
+  for (int w = 0; w < BITSET_WORDS; w++) out->words[w] = a->words[w] & b->words[w];
+}
+
+// Set out to the members of either a or b
+static inline void bitset_or(bitset_t* out, const bitset_t* a, const bitset_t* b) {
+  for (int w = 0; w < BITSET_WORDS; w++) out->words[w] = a->words[w] | b->words[w];
+}
+
+// Set out to the members of a that are not in b
+static inline void bitset_and_not(bitset_t* out, const bitset_t* a, const bitset_t* b) {
+  for (int w = 0; w < BITSET_WORDS; w++) out->words[w] = a->words[w] & ~b->words[w];
+}
+
+// Smallest member of a set that is at least i, or -1 if there is none. Iterate a set with
+// for (int i = bitset_next(s, 0); i != -1; i = bitset_next(s, i + 1)).
+static inline int bitset_next(const bitset_t* set, int i) {
+  if (i >= BITSET_CAPACITY) return -1;
+  int w = i / 64;
+  uint64_t word = set->words[w] & (~UINT64_C(0) << (i % 64));
+  while (true) {
+    if (word != 0) return w * 64 + __builtin_ctzll(word);
+    if (++w == BITSET_WORDS) return -1;
+    word = set->words[w];
+  }
+}
@@ -0,0 +1,447 @@
+#include "bot.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bitset.h"
+#include "conn.h"
+#include "reactor.h"
+#include "socket.h"
+#include "util.h"
+
+// What every player name starts with, before the seat number
+#define BOT_NAME_PREFIX "Player "
+
+// Prompts answered with a player's name. Retries after an invalid answer are in the list too.
+static const char* const name_prompts[] = {
+    "Type the name of a player",  "Choose one player to slaughter", "Choose a player you would like to save",
+    "Who do you want to kill?",   "mark an unfortunate victim",     "Please enter a player's name",
+    "invalid input",              "Invalid username",               "Invalid input",
+};
+
+// The server's announcements of how a game ended, each sent as a message of its own
+static const char* const game_over_announcements[] = {
+    "No one wins! All are dead.",
+    "Villagers win! All werewolves are dead.",
+    "Werewolves win! Werewolves are at least half of the remainings.",
+};
+
+struct fleet;
+
+// One simulated player on its own connection
+typedef struct bot {
+  int index;
+  struct fleet* fleet;
+  conn_t conn;
+  reactor_handle_t handle;
+  bool closing;  // the connection ended and is torn down once the current batch is flushed
+  struct bot* next_closing;
+  int games_left;
+  uint64_t rng;
+
+  // What the bot has gathered about its current table, by seat
+  int me;              // our own seat, -1 until the welcome names it
+  bitset_t seen;       // every seat named so far
+  bitset_t dead;       // seats announced dead
+  bitset_t last_list;  // seats in the last list of names the server sent
+  bitset_t rejected;   // answers the server refused since the prompt was first asked
+  int last_target;     // seat named in the last answer, -1 if it was not a name
+  bool from_list;      // the pending prompt is answered from last_list, and so are its retries
+  bool winner_seen;    // the game on this connection has been decided
+
+  // The answer to the pending prompt, sent once the think time is up
+  char answer[MAX_MESSAGE_LENGTH];
+  wheel_timer_t think_timer;
+  wheel_timer_t chat_timer;
+} bot_t;
+
+// Every bot of one process, driven by a single reactor
+typedef struct fleet {
+  bot_options_t options;
+  char* server_name;
+  unsigned short port;
+
+  reactor_t reactor;
+  conn_t* dirty;      // connections with output to flush
+  bot_t* closing;     // bots whose connection ended during the current batch
+  int active;         // bots that still have games to play
+  bot_t* bots;
+
+  // Totals for the summary
+  uint64_t messages;
+  uint64_t answers;
+  uint64_t chats;
+  uint64_t timeouts;
+  uint64_t games;
+  uint64_t dropped;
+  uint64_t connect_failures;
+} fleet_t;
+
+static int bot_connect(bot_t* bot);
+
+// Fill in the defaults: one bot playing one game, answering after about a second, no chat
+void bot_options_init(bot_options_t* options) {
+  options->bots = 1;
+  options->games = 1;
+  options->think_ms = 1000;
+  options->think_dist = THINK_EXPONENTIAL;
+  options->chat_per_min = 0;
+  options->seed = time_ms();
+}
+
+// A uniform double in [0, 1)
+static double bot_uniform(bot_t* bot) {
+  return (rng_next(&bot->rng) >> 11) * 0x1p-53;
+}
+
+// An exponentially distributed delay with the given mean, in milliseconds
+static uint64_t bot_exponential(bot_t* bot, double mean) {
+  return (uint64_t)(-mean * log(1.0 - bot_uniform(bot)));
+}
+
+// Draw how long to think before answering
+static uint64_t bot_think_time(bot_t* bot) {
+  unsigned mean = bot->fleet->options.think_ms;
+  switch (bot->fleet->options.think_dist) {
+    case THINK_UNIFORM:
+      return rng_below(&bot->rng, 2 * (uint64_t)mean + 1);
+    case THINK_EXPONENTIAL:
+      return bot_exponential(bot, mean);
+    default:
+      return mean;
+  }
+}
+
+// Add every "Player N" named in text to names, as seat N - 1
+static void bot_names_in(const char* text, bitset_t* names) {
+  bitset_clear_all(names);
+  for (const char* at = strstr(text, BOT_NAME_PREFIX); at != NULL; at = strstr(at + 1, BOT_NAME_PREFIX)) {
+    int seat = atoi(at + strlen(BOT_NAME_PREFIX)) - 1;
+    if (seat >= 0 && seat < BITSET_CAPACITY) bitset_set(names, seat);
+  }
+}
+
+// Pick a random member of a set, or -1 if it is empty
+static int bot_pick(bot_t* bot, const bitset_t* set) {
+  int count = bitset_count(set);
+  if (count == 0) return -1;
+  int skip = rng_below(&bot->rng, count);
+  int i = bitset_next(set, 0);
+  while (skip-- > 0) i = bitset_next(set, i + 1);
+  return i;
+}
+
+// Send the answer decided on for the last prompt
+static void bot_answer(void* ctx) {
+  bot_t* bot = ctx;
+  conn_send(&bot->conn, bot->answer);
+  bot->fleet->answers++;
+}
+
+// Say something in the chat and plan the next line
+static void bot_chat(void* ctx) {
+  bot_t* bot = ctx;
+  fleet_t* fleet = bot->fleet;
+
+  // The dead talk too: the server relays their lines to the other dead players
+  if (bot->me != -1) {
+    msg_buf_t line;
+    msg_init(&line);
+    msg_append(&line, "bot %d says hello", bot->index);
+    conn_send(&bot->conn, line.text);
+    fleet->chats++;
+  }
+
+  reactor_add_timer(&fleet->reactor, &bot->chat_timer, bot_exponential(bot, 60000 / fleet->options.chat_per_min),
+                    bot_chat, bot);
+}
+
+// Decide on the answer to a prompt and send it once the think time is up. list holds the names
+// the prompt came with, NULL if it came without a list.
+static void bot_prompt(bot_t* bot, const char* text, const bitset_t* list) {
+  bool yes_no = strstr(text, "(y/n)") != NULL;
+  if (yes_no) {
+    snprintf(bot->answer, sizeof(bot->answer), "%s", rng_below(&bot->rng, 3) == 0 ? "y" : "n");
+    bot->last_target = -1;
+  } else {
+    // A retry means the last answer was refused. Anything else is a new question.
+    if (strstr(text, "nvalid") != NULL) {
+      if (bot->last_target != -1) bitset_set(&bot->rejected, bot->last_target);
+    } else {
+      bitset_clear_all(&bot->rejected);
+    }
+
+    // A prompt that comes with its own list picks from it. The werewolves get their list before the
+    // prompt, and a retry keeps choosing from where the prompt did.
+    if (list != NULL) {
+      bot->from_list = true;
+      bot->last_list = *list;
+    } else if (strstr(text, "slaughter") != NULL) {
+      bot->from_list = true;
+    } else if (strstr(text, "nvalid") == NULL) {
+      bot->from_list = false;
+    }
+
+    // Otherwise any living player will do. Seats are numbered from 1 without gaps, so every seat up
+    // to the highest one named exists, and the next one is worth a try if nothing else is left.
+    bitset_t options;
+    if (bot->from_list) {
+      options = bot->last_list;
+    } else {
+      bitset_clear_all(&options);
+      int highest = bot->me;
+      for (int i = bitset_next(&bot->seen, 0); i != -1; i = bitset_next(&bot->seen, i + 1)) highest = i;
+      for (int i = 0; i <= highest + 1 && i < BITSET_CAPACITY; i++) bitset_set(&options, i);
+      bitset_and_not(&options, &options, &bot->dead);
+    }
+    bitset_and_not(&options, &options, &bot->rejected);
+    if (bot->me != -1) bitset_clear(&options, bot->me);
+
+    int target = bot_pick(bot, &options);
+    if (target == -1) target = bot_pick(bot, &bot->seen);
+    bot->last_target = target;
+
+    // With no seat left worth naming, the prompt is left to time out
+    if (target == -1) {
+      reactor_cancel_timer(&bot->fleet->reactor, &bot->think_timer);
+      return;
+    }
+    snprintf(bot->answer, sizeof(bot->answer), BOT_NAME_PREFIX "%d", target + 1);
+  }
+
+  reactor_add_timer(&bot->fleet->reactor, &bot->think_timer, bot_think_time(bot), bot_answer, bot);
+}
+
+// Take in one message from the server
+static void bot_message(bot_t* bot, const char* text) {
+  fleet_t* fleet = bot->fleet;
+  fleet->messages++;
+
+  bitset_t named;
+  bot_names_in(text, &named);
+  bitset_or(&bot->seen, &bot->seen, &named);
+
+  // The welcome tells us our own name
+  const char* welcome = strstr(text, "username will be: ");
+  if (bot->me == -1 && welcome != NULL) bot->me = bitset_next(&named, 0);
+
+  // Deaths: a night's list, or the one player a vote or a disconnect took out
+  if (strstr(text, "The following users died") != NULL) {
+    bitset_or(&bot->dead, &bot->dead, &named);
+    return;
+  }
+  if (strstr(text, "has been voted out") != NULL || strstr(text, "has disconnected") != NULL) {
+    int seat = bitset_next(&named, 0);
+    if (seat != -1) bitset_set(&bot->dead, seat);
+    return;
+  }
+
+  if (strstr(text, "Time is up, you did not answer") != NULL) {
+    fleet->timeouts++;
+    return;
+  }
+
+  // Only the server's own announcement ends a game, never a chat line that mentions winning
+  for (size_t i = 0; i < sizeof(game_over_announcements) / sizeof(game_over_announcements[0]); i++) {
+    if (strcmp(text, game_over_announcements[i]) == 0) {
+      fleet->games++;
+      bot->games_left--;
+      bot->winner_seen = true;
+      return;
+    }
+  }
+
+  // A list of names on its own lines, for the werewolves to choose from
+  bool has_list = strstr(text, "\n" BOT_NAME_PREFIX) != NULL;
+  if (has_list) bot->last_list = named;
+
+  bool prompt = strstr(text, "(y/n)") != NULL;
+  for (size_t i = 0; !prompt && i < sizeof(name_prompts) / sizeof(name_prompts[0]); i++)
+    prompt = strstr(text, name_prompts[i]) != NULL;
+  if (prompt) bot_prompt(bot, text, has_list ? &named : NULL);
+}
+
+// Stop playing on this connection. It is torn down after the current batch has been flushed.
+static void bot_close(bot_t* bot) {
+  if (bot->closing) return;
+  bot->closing = true;
+  reactor_remove(&bot->fleet->reactor, &bot->handle);
+  bot->next_closing = bot->fleet->closing;
+  bot->fleet->closing = bot;
+}
+
+// Reactor callback for a bot's socket: take in every message that has arrived
+static void bot_readable(void* ctx, int fd) {
+  bot_t* bot = ctx;
+  msg_reader_t* reader = &bot->conn.reader;
+
+  ssize_t rc = msg_reader_fill(reader);
+  if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+
+  msg_view_t view;
+  int got = 0;
+  if (rc > 0) {
+    while (!bot->closing && (got = msg_reader_view(reader, &view)) > 0) {
+      // Take up the server's offer of v2 framing
+      if (view.control == PROTO_OFFER) {
+        conn_accept_v2(&bot->conn);
+      } else if (view.control == 0) {
+        bot_message(bot, view.text);
+      }
+    }
+  }
+
+  if (rc <= 0 || got < 0) bot_close(bot);
+}
+
+// Reactor callback for a full socket that has become writable
+static void bot_writable(void* ctx, int fd) {
+  bot_t* bot = ctx;
+  conn_flush(&bot->conn);
+}
+
+// Called when a write to a bot's connection fails
+static void bot_failed(void* ctx) {
+  bot_close(ctx);
+}
+
+// Watch a bot's socket for writability while it is full
+static void bot_blocked(void* ctx, bool blocked) {
+  bot_t* bot = ctx;
+  reactor_watch_writable(&bot->fleet->reactor, &bot->handle, blocked);
+}
+
+// Free a bot's connection and play the next game, or retire the bot if it is done
+static void bot_finish(bot_t* bot) {
+  fleet_t* fleet = bot->fleet;
+
+  reactor_cancel_timer(&fleet->reactor, &bot->think_timer);
+  reactor_cancel_timer(&fleet->reactor, &bot->chat_timer);
+  conn_destroy(&bot->conn);
+  close(bot->conn.fd);
+  bot->closing = false;
+
+  // The server hung up before the game had a winner
+  if (!bot->winner_seen) {
+    fleet->dropped++;
+    bot->games_left--;
+  }
+
+  if (bot->games_left > 0 && bot_connect(bot) == 0) return;
+  if (--fleet->active == 0) reactor_stop(&fleet->reactor);
+}
+
+// Flush what the last batch of events queued, then deal with the connections that ended
+static void fleet_idle(void* ctx) {
+  fleet_t* fleet = ctx;
+
+  conn_flush_all(&fleet->dirty);
+
+  while (fleet->closing != NULL) {
+    bot_t* bot = fleet->closing;
+    fleet->closing = bot->next_closing;
+    bot_finish(bot);
+  }
+}
+
+// Open a connection for a bot and start listening to the server. Returns 0, or -1 on failure.
+static int bot_connect(bot_t* bot) {
+  fleet_t* fleet = bot->fleet;
+
+  int fd = socket_connect(fleet->server_name, fleet->port);
+  if (fd == -1) {
+    fleet->connect_failures++;
+    return -1;
+  }
+  if (socket_set_nonblocking(fd) != 0) {
+    close(fd);
+    fleet->connect_failures++;
+    return -1;
+  }
+
+  conn_init(&bot->conn, fd);
+  bot->conn.on_error = bot_failed;
+  bot->conn.on_blocked = bot_blocked;
+  bot->conn.ctx = bot;
+  conn_attach(&bot->conn, &fleet->dirty);
+
+  bot->handle.fd = fd;
+  bot->handle.on_readable = bot_readable;
+  bot->handle.on_writable = bot_writable;
+  bot->handle.ctx = bot;
+  if (reactor_add(&fleet->reactor, &bot->handle) != 0) {
+    conn_destroy(&bot->conn);
+    close(fd);
+    fleet->connect_failures++;
+    return -1;
+  }
+
+  // Forget the last table
+  bot->me = -1;
+  bitset_clear_all(&bot->seen);
+  bitset_clear_all(&bot->dead);
+  bitset_clear_all(&bot->last_list);
+  bitset_clear_all(&bot->rejected);
+  bot->last_target = -1;
+  bot->from_list = false;
+  bot->winner_seen = false;
+
+  if (fleet->options.chat_per_min > 0) {
+    reactor_add_timer(&fleet->reactor, &bot->chat_timer,
+                      bot_exponential(bot, 60000 / fleet->options.chat_per_min), bot_chat, bot);
+  }
+  return 0;
+}
+
+// Connect the bots to a server and play until every bot has played its games
+int bot_run(char* server_name, unsigned short port, const bot_options_t* options) {
+  fleet_t* fleet = calloc(1, sizeof(fleet_t));
+  if (fleet == NULL) return -1;
+  fleet->options = *options;
+  fleet->server_name = server_name;
+  fleet->port = port;
+
+  fleet->bots = calloc(options->bots, sizeof(bot_t));
+  if (fleet->bots == NULL || reactor_init(&fleet->reactor) != 0) {
+    free(fleet->bots);
+    free(fleet);
+    return -1;
+  }
+  fleet->reactor.on_idle = fleet_idle;
+  fleet->reactor.idle_ctx = fleet;
+
+  uint64_t start = monotonic_ms();
+
+  // Every bot draws from its own generator, so a run depends only on the seed and the server
+  for (int i = 0; i < options->bots; i++) {
+    bot_t* bot = &fleet->bots[i];
+    bot->index = i;
+    bot->fleet = fleet;
+    bot->games_left = options->games;
+    bot->rng = options->seed ^ ((uint64_t)i * 0x9e3779b97f4a7c15);
+    wheel_timer_init(&bot->think_timer);
+    wheel_timer_init(&bot->chat_timer);
+    if (bot_connect(bot) == 0) fleet->active++;
+  }
+
+  if (fleet->active > 0) reactor_run(&fleet->reactor);
+
+  // One line of key=value pairs, easy to collect from many runs
+  printf("bots=%d seed=%llu elapsed_ms=%llu games=%llu dropped=%llu messages=%llu answers=%llu chats=%llu "
+         "timeouts=%llu connect_failures=%llu\n",
+         options->bots, (unsigned long long)options->seed, (unsigned long long)(monotonic_ms() - start),
+         (unsigned long long)fleet->games, (unsigned long long)fleet->dropped,
+         (unsigned long long)fleet->messages, (unsigned long long)fleet->answers,
+         (unsigned long long)fleet->chats, (unsigned long long)fleet->timeouts,
+         (unsigned long long)fleet->connect_failures);
+
+  reactor_destroy(&fleet->reactor);
+  free(fleet->bots);
+  free(fleet);
+  return 0;
+}
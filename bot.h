@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+
+// How long a bot waits before answering a prompt
+typedef enum think_dist {
+  THINK_FIXED,        // always the mean
+  THINK_UNIFORM,      // uniform between 0 and twice the mean
+  THINK_EXPONENTIAL,  // exponential with the given mean, like independent players
+} think_dist_t;
+
+// What a fleet of bots does
+typedef struct bot_options {
+  int bots;                // number of connections, each playing as one player
+  int games;               // games each bot plays before it stops, reconnecting in between
+  unsigned think_ms;       // mean think time before answering a prompt
+  think_dist_t think_dist;
+  double chat_per_min;     // chat lines per bot per minute while alive, 0 for none
+  uint64_t seed;           // seed of every bot's random choices, so runs can be repeated
+} bot_options_t;
+
+// Fill in the defaults: one bot playing one game, answering after about a second, no chat
+void bot_options_init(bot_options_t* options);
+
+// Connect the bots to a server and play until every bot has played its games.
+// Prints a summary to stdout. Returns 0, or -1 if the bots could not be set up.
+int bot_run(char* server_name, unsigned short port, const bot_options_t* options);
@@ -0,0 +1,198 @@
+#include "checkpoint.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Path of a game's checkpoint, or of the file it is written to first when tmp is set
+static void checkpoint_path(const checkpointer_t* checkpoints, int game, bool tmp, char* out, size_t size) {
+  snprintf(out, size, "%s/game-%d" CHECKPOINT_SUFFIX "%s", checkpoints->dir, game, tmp ? ".tmp" : "");
+}
+
+// Write one checkpoint to its temporary file, sync it and rename it into place
+static int checkpoint_write(const checkpointer_t* checkpoints, const checkpoint_job_t* job) {
+  char tmp[4096], path[4096];
+  checkpoint_path(checkpoints, job->game, true, tmp, sizeof(tmp));
+  checkpoint_path(checkpoints, job->game, false, path, sizeof(path));
+
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) return -1;
+  size_t done = 0;
+  while (done < job->len) {
+    ssize_t wrote = write(fd, job->data + done, job->len - done);
+    if (wrote < 0) {
+      close(fd);
+      return -1;
+    }
+    done += wrote;
+  }
+  if (fdatasync(fd) != 0) {
+    close(fd);
+    return -1;
+  }
+  close(fd);
+  return rename(tmp, path);
+}
+
+// Thread function for the writer: write out whatever is queued, then make the renames durable
+static void* checkpoint_main(void* arg) {
+  checkpointer_t* checkpoints = arg;
+
+  while (true) {
+    pthread_mutex_lock(&checkpoints->lock);
+    while (checkpoints->head == NULL) pthread_cond_wait(&checkpoints->ready, &checkpoints->lock);
+    checkpoint_job_t* jobs = checkpoints->head;
+    checkpoints->head = NULL;
+    checkpoints->tail = &checkpoints->head;
+    pthread_mutex_unlock(&checkpoints->lock);
+
+    while (jobs != NULL) {
+      checkpoint_job_t* next = jobs->next;
+      if (jobs->len == 0) {
+        char path[4096];
+        checkpoint_path(checkpoints, jobs->game, false, path, sizeof(path));
+        unlink(path);
+      } else if (checkpoint_write(checkpoints, jobs) != 0) {
+        perror("Failed to write checkpoint");
+        atomic_fetch_add(&checkpoints->failed, 1);
+      } else {
+        atomic_fetch_add(&checkpoints->written, 1);
+      }
+      free(jobs);
+      jobs = next;
+    }
+
+    // One sync of the directory covers every rename and removal of the batch
+    int dir = open(checkpoints->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir != -1) {
+      fsync(dir);
+      close(dir);
+    }
+  }
+  return NULL;
+}
+
+// Start writing checkpoints into dir
+int checkpointer_start(checkpointer_t* checkpoints, const char* dir) {
+  memset(checkpoints, 0, sizeof(checkpointer_t));
+  checkpoints->dir = strdup(dir);
+  if (checkpoints->dir == NULL) return -1;
+
+  checkpoints->head = NULL;
+  checkpoints->tail = &checkpoints->head;
+  atomic_init(&checkpoints->written, 0);
+  atomic_init(&checkpoints->replaced, 0);
+  atomic_init(&checkpoints->failed, 0);
+  pthread_mutex_init(&checkpoints->lock, NULL);
+  pthread_cond_init(&checkpoints->ready, NULL);
+  if (pthread_create(&checkpoints->thread, NULL, checkpoint_main, checkpoints) != 0) return -1;
+  return 0;
+}
+
+// Queue a job, in place of a checkpoint of the same game that has not been written yet
+static void checkpoint_queue(checkpointer_t* checkpoints, checkpoint_job_t* job) {
+  pthread_mutex_lock(&checkpoints->lock);
+  checkpoint_job_t* stale = NULL;
+  for (checkpoint_job_t** link = &checkpoints->head; *link != NULL; link = &(*link)->next) {
+    if ((*link)->game != job->game) continue;
+    stale = *link;
+    job->next = stale->next;
+    *link = job;
+    if (checkpoints->tail == &stale->next) checkpoints->tail = &job->next;
+    break;
+  }
+  if (stale == NULL) {
+    job->next = NULL;
+    *checkpoints->tail = job;
+    checkpoints->tail = &job->next;
+    pthread_cond_signal(&checkpoints->ready);
+  }
+  pthread_mutex_unlock(&checkpoints->lock);
+
+  if (stale != NULL) {
+    atomic_fetch_add(&checkpoints->replaced, 1);
+    free(stale);
+  }
+}
+
+// Queue len bytes as the latest checkpoint of a game
+void checkpoint_save(checkpointer_t* checkpoints, int game, const void* data, size_t len) {
+  checkpoint_job_t* job = malloc(sizeof(checkpoint_job_t) + len);
+  if (job == NULL) {
+    atomic_fetch_add(&checkpoints->failed, 1);
+    return;
+  }
+  job->game = game;
+  job->len = len;
+  memcpy(job->data, data, len);
+  checkpoint_queue(checkpoints, job);
+}
+
+// Queue the removal of a game's checkpoint
+void checkpoint_remove(checkpointer_t* checkpoints, int game) {
+  checkpoint_job_t* job = malloc(sizeof(checkpoint_job_t));
+  if (job == NULL) return;
+  job->game = game;
+  job->len = 0;
+  checkpoint_queue(checkpoints, job);
+}
+
+// Read one checkpoint file into a new buffer. Returns NULL if it cannot be read.
+static char* checkpoint_read(const char* path, size_t* len) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0 || st.st_size > CHECKPOINT_MAX_SIZE) {
+    close(fd);
+    return NULL;
+  }
+
+  char* data = malloc(st.st_size);
+  size_t done = 0;
+  while (data != NULL && done < (size_t)st.st_size) {
+    ssize_t got = read(fd, data + done, st.st_size - done);
+    if (got <= 0) {
+      free(data);
+      data = NULL;
+    } else {
+      done += got;
+    }
+  }
+  close(fd);
+  *len = done;
+  return data;
+}
+
+// Read every checkpoint in dir and call found with each one
+int checkpoint_load_all(const char* dir, void (*found)(void* ctx, int game, const char* data, size_t len),
+                        void* ctx) {
+  DIR* entries = opendir(dir);
+  if (entries == NULL) return -1;
+
+  int count = 0;
+  struct dirent* entry;
+  while ((entry = readdir(entries)) != NULL) {
+    // Only finished checkpoints: a temporary file was cut off before its rename
+    int game, end;
+    if (sscanf(entry->d_name, "game-%d%n", &game, &end) != 1 || strcmp(entry->d_name + end, CHECKPOINT_SUFFIX) != 0)
+      continue;
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    size_t len;
+    char* data = checkpoint_read(path, &len);
+    if (data == NULL) {
+      fprintf(stderr, "Failed to read checkpoint %s\n", path);
+      continue;
+    }
+    found(ctx, game, data, len);
+    free(data);
+    count++;
+  }
+  closedir(entries);
+  return count;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Every game in progress keeps its latest checkpoint in dir/game-<id>.ckpt. A checkpoint is
+// written to a temporary file, synced and renamed over the last one, so a crash at any point
+// leaves either the old checkpoint or the new one, never half of either. What a checkpoint holds
+// is up to the game; here it is only bytes.
+#define CHECKPOINT_SUFFIX ".ckpt"
+#define CHECKPOINT_MAX_SIZE (1024 * 1024)  // Largest checkpoint read back, far above any table's
+
+// A checkpoint on its way to disk, or the removal of one when len is 0
+typedef struct checkpoint_job {
+  struct checkpoint_job* next;
+  int game;
+  size_t len;
+  char data[];
+} checkpoint_job_t;
+
+// A checkpoint directory and the thread that writes it. Games queue their checkpoints and never
+// wait for the disk. A game that checkpoints again before its last one was written only has its
+// newest one written.
+typedef struct checkpointer {
+  char* dir;
+  pthread_t thread;
+  pthread_mutex_t lock;     // protects the queue
+  pthread_cond_t ready;     // signalled when a job is queued
+  checkpoint_job_t* head;   // jobs waiting to be written, oldest first
+  checkpoint_job_t** tail;
+
+  atomic_uint_fast64_t written;   // checkpoints on disk
+  atomic_uint_fast64_t replaced;  // checkpoints skipped because a newer one came first
+  atomic_uint_fast64_t failed;    // checkpoints that could not be written
+} checkpointer_t;
+
+// Start writing checkpoints into dir, which must exist. Returns -1 if an error occurs.
+int checkpointer_start(checkpointer_t* checkpoints, const char* dir);
+
+// Queue len bytes as the latest checkpoint of a game. Copies data, never blocks on I/O.
+void checkpoint_save(checkpointer_t* checkpoints, int game, const void* data, size_t len);
+
+// Queue the removal of a game's checkpoint, once it has ended
+void checkpoint_remove(checkpointer_t* checkpoints, int game);
+
+// Read every checkpoint in dir and call found with each one, whose data is only valid during the
+// call. Returns the number of checkpoints read, or -1 if dir cannot be read.
+int checkpoint_load_all(const char* dir, void (*found)(void* ctx, int game, const char* data, size_t len),
+                        void* ctx);
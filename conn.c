@@ -0,0 +1,301 @@
+#include "conn.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+// Most buffers a single writev hands to the kernel
+#define FLUSH_IOV_MAX 64
+
+// Most frames in one batch: each takes a header and a payload buffer, behind the batch header
+#define BATCH_FRAMES_MAX ((FLUSH_IOV_MAX - 1) / 2)
+
+// Start an empty message
+void msg_init(msg_buf_t* msg) {
+  msg->text[0] = '\0';
+  msg->len = 0;
+}
+
+// Append printf-style text to a message
+void msg_append(msg_buf_t* msg, const char* format, ...) {
+  size_t room = sizeof(msg->text) - msg->len;
+  if (room <= 1) return;
+
+  va_list args;
+  va_start(args, format);
+  int n = vsnprintf(msg->text + msg->len, room, format, args);
+  va_end(args);
+
+  if (n < 0) return;
+  msg->len += (size_t)n < room ? (size_t)n : room - 1;
+}
+
+// Set up a connection for a connected, non-blocking socket
+void conn_init(conn_t* conn, int fd) {
+  memset(conn, 0, sizeof(conn_t));
+  conn->fd = fd;
+  conn->version = FRAMING_V1;
+  msg_reader_init(&conn->reader, fd);
+}
+
+// Note whether the socket is full, telling the owner when that changes
+static void conn_set_blocked(conn_t* conn, bool blocked) {
+  if (conn->blocked == blocked) return;
+  conn->blocked = blocked;
+  if (conn->on_blocked != NULL) conn->on_blocked(conn->ctx, blocked);
+}
+
+// Mark a connection as gone and tell its owner
+static void conn_fail(conn_t* conn) {
+  if (conn->failed) return;
+  conn->failed = true;
+  conn_discard(conn);
+  conn_set_blocked(conn, false);
+  if (conn->on_error != NULL) conn->on_error(conn->ctx);
+}
+
+// Link a connection with queued output into its flush list
+static void conn_mark_dirty(conn_t* conn) {
+  if (conn->dirty || conn->flush_list == NULL) return;
+  conn->dirty = true;
+  conn->next_dirty = *conn->flush_list;
+  *conn->flush_list = conn;
+}
+
+// Start queueing output on flush_list
+void conn_attach(conn_t* conn, struct conn** flush_list) {
+  // Whoever watches the socket from now on has not been told it is full
+  conn->blocked = false;
+  conn->flush_list = flush_list;
+  if (conn->out_count > 0) conn_mark_dirty(conn);
+}
+
+// Queue one message as a single frame
+void conn_send(conn_t* conn, const char* message) {
+  if (conn->failed) return;
+
+  frame_t* frame = frame_create(message);
+  if (frame == NULL) {
+    conn_fail(conn);
+    return;
+  }
+  conn_send_frame(conn, frame);
+  frame_unref(frame);
+}
+
+// Make room for one more frame in the ring, keeping queued frames in order. Fails once the
+// connection has as many queued as it may have.
+static bool conn_reserve(conn_t* conn) {
+  if (conn->out_count >= CONN_MAX_QUEUED) {
+    if (conn->counters != NULL) conn->counters->overflows++;
+    return false;
+  }
+  if (conn->out_count < conn->out_cap) return true;
+
+  size_t cap = conn->out_cap == 0 ? 16 : conn->out_cap * 2;
+  out_entry_t* out = malloc(cap * sizeof(out_entry_t));
+  if (out == NULL) return false;
+  for (size_t i = 0; i < conn->out_count; i++) {
+    out[i] = conn->out[(conn->out_start + i) % conn->out_cap];
+  }
+  free(conn->out);
+  conn->out = out;
+  conn->out_cap = cap;
+  conn->out_start = 0;
+  return true;
+}
+
+// Queue a reference to an already encoded frame
+void conn_send_frame(conn_t* conn, frame_t* frame) {
+  if (conn->failed) return;
+  if (!conn_reserve(conn)) {
+    conn_fail(conn);
+    return;
+  }
+
+  out_entry_t* entry = &conn->out[(conn->out_start + conn->out_count) % conn->out_cap];
+  entry->frame = frame_ref(frame);
+  entry->version = conn->version;
+  conn->out_count++;
+
+  // Without a flush list there is nobody to flush later, so write now. A full socket is
+  // flushed when it becomes writable instead.
+  if (conn->flush_list == NULL) {
+    conn_flush(conn);
+  } else if (!conn->blocked) {
+    conn_mark_dirty(conn);
+  }
+}
+
+// Offer the peer v2 framing
+void conn_offer_v2(conn_t* conn) {
+  frame_t* frame = frame_create_control(PROTO_OFFER);
+  if (frame == NULL) {
+    conn_fail(conn);
+    return;
+  }
+  conn_send_frame(conn, frame);
+  frame_unref(frame);
+}
+
+// Switch output to v2 framing once the peer has accepted it
+void conn_upgrade(conn_t* conn) {
+  if (conn->version == FRAMING_V2) return;
+
+  // The switch marker is the last v1 frame the peer gets
+  frame_t* frame = frame_create_control(PROTO_SWITCH);
+  if (frame == NULL) {
+    conn_fail(conn);
+    return;
+  }
+  conn_send_frame(conn, frame);
+  frame_unref(frame);
+  conn->version = FRAMING_V2;
+}
+
+// Accept the peer's offer of v2 framing and switch output to it
+void conn_accept_v2(conn_t* conn) {
+  if (conn->version == FRAMING_V2) return;
+
+  // The answer is the last v1 frame the peer gets, just like a switch marker
+  frame_t* frame = frame_create_control(PROTO_ACCEPT);
+  if (frame == NULL) {
+    conn_fail(conn);
+    return;
+  }
+  conn_send_frame(conn, frame);
+  frame_unref(frame);
+  conn->version = FRAMING_V2;
+}
+
+// Queued entry i, counting from the front of the ring
+static out_entry_t* conn_entry(conn_t* conn, size_t i) {
+  return &conn->out[(conn->out_start + i) % conn->out_cap];
+}
+
+// Pick the next unit to write: one frame, or in v2 as many queued v2 frames as fit in a batch
+static void conn_plan_unit(conn_t* conn) {
+  out_entry_t* first = conn_entry(conn, 0);
+  conn->unit_frames = 1;
+  conn->unit_len = frame_wire_len(first->frame, first->version);
+  conn->unit_header_len = 0;
+  if (first->version != FRAMING_V2) return;
+
+  size_t frames = 0;
+  size_t payload = 0;
+  while (frames < conn->out_count && frames < BATCH_FRAMES_MAX) {
+    out_entry_t* entry = conn_entry(conn, frames);
+    if (entry->version != FRAMING_V2) break;
+    size_t len = frame_wire_len(entry->frame, FRAMING_V2);
+    if (payload + len > MAX_BATCH_LENGTH) break;
+    payload += len;
+    frames++;
+  }
+  if (frames < 2) return;
+
+  conn->unit_frames = frames;
+  conn->unit_header_len = varint_encode((uint64_t)payload << 1 | FRAME_BATCH, conn->unit_header);
+  conn->unit_len = conn->unit_header_len + payload;
+}
+
+// Add a buffer to an iovec array, skipping the bytes of it already written
+static void iov_push(struct iovec* iov, int* count, size_t* skip, const void* base, size_t len) {
+  if (*skip >= len) {
+    *skip -= len;
+    return;
+  }
+  iov[*count].iov_base = (char*)base + *skip;
+  iov[*count].iov_len = len - *skip;
+  (*count)++;
+  *skip = 0;
+}
+
+// Write out as much queued output as the socket takes
+int conn_flush(conn_t* conn) {
+  while (conn->out_count > 0) {
+    if (conn->unit_frames == 0) conn_plan_unit(conn);
+
+    // Gather the rest of the unit. The frame headers live in the shared frames.
+    struct iovec iov[FLUSH_IOV_MAX];
+    int count = 0;
+    size_t skip = conn->out_offset;
+    iov_push(iov, &count, &skip, conn->unit_header, conn->unit_header_len);
+    for (size_t i = 0; i < conn->unit_frames; i++) {
+      out_entry_t* entry = conn_entry(conn, i);
+      frame_t* f = entry->frame;
+      if (entry->version == FRAMING_V1) {
+        iov_push(iov, &count, &skip, &f->v1_header, sizeof(f->v1_header));
+        iov_push(iov, &count, &skip, f->text, f->len + 1);
+      } else {
+        iov_push(iov, &count, &skip, f->v2_header, f->v2_header_len);
+        iov_push(iov, &count, &skip, f->text, f->len);
+      }
+    }
+
+    ssize_t rc = writev(conn->fd, iov, count);
+    if (rc == -1 && errno == EINTR) continue;
+    if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      conn_set_blocked(conn, true);
+      return 0;
+    }
+    if (rc <= 0) {
+      conn_fail(conn);
+      return -1;
+    }
+
+    if (conn->counters != NULL) {
+      conn->counters->writes++;
+      conn->counters->bytes_out += rc;
+    }
+
+    // Release the unit's frames once all of it is written
+    conn->out_offset += rc;
+    if (conn->out_offset < conn->unit_len) continue;
+    if (conn->counters != NULL) conn->counters->frames_out += conn->unit_frames;
+    for (size_t i = 0; i < conn->unit_frames; i++) {
+      frame_unref(conn_entry(conn, 0)->frame);
+      conn->out_start = (conn->out_start + 1) % conn->out_cap;
+      conn->out_count--;
+    }
+    conn->unit_frames = 0;
+    conn->out_offset = 0;
+  }
+
+  conn_set_blocked(conn, false);
+  return 0;
+}
+
+// Flush every connection on a flush list and empty the list
+void conn_flush_all(conn_t** flush_list) {
+  // Error handlers may queue more output, which puts connections back on the list
+  while (*flush_list != NULL) {
+    conn_t* conn = *flush_list;
+    *flush_list = conn->next_dirty;
+    conn->next_dirty = NULL;
+    conn->dirty = false;
+    conn_flush(conn);
+  }
+}
+
+// Drop any queued output
+void conn_discard(conn_t* conn) {
+  for (size_t i = 0; i < conn->out_count; i++) {
+    frame_unref(conn_entry(conn, i)->frame);
+  }
+  conn->out_start = 0;
+  conn->out_count = 0;
+  conn->unit_frames = 0;
+  conn->out_offset = 0;
+}
+
+// Drop any queued output and free the buffers
+void conn_destroy(conn_t* conn) {
+  conn_discard(conn);
+  msg_reader_destroy(&conn->reader);
+  free(conn->out);
+  conn->out = NULL;
+  conn->out_cap = 0;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "frame.h"
+#include "message.h"
+
+// Most frames queued for one connection. A peer that falls further behind than this is not
+// reading, so it is dropped rather than left to hold on to frames for ever. Leaves room for a
+// spectator's whole feed at once.
+#define CONN_MAX_QUEUED 4096
+
+// Gathers the pieces of one logical message so it can be sent as a single frame
+typedef struct msg_buf {
+  char text[MAX_MESSAGE_LENGTH];
+  size_t len;
+} msg_buf_t;
+
+// Traffic through a set of connections, counted by the thread that owns them
+typedef struct io_counters {
+  uint64_t frames_in;
+  uint64_t bytes_in;
+  uint64_t frames_out;
+  uint64_t bytes_out;
+  uint64_t writes;  // writev calls that wrote something
+  uint64_t overflows;  // connections dropped for having CONN_MAX_QUEUED frames queued
+} io_counters_t;
+
+// A queued frame and the framing it goes out in
+typedef struct out_entry {
+  frame_t* frame;
+  int version;
+} out_entry_t;
+
+// One player's connection. Outgoing messages are queued as references to frames and written
+// together with a single writev when the connection is flushed. In v2 framing, runs of queued
+// frames go out as batch frames.
+typedef struct conn {
+  int fd;
+  bool failed;  // a write failed, so the peer is gone and further output is dropped
+  int version;  // framing of frames queued from now on
+
+  // Incoming messages
+  msg_reader_t reader;
+
+  // Ring of queued frames
+  out_entry_t* out;
+  size_t out_cap;
+  size_t out_start;
+  size_t out_count;
+
+  // The unit being written: the first unit_frames queued frames, behind a batch header if
+  // unit_header_len is not 0
+  size_t unit_frames;
+  size_t unit_len;
+  uint8_t unit_header[MAX_VARINT_LEN];
+  size_t unit_header_len;
+  size_t out_offset;  // bytes of the unit already written
+
+  // Connections with queued output are linked into a flush list, if they have one.
+  // Without a list, every message is written as soon as it is queued.
+  struct conn** flush_list;
+  struct conn* next_dirty;
+  bool dirty;
+
+  // Set while the socket is full and output waits for it to become writable
+  bool blocked;
+
+  // Called once when a write fails, and when the socket fills up or drains
+  void (*on_error)(void* ctx);
+  void (*on_blocked)(void* ctx, bool blocked);
+  void* ctx;
+
+  // Where output is counted, NULL for nowhere
+  io_counters_t* counters;
+} conn_t;
+
+// Start an empty message
+void msg_init(msg_buf_t* msg);
+
+// Append printf-style text to a message. Text past MAX_MESSAGE_LENGTH is dropped.
+void msg_append(msg_buf_t* msg, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// Set up a connection for a connected, non-blocking socket
+void conn_init(conn_t* conn, int fd);
+
+// Start queueing output on flush_list, which already holds this connection if output is waiting
+void conn_attach(conn_t* conn, struct conn** flush_list);
+
+// Queue one message as a single frame
+void conn_send(conn_t* conn, const char* message);
+
+// Queue a reference to an already encoded frame. The caller keeps its own reference.
+void conn_send_frame(conn_t* conn, frame_t* frame);
+
+// Offer the peer v2 framing
+void conn_offer_v2(conn_t* conn);
+
+// Switch output to v2 framing once the peer has accepted it
+void conn_upgrade(conn_t* conn);
+
+// Accept the peer's offer of v2 framing and switch output to it
+void conn_accept_v2(conn_t* conn);
+
+// Write out as much queued output as the socket takes. If it fills up, on_blocked is called
+// and the rest waits for the next flush. Returns non-zero value if an error occurs.
+int conn_flush(conn_t* conn);
+
+// Flush every connection on a flush list and empty the list
+void conn_flush_all(conn_t** flush_list);
+
+// Drop any queued output
+void conn_discard(conn_t* conn);
+
+// Drop any queued output and free the buffers. Does not close the socket.
+void conn_destroy(conn_t* conn);
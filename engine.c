@@ -0,0 +1,971 @@
+/*-----------------------------------------LIBRARY-----------------------------------------*/
+
+
+#include "engine.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+
+/*-----------------------------------------GLOBAL VALUES-----------------------------------------*/
+
+
+// Every role's name, as players see it
+const char *const role_names[ROLE_COUNT] = {"werewolf", "guard", "witch", "hunter", "seer", "villager"};
+
+
+/*-----------------------------------------FUNCTIONS HEADERS-----------------------------------------*/
+
+
+// Queue an event for whoever runs the game
+static void engine_emit(engine_t *engine, event_kind_t kind, int player, int target, int value);
+
+// Ask a player for a decision
+static void engine_ask(engine_t *engine, int player, decision_t decision);
+
+// The alive player dealt a given role, NO_PLAYER if there is none
+static int engine_find_role(engine_t *engine, role_t role);
+
+/* Check the game against the ending criteria and announce the outcome if one is met
+   Returns true if the game continues, false if otherwise. */
+static bool engine_check_status(engine_t *engine);
+
+// Start a night: forget last night's choices and ask every role at once
+static void engine_night(engine_t *engine);
+
+// Mark one of the night's tasks as done and resolve the night once none is left
+static void engine_task_done(engine_t *engine, int task);
+
+// Store the werewolves' victim and tell the witch who is dying
+static void engine_werewolf_kill(engine_t *engine, int victim);
+
+// Ask the witch whether to use her kill potion, or finish her task if she cannot
+static void engine_witch_kill(engine_t *engine);
+
+// Apply the guard's save and the hunter's mark, announce the deaths and start the day if the game continues
+static void engine_night_end(engine_t *engine);
+
+// Count one vote, keeping the leader and ties exact
+static void engine_tally(engine_t *engine, int target);
+
+// Take a player off the vote, which ends as soon as nobody is left to vote
+static void engine_drop_voter(engine_t *engine, int player);
+
+// Strike the votes against a player who left, and find the lead again among the living
+static void engine_drop_candidate(engine_t *engine, int player);
+
+// Announce who was voted out, unless there is a tie, and start the next night if the game continues
+static void engine_day_end(engine_t *engine);
+
+// Append n bytes to a saved engine
+static void save_bytes(unsigned char **at, const void *from, size_t n);
+
+// Take n bytes of a saved engine. Returns false if fewer are left.
+static bool load_bytes(const unsigned char **at, const unsigned char *end, void *to, size_t n);
+
+// Clear the bits of a loaded set beyond the seats in use, which no player can be
+static void load_mask(bitset_t *set, int players);
+
+// Whether a loaded event only names seats in use, and a role, decision or outcome that exists where it has one
+static bool load_event_valid(const engine_event_t *event, int players);
+
+
+/*-----------------------------------------FUNCTIONS-----------------------------------------*/
+
+
+/*-------------------------Configuration-------------------------*/
+
+
+// Fill in the classic table for a number of players
+void game_config_default(game_config_t *config, int players)
+{
+  memset(config, 0, sizeof(game_config_t));
+  config->players = players;
+
+  // A quarter of the table, rounded so that the 7 player game has its 2 werewolves
+  config->roles[ROLE_WEREWOLF] = (players + 1) / 4;
+  if (config->roles[ROLE_WEREWOLF] < 1)
+    config->roles[ROLE_WEREWOLF] = 1;
+
+  // Then one of each special role while there are seats left, and villagers for the rest
+  int dealt = config->roles[ROLE_WEREWOLF];
+  role_t specials[] = {ROLE_GUARD, ROLE_WITCH, ROLE_HUNTER, ROLE_SEER};
+  for (int i = 0; i < 4 && dealt < players; i++, dealt++)
+    config->roles[specials[i]] = 1;
+  config->roles[ROLE_VILLAGER] = players - dealt;
+} // game_config_default
+
+
+
+/* Set up a table of players seats, dealt the default roles for that many players except for the
+   counts given in roles. Returns false, after saying why on stderr, if the table cannot be played. */
+bool game_config_parse(game_config_t *config, int players, char *roles)
+{
+  if (players < 2 || players > MAX_USERS)
+  {
+    fprintf(stderr, "A table seats between 2 and %d players\n", MAX_USERS);
+    return false;
+  }
+  game_config_default(config, players);
+
+  // Every entry is a role's name and how many players are dealt it
+  char *save = NULL;
+  for (char *entry = roles == NULL ? NULL : strtok_r(roles, ",", &save); entry != NULL; entry = strtok_r(NULL, ",", &save))
+  {
+    char *count = strchr(entry, '=');
+    if (count == NULL)
+    {
+      fprintf(stderr, "Expected role=count, got %s\n", entry);
+      return false;
+    }
+    *count++ = '\0';
+
+    role_t role = ROLE_COUNT;
+    for (int r = 0; r < ROLE_COUNT; r++)
+      if (strcmp(entry, role_names[r]) == 0)
+        role = r;
+    if (role == ROLE_COUNT || role == ROLE_VILLAGER)
+    {
+      fprintf(stderr, "Unknown role %s. Villagers fill whatever seats are left.\n", entry);
+      return false;
+    }
+    config->roles[role] = atoi(count);
+  }
+
+  // The rules ask the seer, guard, witch and hunter one at a time, so a table has at most one of each
+  for (int r = 0; r < ROLE_COUNT; r++)
+  {
+    if (r != ROLE_WEREWOLF && r != ROLE_VILLAGER && (config->roles[r] < 0 || config->roles[r] > 1))
+    {
+      fprintf(stderr, "A table has at most one %s\n", role_names[r]);
+      return false;
+    }
+  }
+  if (config->roles[ROLE_WEREWOLF] < 1)
+  {
+    fprintf(stderr, "A table needs at least one werewolf\n");
+    return false;
+  }
+
+  // Villagers take the seats the other roles leave
+  int dealt = 0;
+  for (int r = 0; r < ROLE_COUNT; r++)
+    if (r != ROLE_VILLAGER)
+      dealt += config->roles[r];
+  if (dealt > players)
+  {
+    fprintf(stderr, "%d roles do not fit at a table of %d\n", dealt, players);
+    return false;
+  }
+  config->roles[ROLE_VILLAGER] = players - dealt;
+  return true;
+} // game_config_parse
+
+
+
+/*-------------------------Game Lifecycle-------------------------*/
+
+
+// Set up a game for config's table and deal every seat its role, shuffled with seed
+void engine_init(engine_t *engine, const game_config_t *config, uint64_t seed)
+{
+  // Only the seats in use are touched, so a small table is cheap to set up
+  int players = config->players;
+  engine->config = *config;
+  engine->seed = seed;
+  engine->rng = seed;
+  engine->over = false;
+  memset(engine->owed, 0, players * sizeof(decision_t));
+  memset(engine->votes_against, 0, players * sizeof(int));
+  bitset_clear_all(&engine->alive);
+  for (int r = 0; r < ROLE_COUNT; r++)
+    bitset_clear_all(&engine->by_role[r]);
+  bitset_clear_all(&engine->voters);
+
+  engine->witch_kill = true;
+  engine->witch_save = true;
+  engine->werewolf_k = NO_PLAYER;
+  engine->witch_k = NO_PLAYER;
+  engine->hunter_k = NO_PLAYER;
+  engine->guarded = NO_PLAYER;
+  engine->hunter_mark = NO_PLAYER;
+  engine->night_pending = 0;
+  engine->event_head = 0;
+  engine->event_count = 0;
+
+  // Lay out the deck and shuffle it once (Fisher-Yates), so seat i is dealt the i-th card
+  int cards = 0;
+  for (int r = 0; r < ROLE_COUNT; r++)
+    for (int n = 0; n < config->roles[r]; n++)
+      engine->role[cards++] = r;
+  for (int i = cards - 1; i > 0; i--)
+  {
+    int j = rng_below(&engine->rng, i + 1);
+    role_t card = engine->role[i];
+    engine->role[i] = engine->role[j];
+    engine->role[j] = card;
+  }
+
+  for (int i = 0; i < players; i++)
+  {
+    bitset_set(&engine->alive, i);
+    bitset_set(&engine->by_role[engine->role[i]], i);
+  }
+} // engine_init
+
+
+
+// Start the game with its first night, or end it at once if the deal already decides it
+void engine_start(engine_t *engine)
+{
+  if (engine_check_status(engine))
+    engine_night(engine);
+} // engine_start
+
+
+
+/* Take a player out of the game for good, as if dead, without announcing anything. Whatever they
+   owe is settled as if their time was up, so nobody waits for them, and the game ends if losing
+   them decides it. */
+void engine_leave(engine_t *engine, int player)
+{
+  bool was_alive = bitset_test(&engine->alive, player);
+  bitset_clear(&engine->alive, player);
+  if (engine->over || !was_alive)
+    return;
+
+  // Nobody can be voted out once gone, and a vote they owe is dropped from the vote, which may end the day
+  engine_drop_candidate(engine, player);
+  engine_timeout(engine, player);
+  if (!engine->over)
+    engine_check_status(engine);
+} // engine_leave
+
+
+
+/*-------------------------Events-------------------------*/
+
+
+// Queue an event for whoever runs the game
+static void engine_emit(engine_t *engine, event_kind_t kind, int player, int target, int value)
+{
+  // Events are taken after every action, so the ring only fills up if nobody takes them
+  if (engine->event_count == ENGINE_MAX_EVENTS)
+  {
+    fprintf(stderr, "Engine event queue is full, dropping an event\n");
+    return;
+  }
+
+  int slot = (engine->event_head + engine->event_count) % ENGINE_MAX_EVENTS;
+  engine->events[slot] = (engine_event_t){.kind = kind, .player = player, .target = target, .value = value};
+  engine->event_count++;
+} // engine_emit
+
+
+
+// Take the oldest event not taken yet
+bool engine_next_event(engine_t *engine, engine_event_t *event)
+{
+  if (engine->event_count == 0)
+    return false;
+
+  *event = engine->events[engine->event_head];
+  engine->event_head = (engine->event_head + 1) % ENGINE_MAX_EVENTS;
+  engine->event_count--;
+  return true;
+} // engine_next_event
+
+
+
+// Put the event engine_next_event took last back, so it is the next one taken again
+void engine_unread(engine_t *engine)
+{
+  engine->event_head = (engine->event_head + ENGINE_MAX_EVENTS - 1) % ENGINE_MAX_EVENTS;
+  engine->event_count++;
+} // engine_unread
+
+
+
+// Ask a player for a decision
+static void engine_ask(engine_t *engine, int player, decision_t decision)
+{
+  engine->owed[player] = decision;
+  engine_emit(engine, EVENT_ASK, player, NO_PLAYER, decision);
+} // engine_ask
+
+
+
+/*-------------------------Players-------------------------*/
+
+
+// The alive player dealt a given role, NO_PLAYER if there is none
+static int engine_find_role(engine_t *engine, role_t role)
+{
+  bitset_t holders;
+  bitset_and(&holders, &engine->alive, &engine->by_role[role]);
+  return bitset_next(&holders, 0);
+} // engine_find_role
+
+
+
+// Set out to the players that are valid targets of a decision made by player
+void engine_targets(engine_t *engine, int player, decision_t decision, bitset_t *out)
+{
+  switch (decision)
+  {
+  // Anyone alive but themself
+  case DECIDE_SEER:
+  case DECIDE_GUARD:
+    *out = engine->alive;
+    bitset_clear(out, player);
+    break;
+
+  // They cannot kill a dead player or another werewolf
+  case DECIDE_WEREWOLF:
+    bitset_and_not(out, &engine->alive, &engine->by_role[ROLE_WEREWOLF]);
+    break;
+
+  // Only the player who is dying can be saved
+  case DECIDE_WITCH_SAVE:
+    bitset_clear_all(out);
+    if (engine->werewolf_k != NO_PLAYER)
+      bitset_set(out, engine->werewolf_k);
+    break;
+
+  // Anyone alive, themself included
+  case DECIDE_WITCH_KILL:
+  case DECIDE_HUNTER:
+  case DECIDE_VOTE:
+    *out = engine->alive;
+    break;
+
+  default:
+    bitset_clear_all(out);
+  }
+} // engine_targets
+
+
+
+// Pick one of players at random with the game's generator, or NO_PLAYER if there is none
+int engine_random_player(engine_t *engine, const bitset_t *players)
+{
+  int count = bitset_count(players);
+  if (count == 0)
+    return NO_PLAYER;
+
+  // Skip whole words by their popcount, then walk to the chosen member within its word
+  int skip = rng_below(&engine->rng, count);
+  int w = 0;
+  while (skip >= __builtin_popcountll(players->words[w]))
+    skip -= __builtin_popcountll(players->words[w++]);
+  int i = bitset_next(players, w * 64);
+  while (skip-- > 0)
+    i = bitset_next(players, i + 1);
+  return i;
+} // engine_random_player
+
+
+
+/*-------------------------Status-------------------------*/
+
+
+/* Check the game against the ending criteria and announce the outcome if one is met
+   Returns true if the game continues, false if otherwise. */
+static bool engine_check_status(engine_t *engine)
+{
+  // Tally alive werewolves and villagers
+  int aliveCount = bitset_count(&engine->alive);
+  int werewolfCount = bitset_count_and(&engine->alive, &engine->by_role[ROLE_WEREWOLF]);
+
+  outcome_t outcome;
+  if (werewolfCount == 0 && aliveCount == 0)
+    outcome = OUTCOME_NOBODY;
+  else if (werewolfCount == 0)
+    outcome = OUTCOME_VILLAGERS;
+  else if (werewolfCount >= (aliveCount + 1) / 2)
+    outcome = OUTCOME_WEREWOLVES;
+  else
+    return true;
+
+  engine->over = true;
+  engine_emit(engine, EVENT_GAME_OVER, NO_PLAYER, NO_PLAYER, outcome);
+  return false;
+} // engine_check_status
+
+
+
+/*-------------------------Actions-------------------------*/
+
+
+/* Make a decision player owes. Targets are player ids, or NO_PLAYER where the decision allows it.
+   Returns ENGINE_OK, ENGINE_INVALID or ENGINE_NOT_ASKED. */
+int engine_act(engine_t *engine, int player, decision_t decision, int target)
+{
+  if (engine->over || player < 0 || player >= engine->config.players || engine->owed[player] != decision)
+    return ENGINE_NOT_ASKED;
+
+  // Passing is only allowed where the rules let the player do nothing
+  bitset_t targets;
+  engine_targets(engine, player, decision, &targets);
+  bool pass = decision == DECIDE_WITCH_SAVE || decision == DECIDE_WITCH_KILL;
+  if (target == NO_PLAYER ? !pass : (target < 0 || target >= engine->config.players || !bitset_test(&targets, target)))
+    return ENGINE_INVALID;
+
+  engine->owed[player] = DECIDE_NOTHING;
+  switch (decision)
+  {
+  case DECIDE_SEER:
+    engine_emit(engine, EVENT_SEEN, player, target, engine->role[target]);
+    engine_task_done(engine, NIGHT_SEER);
+    break;
+
+  case DECIDE_WEREWOLF:
+    engine_werewolf_kill(engine, target);
+    break;
+
+  case DECIDE_GUARD:
+    engine->guarded = target;
+    engine_task_done(engine, NIGHT_GUARD);
+    break;
+
+  // If she saves, the dying player is cleared. Either way she is asked about her other potion.
+  case DECIDE_WITCH_SAVE:
+    if (target != NO_PLAYER)
+    {
+      engine->witch_save = false;
+      engine->werewolf_k = NO_PLAYER;
+    }
+    engine_witch_kill(engine);
+    break;
+
+  case DECIDE_WITCH_KILL:
+    if (target != NO_PLAYER)
+    {
+      engine->witch_kill = false;
+      engine->witch_k = target;
+    }
+    engine_task_done(engine, NIGHT_WITCH);
+    break;
+
+  // Whether the hunter dies is only known once the night is resolved
+  case DECIDE_HUNTER:
+    engine->hunter_mark = target;
+    engine_task_done(engine, NIGHT_HUNTER);
+    break;
+
+  case DECIDE_VOTE:
+    engine_tally(engine, target);
+    engine_drop_voter(engine, player);
+    break;
+
+  default:
+    break;
+  }
+  return ENGINE_OK;
+} // engine_act
+
+
+
+// Take the default for the decision player owes: a random victim for the werewolves, nothing for anyone else
+void engine_timeout(engine_t *engine, int player)
+{
+  decision_t decision = engine->owed[player];
+  if (engine->over || decision == DECIDE_NOTHING)
+    return;
+
+  bitset_t victims;
+  switch (decision)
+  {
+  case DECIDE_WEREWOLF:
+    engine_targets(engine, player, decision, &victims);
+    engine->owed[player] = DECIDE_NOTHING;
+    engine_werewolf_kill(engine, engine_random_player(engine, &victims));
+    break;
+
+  // Abstaining from a vote is just not voting
+  case DECIDE_VOTE:
+    engine->owed[player] = DECIDE_NOTHING;
+    engine_drop_voter(engine, player);
+    break;
+
+  // The witch saves and kills nobody tonight, even if she was only asked about one potion yet
+  case DECIDE_WITCH_SAVE:
+  case DECIDE_WITCH_KILL:
+    engine->owed[player] = DECIDE_NOTHING;
+    engine_task_done(engine, NIGHT_WITCH);
+    break;
+
+  case DECIDE_SEER:
+    engine->owed[player] = DECIDE_NOTHING;
+    engine_task_done(engine, NIGHT_SEER);
+    break;
+
+  case DECIDE_GUARD:
+    engine->owed[player] = DECIDE_NOTHING;
+    engine_task_done(engine, NIGHT_GUARD);
+    break;
+
+  case DECIDE_HUNTER:
+    engine->owed[player] = DECIDE_NOTHING;
+    engine_task_done(engine, NIGHT_HUNTER);
+    break;
+
+  default:
+    break;
+  }
+} // engine_timeout
+
+
+
+/*-------------------------Night-------------------------*/
+
+
+// Start a night: forget last night's choices and ask every role at once
+static void engine_night(engine_t *engine)
+{
+  engine->werewolf_k = NO_PLAYER;
+  engine->witch_k = NO_PLAYER;
+  engine->hunter_k = NO_PLAYER;
+  engine->guarded = NO_PLAYER;
+  engine->hunter_mark = NO_PLAYER;
+  engine_emit(engine, EVENT_NIGHT, NO_PLAYER, NO_PLAYER, 0);
+
+  // None of these choices depend on each other, so every role thinks at the same time. The witch
+  // is asked once the werewolves have chosen.
+  engine->night_pending = NIGHT_SEER | NIGHT_WEREWOLVES | NIGHT_GUARD | NIGHT_WITCH | NIGHT_HUNTER;
+
+  int seer = engine_find_role(engine, ROLE_SEER);
+  if (seer == NO_PLAYER)
+    engine_task_done(engine, NIGHT_SEER);
+  else
+    engine_ask(engine, seer, DECIDE_SEER);
+
+  int guard = engine_find_role(engine, ROLE_GUARD);
+  if (guard == NO_PLAYER)
+    engine_task_done(engine, NIGHT_GUARD);
+  else
+    engine_ask(engine, guard, DECIDE_GUARD);
+
+  int hunter = engine_find_role(engine, ROLE_HUNTER);
+  if (hunter == NO_PLAYER)
+    engine_task_done(engine, NIGHT_HUNTER);
+  else
+    engine_ask(engine, hunter, DECIDE_HUNTER);
+
+  // The first werewolf alive speaks for the pack. The game is over once there is none.
+  engine_ask(engine, engine_find_role(engine, ROLE_WEREWOLF), DECIDE_WEREWOLF);
+} // engine_night
+
+
+
+// Mark one of the night's tasks as done and resolve the night once none is left
+static void engine_task_done(engine_t *engine, int task)
+{
+  engine_emit(engine, EVENT_TASK_DONE, NO_PLAYER, NO_PLAYER, task);
+  engine->night_pending &= ~task;
+  if (engine->night_pending == 0)
+    engine_night_end(engine);
+} // engine_task_done
+
+
+
+// Store the werewolves' victim and tell the witch who is dying
+static void engine_werewolf_kill(engine_t *engine, int victim)
+{
+  engine->werewolf_k = victim;
+
+  int witch = engine_find_role(engine, ROLE_WITCH);
+  if (witch == NO_PLAYER)
+  {
+    engine_task_done(engine, NIGHT_WEREWOLVES);
+    engine_task_done(engine, NIGHT_WITCH);
+    return;
+  }
+
+  // She can only save once, and only if someone is dying
+  engine_emit(engine, EVENT_DYING, witch, victim, 0);
+  if (victim != NO_PLAYER && engine->witch_save)
+    engine_ask(engine, witch, DECIDE_WITCH_SAVE);
+  else
+  {
+    if (victim != NO_PLAYER)
+      engine_emit(engine, EVENT_NO_POTION, witch, NO_PLAYER, DECIDE_WITCH_SAVE);
+    engine_witch_kill(engine);
+  }
+  engine_task_done(engine, NIGHT_WEREWOLVES);
+} // engine_werewolf_kill
+
+
+
+// Ask the witch whether to use her kill potion, or finish her task if she cannot
+static void engine_witch_kill(engine_t *engine)
+{
+  int witch = engine_find_role(engine, ROLE_WITCH);
+  if (witch == NO_PLAYER)
+  {
+    engine_task_done(engine, NIGHT_WITCH);
+    return;
+  }
+
+  // She can only kill once
+  if (!engine->witch_kill)
+  {
+    engine_emit(engine, EVENT_NO_POTION, witch, NO_PLAYER, DECIDE_WITCH_KILL);
+    engine_task_done(engine, NIGHT_WITCH);
+    return;
+  }
+  engine_ask(engine, witch, DECIDE_WITCH_KILL);
+} // engine_witch_kill
+
+
+
+// Apply the guard's save and the hunter's mark, announce the deaths and start the day if the game continues
+static void engine_night_end(engine_t *engine)
+{
+  // A guarded player survives the werewolves
+  if (engine->guarded != NO_PLAYER && engine->guarded == engine->werewolf_k)
+    engine->werewolf_k = NO_PLAYER;
+
+  // If the hunter is killed during the night, their mark goes with them
+  int hunter = bitset_next(&engine->by_role[ROLE_HUNTER], 0);
+  if (hunter != -1 && (engine->witch_k == hunter || engine->werewolf_k == hunter))
+    engine->hunter_k = engine->hunter_mark;
+
+  // Announce every death, then mark the dead
+  int deaths[] = {engine->witch_k, engine->werewolf_k, engine->hunter_k};
+  role_t killers[] = {ROLE_WITCH, ROLE_WEREWOLF, ROLE_HUNTER};
+  int count = 0;
+  for (int i = 0; i < 3; i++)
+  {
+    if (deaths[i] == NO_PLAYER)
+      continue;
+    engine_emit(engine, EVENT_DIED, NO_PLAYER, deaths[i], killers[i]);
+    count++;
+  }
+  for (int i = 0; i < 3; i++)
+    if (deaths[i] != NO_PLAYER)
+      bitset_clear(&engine->alive, deaths[i]);
+  engine_emit(engine, EVENT_DAWN, NO_PLAYER, NO_PLAYER, count);
+
+  // If ending state is not reached, move on to day phase
+  if (engine_check_status(engine))
+    engine_emit(engine, EVENT_DAY, NO_PLAYER, NO_PLAYER, 0);
+} // engine_night_end
+
+
+
+/*-------------------------Day-------------------------*/
+
+
+// End the day's discussion: every living player owes a vote
+void engine_start_vote(engine_t *engine)
+{
+  if (engine->over)
+    return;
+
+  engine->most_votes = 0;
+  engine->leader = NO_PLAYER;
+  engine->leaders = 0;
+  engine->voters = engine->alive;
+  for (int i = bitset_next(&engine->voters, 0); i != -1; i = bitset_next(&engine->voters, i + 1))
+    engine->owed[i] = DECIDE_VOTE;
+
+  engine_emit(engine, EVENT_VOTE, NO_PLAYER, NO_PLAYER, 0);
+  if (bitset_next(&engine->voters, 0) == -1)
+    engine_day_end(engine);
+} // engine_start_vote
+
+
+
+// Count one vote, keeping the leader and ties exact
+static void engine_tally(engine_t *engine, int target)
+{
+  // Tallies only ever go up by one, so the lead is kept exactly by comparing against it alone
+  int votes = ++engine->votes_against[target];
+  if (votes > engine->most_votes)
+  {
+    engine->most_votes = votes;
+    engine->leader = target;
+    engine->leaders = 1;
+  }
+  else if (votes == engine->most_votes)
+    engine->leaders++;
+} // engine_tally
+
+
+
+// Take a player off the vote, which ends as soon as nobody is left to vote
+static void engine_drop_voter(engine_t *engine, int player)
+{
+  bitset_clear(&engine->voters, player);
+  if (bitset_next(&engine->voters, 0) == -1)
+    engine_day_end(engine);
+} // engine_drop_voter
+
+
+
+// Strike the votes against a player who left, and find the lead again among the living
+static void engine_drop_candidate(engine_t *engine, int player)
+{
+  if (engine->votes_against[player] == 0)
+    return;
+
+  engine->votes_against[player] = 0;
+  engine->most_votes = 0;
+  engine->leader = NO_PLAYER;
+  engine->leaders = 0;
+  for (int i = bitset_next(&engine->alive, 0); i != -1; i = bitset_next(&engine->alive, i + 1))
+  {
+    int votes = engine->votes_against[i];
+    if (votes == 0 || votes < engine->most_votes)
+      continue;
+    if (votes > engine->most_votes)
+    {
+      engine->most_votes = votes;
+      engine->leader = i;
+      engine->leaders = 0;
+    }
+    engine->leaders++;
+  }
+} // engine_drop_candidate
+
+
+
+// End the vote early. Everyone who has not voted abstains.
+void engine_end_vote(engine_t *engine)
+{
+  if (engine->over || bitset_next(&engine->voters, 0) == -1)
+    return;
+
+  for (int i = bitset_next(&engine->voters, 0); i != -1; i = bitset_next(&engine->voters, i + 1))
+    engine->owed[i] = DECIDE_NOTHING;
+  bitset_clear_all(&engine->voters);
+  engine_day_end(engine);
+} // engine_end_vote
+
+
+
+// Announce who was voted out, unless there is a tie, and start the next night if the game continues
+static void engine_day_end(engine_t *engine)
+{
+  // If it's a tie, or nobody voted, nobody dies
+  if (engine->leaders != 1)
+    engine_emit(engine, EVENT_TIE, NO_PLAYER, NO_PLAYER, 0);
+  else
+  {
+    bitset_clear(&engine->alive, engine->leader);
+    engine_emit(engine, EVENT_VOTED_OUT, NO_PLAYER, engine->leader, engine->role[engine->leader]);
+  }
+
+  // Set votes_against back to 0
+  memset(engine->votes_against, 0, engine->config.players * sizeof(int));
+
+  // Night phase follows if ending state is not reached
+  if (engine_check_status(engine))
+    engine_night(engine);
+} // engine_day_end
+
+
+
+/*-------------------------Saving-------------------------*/
+
+
+// Append n bytes to a saved engine
+static void save_bytes(unsigned char **at, const void *from, size_t n)
+{
+  memcpy(*at, from, n);
+  *at += n;
+} // save_bytes
+
+
+
+// Take n bytes of a saved engine. Returns false if fewer are left.
+static bool load_bytes(const unsigned char **at, const unsigned char *end, void *to, size_t n)
+{
+  if ((size_t)(end - *at) < n)
+    return false;
+  memcpy(to, *at, n);
+  *at += n;
+  return true;
+} // load_bytes
+
+
+
+// Clear the bits of a loaded set beyond the seats in use, which no player can be
+static void load_mask(bitset_t *set, int players)
+{
+  if (players % 64 != 0)
+    set->words[players / 64] &= (UINT64_C(1) << (players % 64)) - 1;
+} // load_mask
+
+
+
+// Whether a loaded event only names seats in use, and a role, decision or outcome that exists where it has one
+static bool load_event_valid(const engine_event_t *event, int players)
+{
+  if (event->player < NO_PLAYER || event->player >= players || event->target < NO_PLAYER || event->target >= players)
+    return false;
+
+  // Whoever runs the game looks these up by seat, role, decision or outcome
+  switch (event->kind)
+  {
+  case EVENT_ASK:
+    return event->player != NO_PLAYER && event->value > DECIDE_NOTHING && event->value <= DECIDE_VOTE;
+  case EVENT_SEEN:
+    return event->player != NO_PLAYER && event->target != NO_PLAYER && event->value >= 0 && event->value < ROLE_COUNT;
+  case EVENT_DYING:
+  case EVENT_NO_POTION:
+    return event->player != NO_PLAYER;
+  case EVENT_DIED:
+  case EVENT_VOTED_OUT:
+    return event->target != NO_PLAYER && event->value >= 0 && event->value < ROLE_COUNT;
+  case EVENT_GAME_OVER:
+    return event->value >= OUTCOME_NOBODY && event->value <= OUTCOME_WEREWOLVES;
+  default:
+    return true;
+  }
+} // load_event_valid
+
+
+
+/* Write everything the game depends on into out: the table, the generator, the state of the rules
+   and the events not taken yet. Fields are written one by one in host byte order, each as small as
+   it can be, and arrays only as far as the seats in use. */
+size_t engine_save(const engine_t *engine, void *out)
+{
+  unsigned char *at = out;
+  int players = engine->config.players;
+
+  int32_t table[1 + ROLE_COUNT] = {players};
+  for (int r = 0; r < ROLE_COUNT; r++)
+    table[1 + r] = engine->config.roles[r];
+  save_bytes(&at, table, sizeof(table));
+  save_bytes(&at, &engine->seed, sizeof(uint64_t));
+  save_bytes(&at, &engine->rng, sizeof(uint64_t));
+
+  uint8_t flags[3] = {engine->over, engine->witch_kill, engine->witch_save};
+  save_bytes(&at, flags, sizeof(flags));
+  int32_t night[9] = {engine->werewolf_k, engine->witch_k, engine->hunter_k, engine->guarded, engine->hunter_mark,
+                      engine->night_pending, engine->most_votes, engine->leader, engine->leaders};
+  save_bytes(&at, night, sizeof(night));
+
+  // One byte each for a seat's role and what it owes
+  for (int i = 0; i < players; i++)
+  {
+    uint8_t seat[2] = {engine->role[i], engine->owed[i]};
+    save_bytes(&at, seat, sizeof(seat));
+  }
+  for (int i = 0; i < players; i++)
+  {
+    int32_t votes = engine->votes_against[i];
+    save_bytes(&at, &votes, sizeof(votes));
+  }
+
+  // Only the words of the sets that can hold a seat
+  size_t words = (players + 63) / 64 * sizeof(uint64_t);
+  save_bytes(&at, engine->alive.words, words);
+  save_bytes(&at, engine->voters.words, words);
+  for (int r = 0; r < ROLE_COUNT; r++)
+    save_bytes(&at, engine->by_role[r].words, words);
+
+  // The queue is written oldest first, so it starts at the front of the ring once loaded
+  uint8_t count = engine->event_count;
+  save_bytes(&at, &count, sizeof(count));
+  for (int n = 0; n < engine->event_count; n++)
+  {
+    const engine_event_t *event = &engine->events[(engine->event_head + n) % ENGINE_MAX_EVENTS];
+    int32_t fields[4] = {event->kind, event->player, event->target, event->value};
+    save_bytes(&at, fields, sizeof(fields));
+  }
+  return at - (unsigned char *)out;
+} // engine_save
+
+
+
+// Set up engine from len bytes written by engine_save. Returns false if they are not a saved engine.
+bool engine_load(engine_t *engine, const void *in, size_t len)
+{
+  const unsigned char *at = in;
+  const unsigned char *end = at + len;
+
+  int32_t table[1 + ROLE_COUNT];
+  if (!load_bytes(&at, end, table, sizeof(table)) || table[0] < 2 || table[0] > MAX_USERS)
+    return false;
+  int players = table[0];
+  engine->config.players = players;
+  for (int r = 0; r < ROLE_COUNT; r++)
+    engine->config.roles[r] = table[1 + r];
+  if (!load_bytes(&at, end, &engine->seed, sizeof(uint64_t)) || !load_bytes(&at, end, &engine->rng, sizeof(uint64_t)))
+    return false;
+
+  uint8_t flags[3];
+  int32_t night[9];
+  if (!load_bytes(&at, end, flags, sizeof(flags)) || !load_bytes(&at, end, night, sizeof(night)))
+    return false;
+  engine->over = flags[0];
+  engine->witch_kill = flags[1];
+  engine->witch_save = flags[2];
+  int *fields[9] = {&engine->werewolf_k, &engine->witch_k, &engine->hunter_k, &engine->guarded, &engine->hunter_mark,
+                    &engine->night_pending, &engine->most_votes, &engine->leader, &engine->leaders};
+  for (int f = 0; f < 9; f++)
+    *fields[f] = night[f];
+
+  // Every player the rules point at must have a seat: the night's five choices and the vote's leader
+  for (int f = 0; f < 8; f++)
+    if ((f < 5 || f == 7) && (night[f] < NO_PLAYER || night[f] >= players))
+      return false;
+
+  for (int i = 0; i < players; i++)
+  {
+    uint8_t seat[2];
+    if (!load_bytes(&at, end, seat, sizeof(seat)) || seat[0] >= ROLE_COUNT || seat[1] > DECIDE_VOTE)
+      return false;
+    engine->role[i] = seat[0];
+    engine->owed[i] = seat[1];
+  }
+  for (int i = 0; i < players; i++)
+  {
+    int32_t votes;
+    if (!load_bytes(&at, end, &votes, sizeof(votes)))
+      return false;
+    engine->votes_against[i] = votes;
+  }
+
+  // No set may hold a seat beyond the table, and every seat is in the set of the role it was dealt
+  size_t words = (players + 63) / 64 * sizeof(uint64_t);
+  bitset_clear_all(&engine->alive);
+  bitset_clear_all(&engine->voters);
+  if (!load_bytes(&at, end, engine->alive.words, words) || !load_bytes(&at, end, engine->voters.words, words))
+    return false;
+  load_mask(&engine->alive, players);
+  load_mask(&engine->voters, players);
+  for (int r = 0; r < ROLE_COUNT; r++)
+  {
+    bitset_clear_all(&engine->by_role[r]);
+    if (!load_bytes(&at, end, engine->by_role[r].words, words))
+      return false;
+    load_mask(&engine->by_role[r], players);
+    for (int i = 0; i < players; i++)
+      if (bitset_test(&engine->by_role[r], i) != (engine->role[i] == (role_t)r))
+        return false;
+  }
+
+  uint8_t count;
+  if (!load_bytes(&at, end, &count, sizeof(count)) || count > ENGINE_MAX_EVENTS)
+    return false;
+  engine->event_head = 0;
+  engine->event_count = count;
+  for (int n = 0; n < count; n++)
+  {
+    int32_t event[4];
+    if (!load_bytes(&at, end, event, sizeof(event)) || event[0] < EVENT_NIGHT || event[0] > EVENT_GAME_OVER)
+      return false;
+    engine->events[n] = (engine_event_t){.kind = event[0], .player = event[1], .target = event[2], .value = event[3]};
+    if (!load_event_valid(&engine->events[n], players))
+      return false;
+  }
+  return at == end;
+} // engine_load
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "bitset.h"
+
+
+/*-----------------------------------------MACROS-----------------------------------------*/
+
+
+#define NO_PLAYER -1 // player id meaning nobody
+#define DEFAULT_USERS 7 // Number of users in one game unless configured otherwise
+#define MAX_USERS 512 // Most users one game can seat
+#define ENGINE_MAX_EVENTS 64 // Events queued at once. One step of the rules queues well under 20.
+#define ENGINE_SAVE_MAX sizeof(engine_t) // Bytes a saved engine can take, which is never more than the engine
+
+// Tasks a night waits for before it is resolved, as bits of night_pending
+#define NIGHT_SEER 0x01
+#define NIGHT_WEREWOLVES 0x02
+#define NIGHT_GUARD 0x04
+#define NIGHT_WITCH 0x08 // done once the witch has decided about both potions
+#define NIGHT_HUNTER 0x10
+
+// What engine_act makes of an action
+#define ENGINE_OK 0
+#define ENGINE_INVALID -1   // the target is not allowed; the player still owes the decision
+#define ENGINE_NOT_ASKED -2 // the player does not owe that decision
+
+
+/*-----------------------------------------TYPES-----------------------------------------*/
+
+
+// The roles a player can be dealt
+typedef enum role
+{
+  ROLE_WEREWOLF,
+  ROLE_GUARD,
+  ROLE_WITCH,
+  ROLE_HUNTER,
+  ROLE_SEER,
+  ROLE_VILLAGER,
+  ROLE_COUNT
+} role_t;
+
+// Every role's name, as players see it
+extern const char *const role_names[ROLE_COUNT];
+
+// How many players a table seats and how many of them are dealt each role. Every seat without
+// another role gets a villager. The seer, guard, witch and hunter are each dealt at most once.
+typedef struct game_config
+{
+  int players;
+  int roles[ROLE_COUNT]; // ROLE_VILLAGER's count is whatever the other roles leave over
+} game_config_t;
+
+// Decisions the rules ask players for
+typedef enum decision
+{
+  DECIDE_NOTHING,    // the player owes no decision
+  DECIDE_SEER,       // whose role to see
+  DECIDE_WEREWOLF,   // who the werewolves kill
+  DECIDE_GUARD,      // who to protect tonight
+  DECIDE_WITCH_SAVE, // whether to save the dying player: them, or NO_PLAYER
+  DECIDE_WITCH_KILL, // who to poison, or NO_PLAYER
+  DECIDE_HUNTER,     // who to take down if the hunter dies tonight
+  DECIDE_VOTE        // who to vote out
+} decision_t;
+
+// How a game ended
+typedef enum outcome
+{
+  OUTCOME_NOBODY,    // everyone is dead
+  OUTCOME_VILLAGERS, // every werewolf is dead
+  OUTCOME_WEREWOLVES // werewolves are at least half of the living
+} outcome_t;
+
+// What the rules tell the outside world
+typedef enum event_kind
+{
+  EVENT_NIGHT,     // a night has started
+  EVENT_ASK,       // player owes decision value. For the werewolves, player speaks for the pack.
+  EVENT_SEEN,      // the seer, player, learns that target is dealt role value
+  EVENT_DYING,     // the witch, player, learns the werewolves' victim: target, NO_PLAYER if none
+  EVENT_NO_POTION, // the witch, player, has used the potion of decision value already
+  EVENT_TASK_DONE, // the NIGHT_* task value is finished
+  EVENT_DIED,      // target died in the night, killed by whoever was dealt role value
+  EVENT_DAWN,      // the night is over, with value deaths announced just before
+  EVENT_DAY,       // the day's discussion has started
+  EVENT_VOTE,      // every living player owes a vote
+  EVENT_VOTED_OUT, // target was voted out, and was dealt role value
+  EVENT_TIE,       // the vote ended without a single leader, so nobody dies
+  EVENT_GAME_OVER  // the game ended with outcome value
+} event_kind_t;
+
+// One thing that happened, in the order it happened
+typedef struct engine_event
+{
+  event_kind_t kind;
+  int player; // who the event is for or about, NO_PLAYER if nobody in particular
+  int target; // the other player it involves, NO_PLAYER if none
+  int value;  // a role_t, decision_t, NIGHT_* task, count or outcome_t, depending on kind
+} engine_event_t;
+
+/* The rules of one game, without sockets, timers or text. Actions go in through engine_act and
+   engine_timeout, and everything that follows from them comes out as events, in order, through
+   engine_next_event. Given the same seed and actions, a game always unfolds the same way. */
+typedef struct engine
+{
+  game_config_t config;
+  uint64_t seed;                // what rng started from, so the game can be played again
+  uint64_t rng;                 // splitmix64 state behind the deal and random defaults
+  bool over;
+
+  role_t role[MAX_USERS];
+  decision_t owed[MAX_USERS];   // decision each player has been asked for and not made yet
+  int votes_against[MAX_USERS]; // tally of the current vote
+
+  bitset_t alive;               // players still in the game
+  bitset_t by_role[ROLE_COUNT]; // players dealt each role, alive or not
+
+  bool witch_kill; // whether the witch still has her kill potion
+  bool witch_save; // whether the witch still has her save potion
+
+  // Choices made during the current night, NO_PLAYER when nobody is affected
+  int werewolf_k;    // player killed by the werewolves (cleared if guarded or saved)
+  int witch_k;       // player killed by the witch
+  int hunter_k;      // player taken down by the hunter
+  int guarded;       // player the guard protects
+  int hunter_mark;   // player the hunter takes down if they die tonight
+  int night_pending; // NIGHT_* tasks still waiting for a decision
+
+  // The day's vote, tallied as the votes come in
+  bitset_t voters;  // living players who have not voted yet
+  int most_votes;   // highest number of votes against any one player
+  int leader;       // a player with most_votes against them
+  int leaders;      // number of players with most_votes against them
+
+  // Events not taken yet, as a ring
+  engine_event_t events[ENGINE_MAX_EVENTS];
+  int event_head;
+  int event_count;
+} engine_t;
+
+
+/*-----------------------------------------FUNCTIONS HEADERS-----------------------------------------*/
+
+
+// Fill in the classic table for a number of players: about a quarter of them werewolves, then one
+// guard, witch, hunter and seer as long as there are seats left, and villagers for the rest
+void game_config_default(game_config_t *config, int players);
+
+/* Set up a table of players seats, dealt the default roles for that many players except for the
+   counts given in roles, a list like "werewolf=40,seer=1,hunter=0"
+   Returns false, after saying why on stderr, if the table cannot be played. */
+bool game_config_parse(game_config_t *config, int players, char *roles);
+
+// Set up a game for config's table and deal every seat its role, shuffled with seed
+void engine_init(engine_t *engine, const game_config_t *config, uint64_t seed);
+
+// Start the game with its first night, or end it at once if the deal already decides it
+void engine_start(engine_t *engine);
+
+/* Make a decision player owes. Targets are player ids, or NO_PLAYER where the decision allows it.
+   Returns ENGINE_OK, ENGINE_INVALID or ENGINE_NOT_ASKED. */
+int engine_act(engine_t *engine, int player, decision_t decision, int target);
+
+// Take the default for the decision player owes: a random victim for the werewolves, nothing for anyone else
+void engine_timeout(engine_t *engine, int player);
+
+// End the day's discussion: every living player owes a vote
+void engine_start_vote(engine_t *engine);
+
+// End the vote early. Everyone who has not voted abstains.
+void engine_end_vote(engine_t *engine);
+
+/* Take a player out of the game for good, as if dead, without announcing anything. Whatever they
+   owe is settled the way engine_timeout settles it, and the game ends if that decides it. */
+void engine_leave(engine_t *engine, int player);
+
+// Set out to the players that are valid targets of a decision made by player
+void engine_targets(engine_t *engine, int player, decision_t decision, bitset_t *out);
+
+// Pick one of players at random with the game's generator, or NO_PLAYER if there is none
+int engine_random_player(engine_t *engine, const bitset_t *players);
+
+// Take the oldest event not taken yet. Returns false if there is none.
+bool engine_next_event(engine_t *engine, engine_event_t *event);
+
+// Put the event engine_next_event took last back, so it is the next one taken again
+void engine_unread(engine_t *engine);
+
+/* Write everything the game depends on into out, which must hold ENGINE_SAVE_MAX bytes: the table,
+   the generator, the state of the rules and the events not taken yet. Only the seats in use are
+   written, so a small table saves in a few hundred bytes. Returns the number of bytes written. */
+size_t engine_save(const engine_t *engine, void *out);
+
+/* Set up engine from len bytes written by engine_save, in the state it was saved in.
+   Returns false if they are not a saved engine. */
+bool engine_load(engine_t *engine, const void *in, size_t len);
@@ -0,0 +1,637 @@
+/*-----------------------------------------LIBRARY-----------------------------------------*/
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "engine.h"
+#include "util.h"
+
+
+/*-----------------------------------------GLOBAL VALUES-----------------------------------------*/
+
+
+/* Tests of the rules engine. Every game is dealt from a fixed seed and played by hand, one decision
+   at a time, and the events that follow are checked against the rules. Prints every failed check
+   and one line of totals, and exits non-zero if anything failed. */
+
+#define TEST_SEED 42 // Seed every game is dealt from
+#define TEST_MAX_EVENTS 256 // Events kept from one step of a test
+#define ANY -2 // Matches any player, target or value in count_events
+
+// Run a check, noting where it failed
+#define CHECK(cond) check((cond), #cond, __func__, __LINE__)
+
+// The events one step of a test produced, in order
+typedef struct seen
+{
+  engine_event_t events[TEST_MAX_EVENTS];
+  int count;
+} seen_t;
+
+int checks;
+int failures;
+
+
+/*-----------------------------------------FUNCTIONS HEADERS-----------------------------------------*/
+
+
+/*----------Helpers----------*/
+
+// Count a check, and say where it was if it failed
+void check(bool ok, const char *what, const char *test, int line);
+
+// Take every queued event into s, after the ones already there
+void drain(engine_t *engine, seen_t *s);
+
+// Number of events in s of a kind whose fields match, ANY matching every value of a field
+int count_events(const seen_t *s, event_kind_t kind, int player, int target, int value);
+
+// The first event of a kind in s, or NULL if there is none
+const engine_event_t *find_event(const seen_t *s, event_kind_t kind);
+
+/* Deal a table of players seats with the roles given like the server's -r, NULL for the default,
+   start the game and take the events of its start into s */
+void start_game(engine_t *engine, int players, const char *roles, seen_t *s);
+
+// The nth seat dealt a role, counting from 0, or NO_PLAYER if there are fewer
+int seat(const engine_t *engine, role_t role, int nth);
+
+/* Play a night in which every role that is asked answers: the guard protects guarded, the
+   werewolves kill victim, the witch saves if save and poisons poisoned, and the hunter marks
+   marked. The seer looks at the first other player alive. The night's events are in s. */
+void play_night(engine_t *engine, seen_t *s, int guarded, int victim, bool save, int poisoned, int marked);
+
+/* Start the vote and have every voter vote for target, except the first abstain of them, who are
+   left owing their vote. The events are in s. */
+void play_vote(engine_t *engine, seen_t *s, int target, int abstain);
+
+/*----------Tests----------*/
+
+// A guarded player survives the werewolves, anyone else they choose dies
+void test_guard(void);
+
+// The witch saves the dying player once and poisons once, and is told when a potion is gone
+void test_witch(void);
+
+// A hunter killed in the night takes their mark with them. One who survives takes nobody.
+void test_hunter(void);
+
+// A single leader is voted out, a tie takes nobody, and a vote ends as soon as it is all in
+void test_vote(void);
+
+// The game ends when the werewolves are at least half of the living, when none is left, or when everyone is dead
+void test_win_thresholds(void);
+
+// A decision nobody makes takes its default: a random victim for the werewolves, nothing for anyone else
+void test_timeout(void);
+
+// A leaver's decision is settled as a timeout would settle it, and the game ends at once if losing them decides it
+void test_leave(void);
+
+// A leader who leaves mid-vote is not voted out: the votes against them no longer count
+void test_leader_leaves(void);
+
+// The same seed and the same decisions play out the same game
+void test_deterministic(void);
+
+
+/*-----------------------------------------FUNCTIONS-----------------------------------------*/
+
+
+/*-------------------------Helpers-------------------------*/
+
+
+// Count a check, and say where it was if it failed
+void check(bool ok, const char *what, const char *test, int line)
+{
+  checks++;
+  if (!ok)
+  {
+    failures++;
+    fprintf(stderr, "%s:%d: %s\n", test, line, what);
+  }
+} // check
+
+
+
+// Take every queued event into s, after the ones already there
+void drain(engine_t *engine, seen_t *s)
+{
+  engine_event_t event;
+  while (engine_next_event(engine, &event))
+    if (s->count < TEST_MAX_EVENTS)
+      s->events[s->count++] = event;
+} // drain
+
+
+
+// Number of events in s of a kind whose fields match, ANY matching every value of a field
+int count_events(const seen_t *s, event_kind_t kind, int player, int target, int value)
+{
+  int count = 0;
+  for (int i = 0; i < s->count; i++)
+  {
+    const engine_event_t *e = &s->events[i];
+    if (e->kind == kind && (player == ANY || e->player == player) && (target == ANY || e->target == target) &&
+        (value == ANY || e->value == value))
+      count++;
+  }
+  return count;
+} // count_events
+
+
+
+// The first event of a kind in s, or NULL if there is none
+const engine_event_t *find_event(const seen_t *s, event_kind_t kind)
+{
+  for (int i = 0; i < s->count; i++)
+    if (s->events[i].kind == kind)
+      return &s->events[i];
+  return NULL;
+} // find_event
+
+
+
+// Deal a table, start the game and take the events of its start into s
+void start_game(engine_t *engine, int players, const char *roles, seen_t *s)
+{
+  game_config_t config;
+  char spec[128];
+  snprintf(spec, sizeof(spec), "%s", roles == NULL ? "" : roles);
+  if (!game_config_parse(&config, players, roles == NULL ? NULL : spec))
+  {
+    fprintf(stderr, "Cannot deal %d players with %s\n", players, spec);
+    exit(EXIT_FAILURE);
+  }
+  engine_init(engine, &config, TEST_SEED);
+  engine_start(engine);
+  s->count = 0;
+  drain(engine, s);
+} // start_game
+
+
+
+// The nth seat dealt a role, counting from 0, or NO_PLAYER if there are fewer
+int seat(const engine_t *engine, role_t role, int nth)
+{
+  for (int i = 0; i < engine->config.players; i++)
+    if (engine->role[i] == role && nth-- == 0)
+      return i;
+  return NO_PLAYER;
+} // seat
+
+
+
+// Play a night in which every role that is asked answers with the given choices
+void play_night(engine_t *engine, seen_t *s, int guarded, int victim, bool save, int poisoned, int marked)
+{
+  s->count = 0;
+  for (int i = 0; i < engine->config.players; i++)
+  {
+    int target;
+    switch (engine->owed[i])
+    {
+    case DECIDE_SEER:
+      target = bitset_next(&engine->alive, 0) == i ? bitset_next(&engine->alive, i + 1) : bitset_next(&engine->alive, 0);
+      break;
+    case DECIDE_GUARD:
+      target = guarded;
+      break;
+    case DECIDE_HUNTER:
+      target = marked;
+      break;
+    case DECIDE_WEREWOLF:
+      target = victim;
+      break;
+    default:
+      continue;
+    }
+    CHECK(engine_act(engine, i, engine->owed[i], target) == ENGINE_OK);
+  }
+  drain(engine, s);
+
+  // The witch is asked once the werewolves have chosen, and about her kill once she has decided on saving
+  int witch = seat(engine, ROLE_WITCH, 0);
+  if (witch != NO_PLAYER && engine->owed[witch] == DECIDE_WITCH_SAVE)
+    CHECK(engine_act(engine, witch, DECIDE_WITCH_SAVE, save ? victim : NO_PLAYER) == ENGINE_OK);
+  if (witch != NO_PLAYER && engine->owed[witch] == DECIDE_WITCH_KILL)
+    CHECK(engine_act(engine, witch, DECIDE_WITCH_KILL, poisoned) == ENGINE_OK);
+  drain(engine, s);
+} // play_night
+
+
+
+// Start the vote and have every voter but the first abstain of them vote for target
+void play_vote(engine_t *engine, seen_t *s, int target, int abstain)
+{
+  s->count = 0;
+  engine_start_vote(engine);
+  bitset_t voters = engine->voters;
+  for (int i = bitset_next(&voters, 0); i != -1; i = bitset_next(&voters, i + 1))
+  {
+    if (abstain-- > 0)
+      continue;
+    CHECK(engine_act(engine, i, DECIDE_VOTE, target) == ENGINE_OK);
+  }
+  drain(engine, s);
+} // play_vote
+
+
+
+/*-------------------------Night-------------------------*/
+
+
+// A guarded player survives the werewolves, anyone else they choose dies
+void test_guard(void)
+{
+  static engine_t engine;
+  seen_t s;
+  start_game(&engine, 7, NULL, &s);
+  int villager = seat(&engine, ROLE_VILLAGER, 0);
+  int seer = seat(&engine, ROLE_SEER, 0);
+  CHECK(count_events(&s, EVENT_NIGHT, ANY, ANY, ANY) == 1);
+  CHECK(count_events(&s, EVENT_ASK, seat(&engine, ROLE_GUARD, 0), NO_PLAYER, DECIDE_GUARD) == 1);
+
+  play_night(&engine, &s, villager, villager, false, NO_PLAYER, seer);
+  CHECK(count_events(&s, EVENT_DIED, ANY, ANY, ANY) == 0);
+  CHECK(count_events(&s, EVENT_DAWN, ANY, ANY, 0) == 1);
+  CHECK(count_events(&s, EVENT_DAY, ANY, ANY, ANY) == 1);
+  CHECK(bitset_test(&engine.alive, villager));
+
+  // The guard cannot protect themself, and a choice nobody owes is refused
+  start_game(&engine, 7, NULL, &s);
+  int guard = seat(&engine, ROLE_GUARD, 0);
+  CHECK(engine_act(&engine, guard, DECIDE_GUARD, guard) == ENGINE_INVALID);
+  CHECK(engine_act(&engine, villager, DECIDE_GUARD, seer) == ENGINE_NOT_ASKED);
+
+  play_night(&engine, &s, seer, villager, false, NO_PLAYER, seer);
+  CHECK(count_events(&s, EVENT_DIED, NO_PLAYER, villager, ROLE_WEREWOLF) == 1);
+  CHECK(count_events(&s, EVENT_DAWN, ANY, ANY, 1) == 1);
+  CHECK(!bitset_test(&engine.alive, villager));
+} // test_guard
+
+
+
+// The witch saves the dying player once and poisons once, and is told when a potion is gone
+void test_witch(void)
+{
+  static engine_t engine;
+  seen_t s;
+  start_game(&engine, 7, NULL, &s);
+  int witch = seat(&engine, ROLE_WITCH, 0);
+  int villager = seat(&engine, ROLE_VILLAGER, 0);
+  int seer = seat(&engine, ROLE_SEER, 0);
+  int second_wolf = seat(&engine, ROLE_WEREWOLF, 1);
+
+  play_night(&engine, &s, seer, villager, true, second_wolf, seer);
+  CHECK(count_events(&s, EVENT_DYING, witch, villager, ANY) == 1);
+  CHECK(count_events(&s, EVENT_DIED, NO_PLAYER, villager, ANY) == 0);
+  CHECK(count_events(&s, EVENT_DIED, NO_PLAYER, second_wolf, ROLE_WITCH) == 1);
+  CHECK(!engine.witch_save && !engine.witch_kill);
+  CHECK(bitset_test(&engine.alive, villager) && !bitset_test(&engine.alive, second_wolf));
+
+  // Nobody is voted out, and the next night she has no potion left to use
+  play_vote(&engine, &s, NO_PLAYER, engine.config.players);
+  engine_end_vote(&engine);
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_TIE, ANY, ANY, ANY) == 1);
+  play_night(&engine, &s, villager, seer, true, villager, villager);
+  CHECK(count_events(&s, EVENT_NO_POTION, witch, NO_PLAYER, DECIDE_WITCH_SAVE) == 1);
+  CHECK(count_events(&s, EVENT_NO_POTION, witch, NO_PLAYER, DECIDE_WITCH_KILL) == 1);
+  CHECK(count_events(&s, EVENT_ASK, witch, ANY, ANY) == 0);
+  CHECK(count_events(&s, EVENT_DIED, NO_PLAYER, seer, ROLE_WEREWOLF) == 1);
+} // test_witch
+
+
+
+// A hunter killed in the night takes their mark with them. One who survives takes nobody.
+void test_hunter(void)
+{
+  static engine_t engine;
+  seen_t s;
+  start_game(&engine, 7, NULL, &s);
+  int hunter = seat(&engine, ROLE_HUNTER, 0);
+  int seer = seat(&engine, ROLE_SEER, 0);
+  int villager = seat(&engine, ROLE_VILLAGER, 0);
+  int second_wolf = seat(&engine, ROLE_WEREWOLF, 1);
+
+  play_night(&engine, &s, seer, hunter, false, NO_PLAYER, second_wolf);
+  CHECK(count_events(&s, EVENT_DIED, NO_PLAYER, hunter, ROLE_WEREWOLF) == 1);
+  CHECK(count_events(&s, EVENT_DIED, NO_PLAYER, second_wolf, ROLE_HUNTER) == 1);
+  CHECK(count_events(&s, EVENT_DAWN, ANY, ANY, 2) == 1);
+  CHECK(!bitset_test(&engine.alive, second_wolf));
+
+  start_game(&engine, 7, NULL, &s);
+  play_night(&engine, &s, seer, villager, false, NO_PLAYER, second_wolf);
+  CHECK(count_events(&s, EVENT_DIED, ANY, ANY, ANY) == 1);
+  CHECK(bitset_test(&engine.alive, second_wolf));
+} // test_hunter
+
+
+
+/*-------------------------Day-------------------------*/
+
+
+// A single leader is voted out, a tie takes nobody, and a vote ends as soon as it is all in
+void test_vote(void)
+{
+  static engine_t engine;
+  seen_t s;
+  start_game(&engine, 7, NULL, &s);
+  int villager = seat(&engine, ROLE_VILLAGER, 0);
+  int seer = seat(&engine, ROLE_SEER, 0);
+  play_night(&engine, &s, villager, villager, false, NO_PLAYER, seer);
+
+  // Three votes each for two players, and the last one abstains by letting the deadline pass
+  engine_start_vote(&engine);
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_VOTE, ANY, ANY, ANY) == 1);
+  int n = 0;
+  int last = NO_PLAYER;
+  for (int i = bitset_next(&engine.voters, 0); i != -1; i = bitset_next(&engine.voters, i + 1), n++)
+  {
+    if (n < 6)
+      CHECK(engine_act(&engine, i, DECIDE_VOTE, n % 2 == 0 ? villager : seer) == ENGINE_OK);
+    else
+      last = i;
+  }
+  CHECK(engine_act(&engine, bitset_next(&engine.alive, 0), DECIDE_VOTE, villager) == ENGINE_NOT_ASKED);
+  s.count = 0;
+  drain(&engine, &s);
+  CHECK(find_event(&s, EVENT_TIE) == NULL);
+  engine_timeout(&engine, last);
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_TIE, ANY, ANY, ANY) == 1);
+  CHECK(count_events(&s, EVENT_VOTED_OUT, ANY, ANY, ANY) == 0);
+  CHECK(count_events(&s, EVENT_NIGHT, ANY, ANY, ANY) == 1);
+  CHECK(bitset_count(&engine.alive) == 7);
+
+  // One vote more for the villager than for anyone else, and the last vote ends the day at once
+  play_night(&engine, &s, villager, villager, false, NO_PLAYER, seer);
+  engine_start_vote(&engine);
+  n = 0;
+  for (int i = bitset_next(&engine.voters, 0); i != -1; i = bitset_next(&engine.voters, i + 1), n++)
+    CHECK(engine_act(&engine, i, DECIDE_VOTE, n < 4 ? villager : seer) == ENGINE_OK);
+  s.count = 0;
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_VOTED_OUT, NO_PLAYER, villager, ROLE_VILLAGER) == 1);
+  CHECK(!bitset_test(&engine.alive, villager));
+  CHECK(engine_act(&engine, seer, DECIDE_VOTE, villager) == ENGINE_NOT_ASKED);
+
+  // Nobody can vote for the dead
+  play_night(&engine, &s, seer, seer, false, NO_PLAYER, seer);
+  engine_start_vote(&engine);
+  int voter = bitset_next(&engine.voters, 0);
+  CHECK(engine_act(&engine, voter, DECIDE_VOTE, villager) == ENGINE_INVALID);
+  CHECK(engine.owed[voter] == DECIDE_VOTE);
+} // test_vote
+
+
+
+/*-------------------------Status-------------------------*/
+
+
+// The game ends when the werewolves are at least half of the living, when none is left, or when everyone is dead
+void test_win_thresholds(void)
+{
+  static engine_t engine;
+  seen_t s;
+  const char *lone_wolf = "werewolf=1,guard=0,witch=0,hunter=0,seer=0";
+
+  // One werewolf of two is half already
+  start_game(&engine, 2, lone_wolf, &s);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, OUTCOME_WEREWOLVES) == 1);
+  CHECK(count_events(&s, EVENT_NIGHT, ANY, ANY, ANY) == 0);
+  CHECK(engine.over);
+
+  // One of three is not, so the game goes on until the day's vote decides it either way
+  start_game(&engine, 4, lone_wolf, &s);
+  int wolf = seat(&engine, ROLE_WEREWOLF, 0);
+  int villager = seat(&engine, ROLE_VILLAGER, 0);
+  play_night(&engine, &s, NO_PLAYER, villager, false, NO_PLAYER, NO_PLAYER);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, ANY) == 0);
+  CHECK(count_events(&s, EVENT_DAY, ANY, ANY, ANY) == 1);
+  play_vote(&engine, &s, wolf, 0);
+  CHECK(count_events(&s, EVENT_VOTED_OUT, NO_PLAYER, wolf, ROLE_WEREWOLF) == 1);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, OUTCOME_VILLAGERS) == 1);
+  CHECK(engine.over);
+
+  start_game(&engine, 4, lone_wolf, &s);
+  villager = seat(&engine, ROLE_VILLAGER, 0);
+  play_night(&engine, &s, NO_PLAYER, villager, false, NO_PLAYER, NO_PLAYER);
+  play_vote(&engine, &s, seat(&engine, ROLE_VILLAGER, 1), 0);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, OUTCOME_WEREWOLVES) == 1);
+  CHECK(engine_act(&engine, wolf, DECIDE_WEREWOLF, villager) == ENGINE_NOT_ASKED);
+
+  // The werewolves kill the hunter, who takes the witch, who poisons the werewolf
+  start_game(&engine, 3, "werewolf=1,guard=0,witch=1,hunter=1,seer=0", &s);
+  wolf = seat(&engine, ROLE_WEREWOLF, 0);
+  int witch = seat(&engine, ROLE_WITCH, 0);
+  play_night(&engine, &s, NO_PLAYER, seat(&engine, ROLE_HUNTER, 0), false, wolf, witch);
+  CHECK(count_events(&s, EVENT_DIED, ANY, ANY, ANY) == 3);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, OUTCOME_NOBODY) == 1);
+  CHECK(bitset_count(&engine.alive) == 0);
+} // test_win_thresholds
+
+
+
+/*-------------------------Absent Players-------------------------*/
+
+
+// A decision nobody makes takes its default: a random victim for the werewolves, nothing for anyone else
+void test_timeout(void)
+{
+  static engine_t engine;
+  seen_t s;
+  start_game(&engine, 7, NULL, &s);
+  int wolf = seat(&engine, ROLE_WEREWOLF, 0);
+  int witch = seat(&engine, ROLE_WITCH, 0);
+
+  s.count = 0;
+  engine_timeout(&engine, wolf);
+  drain(&engine, &s);
+  const engine_event_t *dying = find_event(&s, EVENT_DYING);
+  CHECK(dying != NULL && dying->target != NO_PLAYER && engine.role[dying->target] != ROLE_WEREWOLF);
+  CHECK(engine.owed[wolf] == DECIDE_NOTHING && engine.owed[witch] == DECIDE_WITCH_SAVE);
+  if (dying == NULL)
+    return;
+  int victim = dying->target;
+
+  // The witch saves nobody and kills nobody, and the others let their time run out too
+  for (int i = 0; i < engine.config.players; i++)
+    engine_timeout(&engine, i);
+  drain(&engine, &s);
+  CHECK(engine.witch_save && engine.witch_kill);
+  CHECK(count_events(&s, EVENT_DIED, NO_PLAYER, victim, ROLE_WEREWOLF) == 1);
+  CHECK(count_events(&s, EVENT_DIED, ANY, ANY, ANY) == 1);
+  CHECK(count_events(&s, EVENT_DAY, ANY, ANY, ANY) == 1);
+
+  // A timeout for someone who owes nothing changes nothing
+  s.count = 0;
+  engine_timeout(&engine, wolf);
+  drain(&engine, &s);
+  CHECK(s.count == 0);
+} // test_timeout
+
+
+
+// A leaver's decision is settled as a timeout would settle it, and the game ends at once if losing them decides it
+void test_leave(void)
+{
+  static engine_t engine;
+  seen_t s;
+
+  // The werewolf speaking for the pack leaves: the pack's victim is picked for them and the night goes on
+  start_game(&engine, 7, NULL, &s);
+  int wolf = seat(&engine, ROLE_WEREWOLF, 0);
+  s.count = 0;
+  engine_leave(&engine, wolf);
+  drain(&engine, &s);
+  CHECK(!bitset_test(&engine.alive, wolf));
+  CHECK(engine.owed[wolf] == DECIDE_NOTHING);
+  CHECK(count_events(&s, EVENT_DYING, ANY, ANY, ANY) == 1);
+  CHECK(count_events(&s, EVENT_TASK_DONE, ANY, ANY, NIGHT_WEREWOLVES) == 1);
+  CHECK(!engine.over);
+
+  // A voter who leaves is not waited for: the vote ends with the last of the others
+  start_game(&engine, 7, NULL, &s);
+  int villager = seat(&engine, ROLE_VILLAGER, 0);
+  int seer = seat(&engine, ROLE_SEER, 0);
+  play_night(&engine, &s, villager, villager, false, NO_PLAYER, seer);
+  engine_start_vote(&engine);
+  int leaver = bitset_next(&engine.voters, 0);
+  for (int i = bitset_next(&engine.voters, leaver + 1); i != -1; i = bitset_next(&engine.voters, i + 1))
+    CHECK(engine_act(&engine, i, DECIDE_VOTE, villager == i ? seer : villager) == ENGINE_OK);
+  s.count = 0;
+  drain(&engine, &s);
+  CHECK(find_event(&s, EVENT_VOTED_OUT) == NULL);
+  engine_leave(&engine, leaver);
+  drain(&engine, &s);
+  CHECK(engine.owed[leaver] == DECIDE_NOTHING);
+  CHECK(bitset_next(&engine.voters, 0) == -1);
+  CHECK(count_events(&s, EVENT_VOTED_OUT, NO_PLAYER, villager, ROLE_VILLAGER) == 1);
+
+  // The last werewolf leaves: the villagers have won, without waiting for the night to end
+  start_game(&engine, 4, "werewolf=1,guard=1,witch=0,hunter=0,seer=0", &s);
+  wolf = seat(&engine, ROLE_WEREWOLF, 0);
+  s.count = 0;
+  engine_leave(&engine, wolf);
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, OUTCOME_VILLAGERS) == 1);
+  CHECK(engine.over);
+  CHECK(engine_act(&engine, seat(&engine, ROLE_GUARD, 0), DECIDE_GUARD, villager) == ENGINE_NOT_ASKED);
+
+  // Enough villagers leave that the werewolves are half of the living: one of three is not yet, one of two is
+  start_game(&engine, 5, "werewolf=1,guard=0,witch=0,hunter=0,seer=0", &s);
+  s.count = 0;
+  engine_leave(&engine, seat(&engine, ROLE_VILLAGER, 0));
+  engine_leave(&engine, seat(&engine, ROLE_VILLAGER, 1));
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, ANY) == 0);
+  engine_leave(&engine, seat(&engine, ROLE_VILLAGER, 2));
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_GAME_OVER, ANY, ANY, OUTCOME_WEREWOLVES) == 1);
+} // test_leave
+
+
+
+// A leader who leaves mid-vote is not voted out: the votes against them no longer count
+void test_leader_leaves(void)
+{
+  static engine_t engine;
+  seen_t s;
+  start_game(&engine, 7, NULL, &s);
+  int villager = seat(&engine, ROLE_VILLAGER, 0);
+  int seer = seat(&engine, ROLE_SEER, 0);
+  int wolf = seat(&engine, ROLE_WEREWOLF, 0);
+  play_night(&engine, &s, villager, villager, false, NO_PLAYER, seer);
+
+  // Everyone but the villager votes: three against them, two against the seer and one against a werewolf
+  engine_start_vote(&engine);
+  int targets[] = {villager, villager, villager, seer, seer, wolf};
+  int n = 0;
+  for (int i = bitset_next(&engine.voters, 0); i != -1; i = bitset_next(&engine.voters, i + 1))
+    if (i != villager)
+      CHECK(engine_act(&engine, i, DECIDE_VOTE, targets[n++]) == ENGINE_OK);
+  CHECK(engine.leader == villager);
+
+  // The villager leaves before voting, which ends the vote with the seer as its only leader
+  s.count = 0;
+  drain(&engine, &s);
+  engine_leave(&engine, villager);
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_VOTED_OUT, NO_PLAYER, villager, ANY) == 0);
+  CHECK(count_events(&s, EVENT_VOTED_OUT, NO_PLAYER, seer, ROLE_SEER) == 1);
+  CHECK(!bitset_test(&engine.alive, seer));
+
+  // Leaving with the lead shared leaves nobody ahead: two against the seer and two against a werewolf
+  start_game(&engine, 7, NULL, &s);
+  play_night(&engine, &s, villager, villager, false, NO_PLAYER, seer);
+  engine_start_vote(&engine);
+  int shared[] = {villager, villager, seer, seer, wolf, wolf};
+  n = 0;
+  for (int i = bitset_next(&engine.voters, 0); i != -1; i = bitset_next(&engine.voters, i + 1))
+    if (i != villager)
+      CHECK(engine_act(&engine, i, DECIDE_VOTE, shared[n++]) == ENGINE_OK);
+  s.count = 0;
+  drain(&engine, &s);
+  engine_leave(&engine, villager);
+  drain(&engine, &s);
+  CHECK(count_events(&s, EVENT_TIE, ANY, ANY, ANY) == 1);
+  CHECK(count_events(&s, EVENT_VOTED_OUT, ANY, ANY, ANY) == 0);
+} // test_leader_leaves
+
+
+
+/*-------------------------Replaying-------------------------*/
+
+
+// The same seed and the same decisions play out the same game
+void test_deterministic(void)
+{
+  static engine_t first, second;
+  seen_t a, b;
+  start_game(&first, 12, NULL, &a);
+  start_game(&second, 12, NULL, &b);
+  CHECK(memcmp(first.role, second.role, 12 * sizeof(role_t)) == 0);
+
+  for (int round = 0; round < 4 && !first.over; round++)
+  {
+    for (int i = 0; i < 12; i++)
+    {
+      engine_timeout(&first, i);
+      engine_timeout(&second, i);
+    }
+    drain(&first, &a);
+    drain(&second, &b);
+    engine_start_vote(&first);
+    engine_end_vote(&first);
+    engine_start_vote(&second);
+    engine_end_vote(&second);
+    drain(&first, &a);
+    drain(&second, &b);
+  }
+  CHECK(a.count == b.count && memcmp(a.events, b.events, a.count * sizeof(engine_event_t)) == 0);
+} // test_deterministic
+
+
+
+int main(void)
+{
+  test_guard();
+  test_witch();
+  test_hunter();
+  test_vote();
+  test_win_thresholds();
+  test_timeout();
+  test_leave();
+  test_leader_leaves();
+  test_deterministic();
+
+  printf("engine_test checks=%d failed=%d\n", checks, failures);
+  return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+} // main
@@ -0,0 +1,61 @@
+#include "frame.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// Build a frame around len bytes of payload
+static frame_t* frame_alloc(const char* payload, size_t len) {
+  frame_t* frame = malloc(sizeof(frame_t) + len + 1);
+  if (frame == NULL) return NULL;
+
+  atomic_init(&frame->refs, 1);
+  frame->len = len;
+  frame->v1_header = len + 1;
+  frame->v2_header_len = varint_encode((uint64_t)len << 1 | FRAME_MESSAGE, frame->v2_header);
+  memcpy(frame->text, payload, len);
+  frame->text[len] = '\0';
+  return frame;
+}
+
+// Encode a message into a new frame holding one reference
+frame_t* frame_create(const char* message) {
+  return frame_alloc(message, strlen(message));
+}
+
+// Encode the first len bytes of a message into a new frame
+frame_t* frame_create_len(const char* message, size_t len) {
+  return frame_alloc(message, len);
+}
+
+// Encode a PROTO_* control message into a new frame
+frame_t* frame_create_control(char kind) {
+  char payload[PROTO_CONTROL_LEN];
+  encode_control(kind, payload);
+  return frame_alloc(payload, PROTO_CONTROL_LEN);
+}
+
+// Encode a PROTO_* control message with an argument into a new frame
+frame_t* frame_create_control_arg(char kind, const char* arg) {
+  char payload[MAX_MESSAGE_LENGTH];
+  size_t len = strnlen(arg, MAX_MESSAGE_LENGTH - 1 - PROTO_CONTROL_LEN);
+  encode_control(kind, payload);
+  memcpy(payload + PROTO_CONTROL_LEN, arg, len);
+  return frame_alloc(payload, PROTO_CONTROL_LEN + len);
+}
+
+// Bytes a frame takes on the wire in the given framing
+size_t frame_wire_len(const frame_t* frame, int version) {
+  if (version == FRAMING_V1) return sizeof(frame->v1_header) + frame->len + 1;
+  return frame->v2_header_len + frame->len;
+}
+
+// Take another reference to a frame
+frame_t* frame_ref(frame_t* frame) {
+  atomic_fetch_add_explicit(&frame->refs, 1, memory_order_relaxed);
+  return frame;
+}
+
+// Drop a reference, freeing the frame when it was the last one
+void frame_unref(frame_t* frame) {
+  if (atomic_fetch_sub_explicit(&frame->refs, 1, memory_order_acq_rel) == 1) free(frame);
+}
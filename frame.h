@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "message.h"
+
+// A message ready to be written to any connection. Frames are immutable once created and
+// reference counted, so one broadcast is encoded once and shared by every recipient's queue.
+// The v1 and v2 headers are both kept, so connections in either framing share the same frame.
+typedef struct frame {
+  atomic_int refs;
+  size_t len;  // bytes of the message, not counting its NUL
+  size_t v1_header;  // v1 length header: the message and its NUL
+  uint8_t v2_header[MAX_VARINT_LEN];
+  size_t v2_header_len;
+  char text[];  // the message, NUL-terminated
+} frame_t;
+
+// Encode a message into a new frame holding one reference. Returns NULL if allocation fails.
+frame_t* frame_create(const char* message);
+
+// Encode the first len bytes of a message into a new frame. Returns NULL if allocation fails.
+frame_t* frame_create_len(const char* message, size_t len);
+
+// Encode a PROTO_* control message into a new frame. Returns NULL if allocation fails.
+frame_t* frame_create_control(char kind);
+
+// Encode a PROTO_* control message carrying arg into a new frame. Returns NULL if allocation fails.
+frame_t* frame_create_control_arg(char kind, const char* arg);
+
+// Bytes a frame takes on the wire in the given framing
+size_t frame_wire_len(const frame_t* frame, int version);
+
+// Take another reference to a frame
+frame_t* frame_ref(frame_t* frame);
+
+// Drop a reference, freeing the frame when it was the last one
+void frame_unref(frame_t* frame);
@@ -0,0 +1,1774 @@
+/*-----------------------------------------LIBRARY-----------------------------------------*/
+
+
+#include "game.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "message.h"
+#include "socket.h"
+#include "util.h"
+
+
+/*-----------------------------------------GLOBAL VALUES-----------------------------------------*/
+
+
+// What every player name starts with, before the seat number
+#define NAME_PREFIX "Player "
+
+
+/*-----------------------------------------FUNCTIONS HEADERS-----------------------------------------*/
+
+
+/*----------Connections----------*/
+
+/* Set up seat i for a newly connected socket, taking over what buffered has read from it if not NULL, then send it the
+   offer of v2 framing, what welcome writes and its token. Returns false if that could not be sent. */
+bool user_connect(game_t *game, int i, int client_socket_fd, msg_reader_t *buffered, void (*welcome)(game_t *game, int i));
+
+// Leave seat i of a restored game without a connection until its player comes back. Everything sent to it is dropped.
+void user_vacate(game_t *game, int i);
+
+// Reactor callback for a player's socket: handle every message that has arrived
+void user_input(void *user_info, int fd);
+
+// Handle every complete message in a player's reader. Returns -1 if one is malformed, otherwise 0.
+int user_messages(users_t *my_user);
+
+// Handle what players sent before their game started, which the reactor will not wake anyone up for
+void user_buffered_input(game_t *game);
+
+// Answer a pending prompt with a player's message, or relay it as chat
+void user_message(users_t *my_user, char *message);
+
+/*----------Messages----------*/
+
+/* Queue a message for a user. If it cannot be delivered, user_leave is called when it is flushed.
+   Text longer than one message can hold, like the list of a large table, is split at line breaks. */
+void send_safe_message(users_t *user_x, char *message);
+
+// Queue an encoded frame for a user. The caller keeps its reference to the frame.
+void send_safe_frame(users_t *receiver, frame_t *frame);
+
+// Encode a message once and queue it for every user in the game
+void broadcast_message(game_t *game, char *message);
+
+// Encode a message once and queue it for every player in recipients. Long text is split like in send_safe_message.
+void multicast_message(game_t *game, bitset_t *recipients, char *message);
+
+/* Add a message everyone at the table hears to the feed spectators watch, if the game has one
+   Only what is public goes there, without the roles the players learn along the way. */
+void spectate(game_t *game, char *message);
+
+// Length of the first piece of text that fits in one message, cut after a line break where possible
+size_t chunk_length(char *text);
+
+// Called when a write to a user's connection fails
+void user_failed(void *user_info);
+
+// Called when a user's socket fills up or drains, to watch it for writability meanwhile
+void user_blocked(void *user_info, bool blocked);
+
+// Reactor callback for a full socket that has become writable: write out the rest of its output
+void user_writable(void *user_info, int fd);
+
+/* Queue a connected player whose connection failed or closed to be taken out of the game once the current batch
+   of events is over. Nothing is sent from here, so a failure found while sending cannot set off more sends. */
+void user_leave(users_t *user);
+
+/* Send a prompt to a user and route their next message to handler
+   If they have not answered within PROMPT_TIME, on_timeout is called instead */
+void prompt_user(users_t *user, char *message, prompt_fn handler, timeout_fn on_timeout);
+
+/* Route a user's next message to handler, for a prompt that has already been sent
+   With an on_timeout, the user has PROMPT_TIME to answer. Without, the caller keeps the deadline. */
+void expect_answer(users_t *user, prompt_fn handler, timeout_fn on_timeout);
+
+// Ask a user a follow-up question of their prompt. They keep its deadline and default.
+void follow_up_prompt(users_t *user, char *message, prompt_fn handler);
+
+// Ask a user again after an invalid answer. They keep the deadline and default of their prompt.
+void retry_prompt(users_t *user, char *message, prompt_fn handler);
+
+// Called when a user's prompt deadline passes: drop the prompt and take its default
+void prompt_timeout(void *user_info);
+
+/*----------User Set-up and Check----------*/
+
+// Send welcoming messages and inform users of their name and roles
+void welcome_user(game_t *game, int i);
+
+// Welcome a player back to their seat in a restored game and remind them of their role
+void welcome_back(game_t *game, int i);
+
+// Send a player the token that takes their seat back if the server restarts
+void send_token(users_t *user);
+
+// A fresh secret for a seat's token. It does not come from the game's generator, so the game still plays out the same.
+uint64_t new_token(void);
+
+// Turn a player name typed by a user into a player id. Returns NO_PLAYER if there is no such player.
+int parse_player(game_t *game, char *name);
+
+// Write heading followed by the names of players, one per line, into the phase arena
+char *player_list(game_t *game, char *heading, bitset_t *players);
+
+/*----------Rules----------*/
+
+// Turn every event the engine has queued into messages, prompts and timers
+void game_step(game_t *game);
+
+// Render one event of the engine
+void game_event(game_t *game, engine_event_t *event);
+
+// Save the game as it stands at the start of the phase whose event was just taken, for a restarted server to carry on from
+void game_checkpoint(game_t *game);
+
+/* Hand a player's answer to the engine and render what follows
+   If the rules do not allow it, the player is asked again with retry and handler */
+void decide(users_t *user, decision_t decision, int target, char *retry, prompt_fn handler);
+
+// A player did not answer in time: the engine takes the default for what they owe
+void decision_timeout(users_t *user);
+
+/*----------Status Updates----------*/
+
+// Tell everyone who won. The engine has already decided the game is over.
+void announce_winner(game_t *game, outcome_t outcome);
+
+// Add a player who died tonight to the announcement made at dawn
+void night_death(game_t *game, int dead);
+
+// Inform users of what happened last night, and whether there are any deaths
+void night_status_update(game_t *game, int deaths);
+
+// Record in one of the game's histograms how long it has been since a given time
+void record_time(game_t *game, stat_hist_t hist, uint64_t since);
+
+// Append one record of what happened in the game, with length bytes of payload, to its worker's journal
+void journal_game(game_t *game, journal_kind_t kind, int detail, int player, int target, int value, const void *payload, size_t length);
+
+/*----------Role Functions----------*/
+
+// Free the last phase's text and start timing the new phase
+void phase_begin(game_t *game);
+
+// Route every player's chat the way phase allows and enter phase
+void set_phase(game_t *game, phase_t phase);
+
+// Subscribe every connected player to the channels they hear, when the game starts
+void subscribe_players(game_t *game);
+
+// Move a player who has just died from the pack's channel to the ghosts'
+void player_died(game_t *game, int dead);
+
+// Start the night: only the werewolves talk, and the engine asks every role at once
+void night_func(game_t *game);
+
+// Time one of the night's tasks once the engine reports it done
+void night_task_done(game_t *game, int task);
+
+// Prompt the seer to see one player's role
+void seer(game_t *game, int seer_id);
+
+// Hand the seer's choice to the engine
+void seer_input(users_t *seer_user, char *mess);
+
+// Send the seer the role of the player they chose
+void seer_sees(game_t *game, int seer_id, int target, role_t role);
+
+/* Prompt the werewolves to kill a non-werewolf player, give them 10s to discuss
+   and one player will be called upon to make a decision
+   Notes: they cannot kill themselves */
+void werewolf_night_func(game_t *game, int chooser);
+
+// Called when the werewolves' discussion time runs out: ask one of them for a victim
+void werewolf_choice(void *game_info);
+
+// Hand the werewolves' victim to the engine
+void werewolf_input(users_t *werewolf, char *message);
+
+/* Calls the guard and prompt them to save one person
+   Notes: the guard cannot save themself and does not know who was killed by the wolves */
+void guard_night_func(game_t *game, int guard_id);
+
+// Hand the guard's choice to the engine
+void guard_input(users_t *guard, char *message);
+
+// Inform the witch of the dying person, if any
+void witch_dying(game_t *game, int witch_id, int victim);
+
+// Ask the witch whether they want to save the dying player
+void witch_night_func_save(game_t *game, int witch_id);
+
+// Handle the witch's answer on whether to save the dying player
+void witch_save_input(users_t *witch, char *choice);
+
+// Ask the witch whether they want to kill someone
+void witch_night_func_kill(game_t *game, int witch_id);
+
+// Handle the witch's answer on whether to kill someone
+void witch_kill_input(users_t *witch, char *choice);
+
+// Hand the name of the player the witch kills to the engine
+void witch_kill_name_input(users_t *witch, char *dying);
+
+// Tell the witch a potion she would be asked about is used up
+void witch_no_potion(game_t *game, int witch_id, decision_t potion);
+
+// Prompt the hunter to pick one person to die with them if they are killed
+void hunter_func(game_t *game, int hunter_id);
+
+// Hand the hunter's mark to the engine
+void hunter_input(users_t *hunter, char *dead_guy);
+
+/*----------Day Phase Function----------*/
+
+// Prompt all users to discuss then vote on one player to be killed
+void day_func(game_t *game);
+
+// Called when the day's discussion time runs out: the engine asks every alive player to vote
+void vote_func(void *game_info);
+
+/* Prompt every voter at once with one message
+   They share one deadline, PROMPT_TIME from now, and the vote ends early once everyone has voted */
+void vote_prompt(game_t *game);
+
+// Hand a vote to the engine
+void vote_input(users_t *voter, char *message);
+
+// Called when the vote's deadline passes: everyone who has not voted abstains
+void vote_deadline(void *game_info);
+
+// Announce who was voted out, or that there was a tie
+void day_end(game_t *game, engine_event_t *event);
+
+// Hand the finished game back to its owner. announce_winner has already told everyone who won.
+void game_over(game_t *game);
+
+
+/*-----------------------------------------FUNCTIONS-----------------------------------------*/
+
+
+/*-------------------------Game Lifecycle-------------------------*/
+
+
+// Allocate an empty game waiting for players to fill config's seats
+game_t *game_create(int id, const game_config_t *config)
+{
+  game_t *game = calloc(1, sizeof(game_t));
+  if (game == NULL)
+    return NULL;
+  game->user_lst = calloc(config->players, sizeof(users_t));
+  if (game->user_lst == NULL)
+  {
+    free(game);
+    return NULL;
+  }
+
+  // The engine deals the table as soon as it opens, so dealing a seat is a lookup
+  engine_init(&game->engine, config, time_ms() ^ ((uint64_t)id << 32));
+
+  game->id = id;
+  game->phase = PHASE_LOBBY;
+  arena_init(&game->phase_arena, PHASE_ARENA_BLOCK);
+  wheel_timer_init(&game->phase_timer);
+  return game;
+} // game_create
+
+
+
+// Close every player's socket and free the game
+void game_destroy(game_t *game)
+{
+  if (game->reactor != NULL)
+    reactor_cancel_timer(game->reactor, &game->phase_timer);
+
+  for (int i = 0; i < game->joined; i++)
+  {
+    if (game->reactor != NULL)
+    {
+      reactor_cancel_timer(game->reactor, &game->user_lst[i].prompt_timer);
+      reactor_remove(game->reactor, &game->user_lst[i].handle);
+    }
+    conn_destroy(&game->user_lst[i].conn);
+    if (game->user_lst[i].conn.fd != -1)
+      close(game->user_lst[i].conn.fd);
+  }
+  if (game->feed != NULL)
+    feed_close(game->feed);
+  arena_destroy(&game->phase_arena);
+  free(game->user_lst);
+  free(game);
+} // game_destroy
+
+
+
+// Add a newly connected player to the game, welcome them and deal their role
+bool game_join(game_t *game, int client_socket_fd, msg_reader_t *buffered)
+{
+  int i = game->joined;
+  game->user_lst[i].token = new_token();
+  if (!user_connect(game, i, client_socket_fd, buffered, welcome_user))
+    return false;
+
+  // Only now is the seat taken, so a failed welcome never counts as a disconnect
+  bitset_set(&game->players.seated, i);
+  bitset_set(&game->players.connected, i);
+  game->joined++;
+  return true;
+} // game_join
+
+
+
+// Whether every seat of the game is taken
+bool game_full(game_t *game)
+{
+  return game->joined == game->engine.config.players;
+} // game_full
+
+
+
+// Set up a game saved by a checkpoint, as it was at the start of its phase, with nobody connected yet
+game_t *game_restore(int id, const char *data, size_t len)
+{
+  // The magic, the game and its number of seats, a token per seat, who was connected and the engine
+  uint32_t header[2];
+  size_t at = CHECKPOINT_MAGIC_LEN + sizeof(header);
+  if (len < at || memcmp(data, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN) != 0)
+    return NULL;
+  memcpy(header, data + CHECKPOINT_MAGIC_LEN, sizeof(header));
+  int players = header[1];
+  size_t words = (players + 63) / 64 * sizeof(uint64_t);
+  if (header[0] != (uint32_t)id || players < 2 || players > MAX_USERS || len < at + players * sizeof(uint64_t) + words)
+    return NULL;
+
+  game_config_t config = {.players = players};
+  game_t *game = game_create(id, &config);
+  if (game == NULL)
+    return NULL;
+  for (int i = 0; i < players; i++)
+    memcpy(&game->user_lst[i].token, data + at + i * sizeof(uint64_t), sizeof(uint64_t));
+  at += players * sizeof(uint64_t);
+  memcpy(game->players.connected.words, data + at, words);
+  at += words;
+
+  if (!engine_load(&game->engine, data + at, len - at) || game->engine.config.players != players)
+  {
+    game_destroy(game);
+    return NULL;
+  }
+
+  for (int i = 0; i < players; i++)
+  {
+    user_vacate(game, i);
+    bitset_set(&game->players.seated, i);
+  }
+  game->joined = players;
+  game->restored = true;
+  return game;
+} // game_restore
+
+
+
+// Split a token sent with PROTO_RESUME into its game, seat and secret
+bool game_parse_token(const char *token, int *game, int *seat, uint64_t *secret)
+{
+  unsigned long long value;
+  int end;
+  if (sscanf(token, "%d:%d:%16llx%n", game, seat, &value, &end) != 3 || token[end] != '\0')
+    return false;
+  *secret = value;
+  return true;
+} // game_parse_token
+
+
+
+// Give seat back to a player of a restored game who proved it is theirs, and welcome them back
+bool game_rejoin(game_t *game, int seat, uint64_t secret, int client_socket_fd, msg_reader_t *buffered)
+{
+  // A seat is only held for whoever was connected to it, and only until they take it back
+  if (!game->restored || seat < 0 || seat >= game->joined || game->user_lst[seat].token != secret ||
+      !bitset_test(&game->players.connected, seat) || game->user_lst[seat].conn.fd != -1)
+    return false;
+
+  if (!user_connect(game, seat, client_socket_fd, buffered, welcome_back))
+  {
+    user_vacate(game, seat);
+    return false;
+  }
+  return true;
+} // game_rejoin
+
+
+
+// Whether every player who was connected when a restored game was saved has taken their seat back
+bool game_reclaimed(game_t *game)
+{
+  players_t *players = &game->players;
+  for (int i = bitset_next(&players->connected, 0); i != -1; i = bitset_next(&players->connected, i + 1))
+    if (game->user_lst[i].conn.fd == -1)
+      return false;
+  return true;
+} // game_reclaimed
+
+
+
+// Register every player's socket with reactor and start the first night, recording into stats and journal
+void game_start(game_t *game, reactor_t *reactor, conn_t **flush_list, stats_t *stats, journal_buf_t *journal)
+{
+  game->reactor = reactor;
+  game->stats = stats;
+  game->journal = journal;
+  stats->games_started++;
+
+  engine_t *engine = &game->engine;
+  if (game->restored)
+  {
+    // The saved engine picks up where the journal of the game before the restart may have been cut off
+    char *saved = arena_alloc(&game->phase_arena, ENGINE_SAVE_MAX);
+    if (saved != NULL)
+      journal_game(game, JOURNAL_RESTORE, 0, NO_PLAYER, NO_PLAYER, engine->config.players, saved, engine_save(engine, saved));
+  }
+  else
+  {
+    // The seed and the table are enough to deal the game again, and the seats say who was dealt what
+    journal_game_t table = {.seed = engine->seed};
+    memcpy(table.roles, engine->config.roles, sizeof(table.roles));
+    journal_game(game, JOURNAL_GAME, 0, NO_PLAYER, NO_PLAYER, engine->config.players, &table, sizeof(table));
+    for (int i = 0; i < game->joined; i++)
+      journal_game(game, JOURNAL_JOIN, 0, i, NO_PLAYER, engine->role[i], NULL, 0);
+  }
+
+  // Hand the sockets over to the reactor. From now on output is queued and flushed by the owner.
+  for (int i = 0; i < game->joined; i++)
+  {
+    conn_attach(&game->user_lst[i].conn, flush_list);
+    game->user_lst[i].conn.counters = &stats->io;
+    if (game->user_lst[i].conn.fd == -1)
+      continue;
+    if (reactor_add(reactor, &game->user_lst[i].handle) != 0)
+    {
+      perror("Failed to watch client socket");
+      user_leave(&game->user_lst[i]);
+    }
+  }
+  subscribe_players(game);
+
+  // A restored game carries on with the phase it was saved at, without the players who did not come back
+  if (game->restored)
+  {
+    game->restored = false;
+    for (int i = 0; i < game->joined; i++)
+      if (game->user_lst[i].conn.fd == -1)
+        user_leave(&game->user_lst[i]);
+    game_step(game);
+    user_buffered_input(game);
+    return;
+  }
+
+  // Every night prompts the seer, werewolves, guard and hunter at once, and the witch once the
+  // werewolves have chosen. The night is resolved when the reactor has delivered every answer.
+  engine_start(engine);
+  game_step(game);
+  user_buffered_input(game);
+} // game_start
+
+
+
+/*-------------------------Connections-------------------------*/
+
+
+// Set up seat i for a newly connected socket, taking over what buffered has read from it, then send it its welcome
+bool user_connect(game_t *game, int i, int client_socket_fd, msg_reader_t *buffered, void (*welcome)(game_t *game, int i))
+{
+  users_t *user = &game->user_lst[i];
+
+  // Set up player's initial status
+  if (socket_set_nonblocking(client_socket_fd) != 0)
+  {
+    perror("Failed to make client socket non-blocking");
+    return false;
+  }
+  conn_init(&user->conn, client_socket_fd);
+  if (buffered != NULL)
+    msg_reader_move(buffered, &user->conn.reader);
+  user->conn.on_error = user_failed;
+  user->conn.on_blocked = user_blocked;
+  user->conn.ctx = user;
+  user->id = i;
+  snprintf(user->name, MAX_NAME_LEN, NAME_PREFIX "%d", i + 1);
+  user->game = game;
+  game->players.prompt[i] = NULL;
+  wheel_timer_init(&user->prompt_timer);
+  user->handle.fd = client_socket_fd;
+  user->handle.on_readable = user_input;
+  user->handle.on_writable = user_writable;
+  user->handle.ctx = user;
+
+  // Queue the offer and the welcome, then write them with one system call. Nothing waits for the
+  // client: a v2 answer is read once the game has started, like everything else it sends.
+  conn_t *pending = NULL;
+  conn_attach(&user->conn, &pending);
+
+  // Clients that understand v2 framing answer this before anything else they send
+  conn_offer_v2(&user->conn);
+  welcome(game, i);
+  send_token(user);
+
+  conn_flush_all(&pending);
+  conn_attach(&user->conn, NULL);
+  if (user->conn.failed)
+  {
+    perror("Failed to send message to client");
+    conn_destroy(&user->conn);
+    return false;
+  }
+  return true;
+} // user_connect
+
+
+
+// Leave seat i of a restored game without a connection until its player comes back
+void user_vacate(game_t *game, int i)
+{
+  users_t *user = &game->user_lst[i];
+
+  conn_init(&user->conn, -1);
+  user->conn.failed = true;
+  user->id = i;
+  snprintf(user->name, MAX_NAME_LEN, NAME_PREFIX "%d", i + 1);
+  user->game = game;
+  game->players.prompt[i] = NULL;
+  wheel_timer_init(&user->prompt_timer);
+  user->handle.fd = -1;
+} // user_vacate
+
+
+
+// Reactor callback for a player's socket: handle every message that has arrived
+void user_input(void *user_info, int fd)
+{
+  users_t *my_user = (users_t *)user_info;
+  game_t *game = my_user->game;
+
+  // One read per wakeup, however many messages it brings
+  ssize_t rc = msg_reader_fill(&my_user->conn.reader);
+  if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+    return;
+
+  int got = 0;
+  if (rc > 0)
+  {
+    game->stats->io.bytes_in += rc;
+    got = user_messages(my_user);
+  }
+
+  if (rc <= 0 || got < 0)
+  {
+    if (rc == 0)
+      fprintf(stderr, "%s closed the connection\n", my_user->name);
+    else
+      perror("Failed to read message from client");
+    reactor_remove(game->reactor, &my_user->handle);
+    user_leave(my_user);
+  }
+
+} // user_input
+
+
+
+// Handle every complete message in a player's reader. The rest of a partial one waits in the reader.
+int user_messages(users_t *my_user)
+{
+  msg_view_t view;
+  int got;
+  while ((got = msg_reader_view(&my_user->conn.reader, &view)) > 0)
+  {
+    my_user->game->stats->io.frames_in++;
+    // The client took up our offer of v2 framing
+    if (view.control == PROTO_ACCEPT)
+      conn_upgrade(&my_user->conn);
+    else if (view.control == 0)
+      user_message(my_user, view.text);
+  }
+  return got < 0 ? -1 : 0;
+} // user_messages
+
+
+
+// Handle what players sent before their game started, which the reactor will not wake anyone up for
+void user_buffered_input(game_t *game)
+{
+  for (int i = 0; i < game->joined; i++)
+  {
+    users_t *user = &game->user_lst[i];
+    if (user->conn.fd == -1 || !bitset_test(&game->players.connected, i) || bitset_test(&game->players.leaving, i))
+      continue;
+    if (user_messages(user) < 0)
+    {
+      perror("Failed to read message from client");
+      reactor_remove(game->reactor, &user->handle);
+      user_leave(user);
+    }
+  }
+} // user_buffered_input
+
+
+
+// Answer a pending prompt with a player's message, or relay it as chat
+void user_message(users_t *my_user, char *message)
+{
+  game_t *game = my_user->game;
+  players_t *players = &game->players;
+  int id = my_user->id;
+
+  // The game has ended and is waiting to be freed
+  if (game->engine.over)
+    return;
+
+  // The user owes us an answer, so this message is it
+  if (players->prompt[id] != NULL)
+  {
+    prompt_fn handler = players->prompt[id];
+    players->prompt[id] = NULL;
+    uint64_t asked = my_user->prompt_ms;
+    uint64_t retries = game->stats->invalid_retries;
+    handler(my_user, message);
+
+    // Time the answer if the handler took it rather than asking again
+    if (game->stats->invalid_retries == retries)
+      hist_record(&game->stats->hist[STAT_RESPONSE], monotonic_ms() - asked);
+
+    // Unless the handler asked again, the answer was taken and the deadline no longer applies
+    if (players->prompt[id] == NULL)
+      reactor_cancel_timer(game->reactor, &my_user->prompt_timer);
+    return;
+  }
+
+  // Where the line goes was settled when the phase began, and who hears it is kept up as players die or leave
+  channel_t channel = players->route[id];
+  if (channel == CHANNEL_NONE)
+    return;
+  bitset_t recipients = players->subscribers[channel];
+  bitset_clear(&recipients, id);
+
+  journal_game(game, JOURNAL_CHAT, 0, id, NO_PLAYER, 0, message, strnlen(message, MAX_MESSAGE_LENGTH));
+
+  // The chat line is encoded once and shared by every recipient
+  msg_buf_t line;
+  msg_init(&line);
+  msg_append(&line, channel == CHANNEL_GHOST ? "%s (dead): %s\n" : "%s: %s\n", my_user->name, message);
+  multicast_message(game, &recipients, line.text);
+  if (channel == CHANNEL_PUBLIC)
+    spectate(game, line.text);
+
+} // user_message
+
+
+
+/*-------------------------Messages-------------------------*/
+
+
+
+/* Queue a message for a user. If it cannot be delivered, user_leave is called when it is flushed.
+   Text longer than one message can hold, like the list of a large table, is split at line breaks. */
+void send_safe_message(users_t *receiver, char *message)
+{
+  // Almost every message fits in one frame
+  if (message[chunk_length(message)] == '\0')
+  {
+    conn_send(&receiver->conn, message);
+    return;
+  }
+
+  bitset_t recipient;
+  bitset_clear_all(&recipient);
+  bitset_set(&recipient, receiver->id);
+  multicast_message(receiver->game, &recipient, message);
+} // send_safe_messages
+
+
+
+// Queue an encoded frame for a user. The caller keeps its reference to the frame.
+void send_safe_frame(users_t *receiver, frame_t *frame)
+{
+  conn_send_frame(&receiver->conn, frame);
+} // send_safe_frame
+
+
+
+// Encode a message once and queue it for every user in the game
+void broadcast_message(game_t *game, char *message)
+{
+  frame_t *frame = frame_create(message);
+  if (frame == NULL)
+  {
+    perror("Failed to encode broadcast");
+    return;
+  }
+  for (int i = 0; i < game->joined; i++)
+    send_safe_frame(&game->user_lst[i], frame);
+  frame_unref(frame);
+} // broadcast_message
+
+
+
+// Encode a message once and queue it for every player in recipients. Long text is split like in send_safe_message.
+void multicast_message(game_t *game, bitset_t *recipients, char *message)
+{
+  if (bitset_next(recipients, 0) == -1)
+    return;
+
+  // Every piece is encoded once and shared by all the recipients' queues
+  do
+  {
+    size_t len = chunk_length(message);
+    frame_t *frame = frame_create_len(message, len);
+    if (frame == NULL)
+    {
+      perror("Failed to encode message");
+      return;
+    }
+    for (int i = bitset_next(recipients, 0); i != -1; i = bitset_next(recipients, i + 1))
+      send_safe_frame(&game->user_lst[i], frame);
+    frame_unref(frame);
+    message += len;
+  } while (*message != '\0');
+} // multicast_message
+
+
+
+/* Add a message everyone at the table hears to the feed spectators watch, if the game has one
+   Only what is public goes there, without the roles the players learn along the way. */
+void spectate(game_t *game, char *message)
+{
+  if (game->feed == NULL)
+    return;
+
+  // Split like any other message. Publishing never waits for a spectator.
+  do
+  {
+    size_t len = chunk_length(message);
+    feed_publish(game->feed, message, len);
+    message += len;
+  } while (*message != '\0');
+} // spectate
+
+
+
+// Length of the first piece of text that fits in one message, cut after a line break where possible
+size_t chunk_length(char *text)
+{
+  size_t len = strnlen(text, MAX_MESSAGE_LENGTH - 1);
+  if (text[len] == '\0')
+    return len;
+
+  // Only a single line longer than a whole message is cut in the middle
+  for (size_t cut = len; cut > 0; cut--)
+    if (text[cut - 1] == '\n')
+      return cut;
+  return len;
+} // chunk_length
+
+
+
+// Called when a write to a user's connection fails
+void user_failed(void *user_info)
+{
+  user_leave((users_t *)user_info);
+} // user_failed
+
+
+
+// Called when a user's socket fills up or drains, to watch it for writability meanwhile
+void user_blocked(void *user_info, bool blocked)
+{
+  users_t *user = (users_t *)user_info;
+  if (user->game->reactor != NULL)
+    reactor_watch_writable(user->game->reactor, &user->handle, blocked);
+} // user_blocked
+
+
+
+// Reactor callback for a full socket that has become writable: write out the rest of its output
+void user_writable(void *user_info, int fd)
+{
+  users_t *user = (users_t *)user_info;
+  conn_flush(&user->conn);
+} // user_writable
+
+
+
+/* Queue a connected player whose connection failed or closed to be taken out of the game once the current batch
+   of events is over. Nothing is sent from here, so a failure found while sending cannot set off more sends. */
+void user_leave(users_t *user)
+{
+  game_t *game = user->game;
+  players_t *players = &game->players;
+
+  // Before the game has started, a failed welcome only costs the seat, which its caller handles
+  if (game->reactor == NULL || !bitset_test(&players->connected, user->id) || bitset_test(&players->leaving, user->id))
+    return;
+
+  // The owner hears about the game once per batch, however many of its players leave
+  if (bitset_next(&players->leaving, 0) == -1)
+    game->on_leaving(game);
+  bitset_set(&players->leaving, user->id);
+} // user_leave
+
+
+
+// Take every player queued by user_leave out of the game, tell the others with one notice and carry on without them
+void game_take_leavers(game_t *game)
+{
+  players_t *players = &game->players;
+  bitset_t leavers = players->leaving;
+  bitset_clear_all(&players->leaving);
+
+  // A disconnected user is out of the game for good, and nobody waits for their answer any more
+  int count = 0;
+  for (int i = bitset_next(&leavers, 0); i != -1; i = bitset_next(&leavers, i + 1))
+  {
+    bitset_clear(&players->connected, i);
+    for (int channel = 0; channel < CHANNEL_COUNT; channel++)
+      bitset_clear(&players->subscribers[channel], i);
+    reactor_cancel_timer(game->reactor, &game->user_lst[i].prompt_timer);
+    players->prompt[i] = NULL;
+    players->on_timeout[i] = NULL;
+    if (game->engine.over)
+      continue;
+    game->stats->disconnects++;
+    journal_game(game, JOURNAL_LEAVE, 0, i, NO_PLAYER, 0, NULL, 0);
+
+    // The engine settles what they owe as a timeout would. A werewolf speaking for the pack ends its discussion.
+    bool choosing = game->engine.owed[i] == DECIDE_WEREWOLF;
+    engine_leave(&game->engine, i);
+    if (choosing && game_phase(game) == PHASE_NIGHT_TALK)
+    {
+      reactor_cancel_timer(game->reactor, &game->phase_timer);
+      set_phase(game, PHASE_NIGHT);
+    }
+    count++;
+  }
+  if (count == 0)
+    return;
+
+  // Everyone still connected hears about all of them at once. Whoever fails to receive it is queued in turn.
+  game->stats->leave_notices++;
+  if (count == 1)
+  {
+    msg_buf_t notice;
+    msg_init(&notice);
+    msg_append(&notice, "%s has disconnected and will be considered dead for the rest of the game, if not already.",
+               game->user_lst[bitset_next(&leavers, 0)].name);
+    multicast_message(game, &players->connected, notice.text);
+    spectate(game, notice.text);
+  }
+  else
+  {
+    char *list = player_list(game, "These players have disconnected and will be considered dead for the rest of the game, if not already:\n", &leavers);
+    multicast_message(game, &players->connected, list);
+    spectate(game, list);
+  }
+
+  // Then the game moves on at once with what they owed settled, which may end a phase or the game
+  game_step(game);
+} // game_take_leavers
+
+
+
+/* Send a prompt to a user and route their next message to handler
+   If they have not answered within PROMPT_TIME, on_timeout is called instead */
+void prompt_user(users_t *user, char *message, prompt_fn handler, timeout_fn on_timeout)
+{
+  send_safe_message(user, message);
+  expect_answer(user, handler, on_timeout);
+} // prompt_user
+
+
+
+/* Route a user's next message to handler, for a prompt that has already been sent
+   With an on_timeout, the user has PROMPT_TIME to answer. Without, the caller keeps the deadline. */
+void expect_answer(users_t *user, prompt_fn handler, timeout_fn on_timeout)
+{
+  game_t *game = user->game;
+
+  game->players.prompt[user->id] = handler;
+  game->players.on_timeout[user->id] = on_timeout;
+  user->prompt_ms = monotonic_ms();
+  if (on_timeout != NULL)
+    reactor_add_timer(game->reactor, &user->prompt_timer, PROMPT_TIME, prompt_timeout, user);
+} // expect_answer
+
+
+
+// Ask a user a follow-up question of their prompt. They keep its deadline and default.
+void follow_up_prompt(users_t *user, char *message, prompt_fn handler)
+{
+  send_safe_message(user, message);
+  user->game->players.prompt[user->id] = handler;
+} // follow_up_prompt
+
+
+
+// Ask a user again after an invalid answer. They keep the deadline and default of their prompt.
+void retry_prompt(users_t *user, char *message, prompt_fn handler)
+{
+  follow_up_prompt(user, message, handler);
+  user->game->stats->invalid_retries++;
+} // retry_prompt
+
+
+
+// Called when a user's prompt deadline passes: drop the prompt and take its default
+void prompt_timeout(void *user_info)
+{
+  users_t *user = user_info;
+  players_t *players = &user->game->players;
+  user->game->stats->prompt_timeouts++;
+
+  timeout_fn on_timeout = players->on_timeout[user->id];
+  players->prompt[user->id] = NULL;
+  players->on_timeout[user->id] = NULL;
+
+  send_safe_message(user, "Time is up, you did not answer in time.\n");
+  on_timeout(user);
+} // prompt_timeout
+
+
+
+/*-------------------------User Set-Up and Name Check-------------------------*/
+
+
+
+// Send welcoming messages and inform users of their name and roles
+void welcome_user(game_t *game, int i)
+{
+  users_t *user_lst = game->user_lst;
+  msg_buf_t message;
+
+  // Welcome message and assign username
+  msg_init(&message);
+  msg_append(&message, "Hello Player!\nWelcome to Werewolf!\nThe horror will start soon but for now. Your username will be: %s\n", user_lst[i].name);
+  send_safe_message(&user_lst[i], message.text);
+
+  // The engine dealt the table when it opened, so the seat's card is their role. If the welcome
+  // fails, whoever takes the seat next gets the same card.
+  msg_init(&message);
+  msg_append(&message, "Your role is: %s\nThe Game will start shortly!\n", role_names[game->engine.role[i]]);
+  send_safe_message(&user_lst[i], message.text);
+
+} // welcome_user
+
+
+
+// Welcome a player back to their seat in a restored game and remind them of their role
+void welcome_back(game_t *game, int i)
+{
+  msg_buf_t message;
+  msg_init(&message);
+  msg_append(&message, "Welcome back, %s!\nYour role is: %s\nThe game will resume shortly!\n", game->user_lst[i].name, role_names[game->engine.role[i]]);
+  send_safe_message(&game->user_lst[i], message.text);
+} // welcome_back
+
+
+
+// Send a player the token that takes their seat back if the server restarts
+void send_token(users_t *user)
+{
+  char token[PROTO_TOKEN_MAX];
+  snprintf(token, sizeof(token), "%d:%d:%016llx", user->game->id, user->id, (unsigned long long)user->token);
+  frame_t *frame = frame_create_control_arg(PROTO_TOKEN, token);
+  if (frame == NULL)
+    return;
+  send_safe_frame(user, frame);
+  frame_unref(frame);
+} // send_token
+
+
+
+// A fresh secret for a seat's token, not drawn from the game's generator
+uint64_t new_token(void)
+{
+  uint64_t token;
+  if (getrandom(&token, sizeof(token), 0) == sizeof(token))
+    return token;
+
+  // Without the kernel's randomness, a token is still hard to guess from outside the server
+  static uint64_t fallback;
+  if (fallback == 0)
+    fallback = time_ms() ^ ((uint64_t)getpid() << 32);
+  return rng_next(&fallback);
+} // new_token
+
+
+
+// Turn a player name typed by a user into a player id. Returns NO_PLAYER if there is no such player.
+int parse_player(game_t *game, char *name)
+{
+  if (strncmp(name, NAME_PREFIX, strlen(NAME_PREFIX)) != 0)
+    return NO_PLAYER;
+
+  // The seat number is counted from 1, without leading zeros, signs or spaces
+  char *digits = name + strlen(NAME_PREFIX);
+  if (*digits < '1' || *digits > '9')
+    return NO_PLAYER;
+
+  int seat = 0;
+  for (char *c = digits; *c != '\0'; c++)
+  {
+    if (*c < '0' || *c > '9' || seat > game->joined)
+      return NO_PLAYER;
+    seat = seat * 10 + (*c - '0');
+  }
+  if (seat > game->joined)
+    return NO_PLAYER;
+  return seat - 1;
+} // parse_player
+
+
+
+// Write heading followed by the names of players, one per line, into the phase arena
+char *player_list(game_t *game, char *heading, bitset_t *players)
+{
+  // Every name fits in MAX_NAME_LEN with its newline in place of the NUL
+  size_t heading_len = strlen(heading);
+  char *list = arena_alloc(&game->phase_arena, heading_len + bitset_count(players) * MAX_NAME_LEN + 1);
+  if (list == NULL)
+  {
+    perror("Failed to list players");
+    return heading;
+  }
+
+  memcpy(list, heading, heading_len);
+  char *end = list + heading_len;
+  for (int i = bitset_next(players, 0); i != -1; i = bitset_next(players, i + 1))
+  {
+    size_t len = strlen(game->user_lst[i].name);
+    memcpy(end, game->user_lst[i].name, len);
+    end += len;
+    *end++ = '\n';
+  }
+  *end = '\0';
+  return list;
+} // player_list
+
+
+
+/*-------------------------Rules-------------------------*/
+
+
+
+// Turn every event the engine has queued into messages, prompts and timers
+void game_step(game_t *game)
+{
+  engine_event_t event;
+  while (engine_next_event(&game->engine, &event))
+  {
+    // Every night and every day starts with a checkpoint, before anything of it has happened
+    if (event.kind == EVENT_NIGHT || event.kind == EVENT_DAY)
+      game_checkpoint(game);
+    journal_game(game, JOURNAL_EVENT, event.kind, event.player, event.target, event.value, NULL, 0);
+    game_event(game, &event);
+  }
+} // game_step
+
+
+
+// Render one event of the engine
+void game_event(game_t *game, engine_event_t *event)
+{
+  switch (event->kind)
+  {
+  case EVENT_NIGHT:
+    night_func(game);
+    break;
+
+  // Every decision has its own prompt
+  case EVENT_ASK:
+    switch (event->value)
+    {
+    case DECIDE_SEER:
+      seer(game, event->player);
+      break;
+    case DECIDE_WEREWOLF:
+      werewolf_night_func(game, event->player);
+      break;
+    case DECIDE_GUARD:
+      guard_night_func(game, event->player);
+      break;
+    case DECIDE_WITCH_SAVE:
+      witch_night_func_save(game, event->player);
+      break;
+    case DECIDE_WITCH_KILL:
+      witch_night_func_kill(game, event->player);
+      break;
+    case DECIDE_HUNTER:
+      hunter_func(game, event->player);
+      break;
+    }
+    break;
+
+  case EVENT_SEEN:
+    seer_sees(game, event->player, event->target, event->value);
+    break;
+
+  case EVENT_DYING:
+    witch_dying(game, event->player, event->target);
+    break;
+
+  case EVENT_NO_POTION:
+    witch_no_potion(game, event->player, event->value);
+    break;
+
+  case EVENT_TASK_DONE:
+    night_task_done(game, event->value);
+    break;
+
+  case EVENT_DIED:
+    player_died(game, event->target);
+    night_death(game, event->target);
+    break;
+
+  case EVENT_DAWN:
+    night_status_update(game, event->value);
+    break;
+
+  case EVENT_DAY:
+    day_func(game);
+    break;
+
+  case EVENT_VOTE:
+    vote_prompt(game);
+    break;
+
+  case EVENT_VOTED_OUT:
+    player_died(game, event->target);
+    day_end(game, event);
+    break;
+
+  case EVENT_TIE:
+    day_end(game, event);
+    break;
+
+  case EVENT_GAME_OVER:
+    announce_winner(game, event->value);
+    game_over(game);
+    break;
+  }
+} // game_event
+
+
+
+// Save the game as it stands at the start of the phase whose event was just taken, for a restarted server to carry on from
+void game_checkpoint(game_t *game)
+{
+  if (game->checkpoints == NULL)
+    return;
+
+  // The magic, the game and its number of seats, a token per seat, who is connected and the engine
+  int players = game->joined;
+  size_t words = (players + 63) / 64 * sizeof(uint64_t);
+  uint32_t header[2] = {game->id, players};
+  size_t at = CHECKPOINT_MAGIC_LEN + sizeof(header);
+  char *data = malloc(at + players * sizeof(uint64_t) + words + ENGINE_SAVE_MAX);
+  if (data == NULL)
+  {
+    perror("Failed to checkpoint game");
+    return;
+  }
+  memcpy(data, CHECKPOINT_MAGIC, CHECKPOINT_MAGIC_LEN);
+  memcpy(data + CHECKPOINT_MAGIC_LEN, header, sizeof(header));
+  for (int i = 0; i < players; i++)
+    memcpy(data + at + i * sizeof(uint64_t), &game->user_lst[i].token, sizeof(uint64_t));
+  at += players * sizeof(uint64_t);
+  memcpy(data + at, game->players.connected.words, words);
+  at += words;
+
+  // The event that starts the phase is saved with the engine, so a restored game starts the phase again
+  engine_event_t event;
+  engine_unread(&game->engine);
+  at += engine_save(&game->engine, data + at);
+  engine_next_event(&game->engine, &event);
+
+  // The writer thread copies it and does the I/O
+  checkpoint_save(game->checkpoints, game->id, data, at);
+  free(data);
+} // game_checkpoint
+
+
+
+/* Hand a player's answer to the engine and render what follows
+   If the rules do not allow it, the player is asked again with retry and handler */
+void decide(users_t *user, decision_t decision, int target, char *retry, prompt_fn handler)
+{
+  game_t *game = user->game;
+
+  int result = engine_act(&game->engine, user->id, decision, target);
+  if (result == ENGINE_INVALID)
+  {
+    retry_prompt(user, retry, handler);
+    return;
+  }
+  if (result == ENGINE_OK)
+    journal_game(game, JOURNAL_ACT, decision, user->id, target, 0, NULL, 0);
+  game_step(game);
+} // decide
+
+
+
+// A player did not answer in time: the engine takes the default for what they owe
+void decision_timeout(users_t *user)
+{
+  game_t *game = user->game;
+
+  journal_game(game, JOURNAL_TIMEOUT, game->engine.owed[user->id], user->id, NO_PLAYER, 0, NULL, 0);
+  engine_timeout(&game->engine, user->id);
+  game_step(game);
+} // decision_timeout
+
+
+
+/*-------------------------Status Updates-------------------------*/
+
+
+
+// Tell everyone who won. The engine has already decided the game is over.
+void announce_winner(game_t *game, outcome_t outcome)
+{
+  set_phase(game, PHASE_OVER);
+  switch (outcome)
+  {
+  // If everyone is dead
+  case OUTCOME_NOBODY:
+    broadcast_message(game, "No one wins! All are dead.");
+    spectate(game, "No one wins! All are dead.\n");
+    break;
+
+  // If all werewolves are dead
+  case OUTCOME_VILLAGERS:
+    broadcast_message(game, "Villagers win! All werewolves are dead.");
+    spectate(game, "Villagers win! All werewolves are dead.\n");
+    break;
+
+  // If werewolves >= villagers
+  case OUTCOME_WEREWOLVES:
+    broadcast_message(game, "Werewolves win! Werewolves are at least half of the remainings.");
+    spectate(game, "Werewolves win! Werewolves are at least half of the remainings.\n");
+    break;
+  }
+
+} // announce_winner
+
+
+
+// Add a player who died tonight to the announcement made at dawn
+void night_death(game_t *game, int dead)
+{
+  if (game->dawn.len == 0)
+    msg_append(&game->dawn, "The following users died: \n");
+  msg_append(&game->dawn, "%s\n", game->user_lst[dead].name);
+} // night_death
+
+
+
+// Inform users of what happened last night, and whether there are any deaths
+void night_status_update(game_t *game, int deaths)
+{
+  record_time(game, STAT_NIGHT, game->phase_start);
+
+  // The deaths were written as the engine reported them, so only a peaceful night is left to write
+  if (deaths == 0)
+    broadcast_message(game, "It has been a peaceful night, nobody dies.\n");
+  else
+    broadcast_message(game, game->dawn.text);
+  spectate(game, deaths == 0 ? "It has been a peaceful night, nobody dies.\n" : game->dawn.text);
+
+} // night_status_update
+
+
+
+// Record in one of the game's histograms how long it has been since a given time
+void record_time(game_t *game, stat_hist_t hist, uint64_t since)
+{
+  hist_record(&game->stats->hist[hist], monotonic_ms() - since);
+} // record_time
+
+
+
+// Append one record of what happened in the game, with length bytes of payload, to its worker's journal
+void journal_game(game_t *game, journal_kind_t kind, int detail, int player, int target, int value, const void *payload, size_t length)
+{
+  // Only a started game has a worker to journal for
+  if (game->journal == NULL)
+    return;
+
+  journal_record_t record = {
+      .time_ms = time_ms(),
+      .game = game->id,
+      .kind = kind,
+      .detail = detail,
+      .length = length,
+      .player = player,
+      .target = target,
+      .value = value,
+  };
+  journal_append(game->journal, &record, payload);
+} // journal_game
+
+
+
+/*-------------------------Role Functions-------------------------*/
+
+
+
+// Free the last phase's text and start timing the new phase
+void phase_begin(game_t *game)
+{
+  arena_reset(&game->phase_arena);
+  game->phase_start = monotonic_ms();
+} // phase_begin
+
+
+
+// Route every player's chat the way phase allows and enter phase
+void set_phase(game_t *game, phase_t phase)
+{
+  // The living talk to everyone during the day's discussion and the werewolves to the pack during theirs.
+  // The dead talk among themselves until the game is over.
+  engine_t *engine = &game->engine;
+  uint8_t *route = game->players.route;
+  for (int i = 0; i < game->joined; i++)
+  {
+    if (!bitset_test(&engine->alive, i))
+      route[i] = phase == PHASE_OVER ? CHANNEL_NONE : CHANNEL_GHOST;
+    else if (phase == PHASE_DAY_TALK)
+      route[i] = CHANNEL_PUBLIC;
+    else if (phase == PHASE_NIGHT_TALK && engine->role[i] == ROLE_WEREWOLF)
+      route[i] = CHANNEL_WEREWOLF;
+    else
+      route[i] = CHANNEL_NONE;
+  }
+  game->phase = phase;
+} // set_phase
+
+
+
+// Subscribe every connected player to the channels they hear, when the game starts
+void subscribe_players(game_t *game)
+{
+  // A restored game may already have its dead
+  players_t *players = &game->players;
+  engine_t *engine = &game->engine;
+  bitset_t living;
+  bitset_and(&living, &players->connected, &engine->alive);
+  bitset_clear_all(&players->subscribers[CHANNEL_NONE]);
+  players->subscribers[CHANNEL_PUBLIC] = players->connected;
+  bitset_and(&players->subscribers[CHANNEL_WEREWOLF], &living, &engine->by_role[ROLE_WEREWOLF]);
+  bitset_and_not(&players->subscribers[CHANNEL_GHOST], &players->connected, &engine->alive);
+} // subscribe_players
+
+
+
+// Move a player who has just died from the pack's channel to the ghosts'
+void player_died(game_t *game, int dead)
+{
+  players_t *players = &game->players;
+  bitset_clear(&players->subscribers[CHANNEL_WEREWOLF], dead);
+  if (bitset_test(&players->connected, dead))
+    bitset_set(&players->subscribers[CHANNEL_GHOST], dead);
+  players->route[dead] = CHANNEL_GHOST;
+} // player_died
+
+
+
+// The phase the game is in. Only the worker that owns the game may ask.
+phase_t game_phase(game_t *game)
+{
+  return game->phase;
+} // game_phase
+
+
+
+// Start the night: only the werewolves talk, and the engine asks every role at once
+void night_func(game_t *game)
+{
+  phase_begin(game);
+  msg_init(&game->dawn);
+
+  // Only the werewolves talk at night
+  set_phase(game, PHASE_NIGHT_TALK);
+  spectate(game, "Night falls on the village.\n");
+} // night_func
+
+
+
+// Time one of the night's tasks once the engine reports it done
+void night_task_done(game_t *game, int task)
+{
+  // Time the role from the start of the night, or the werewolves from when they were asked
+  switch (task)
+  {
+  case NIGHT_SEER:
+    record_time(game, STAT_SEER, game->phase_start);
+    break;
+  case NIGHT_WEREWOLVES:
+    record_time(game, STAT_WEREWOLF_CHOICE, game->step_start);
+    break;
+  case NIGHT_GUARD:
+    record_time(game, STAT_GUARD, game->phase_start);
+    break;
+  case NIGHT_WITCH:
+    record_time(game, STAT_WITCH, game->phase_start);
+    break;
+  case NIGHT_HUNTER:
+    record_time(game, STAT_HUNTER, game->phase_start);
+    break;
+  }
+} // night_task_done
+
+
+
+// Hand the seer's choice to the engine
+void seer_input(users_t *seer_user, char *mess)
+{
+  // The engine refuses themselves and anyone who doesnt exist or is dead
+  decide(seer_user, DECIDE_SEER, parse_player(seer_user->game, mess), "You have entered an invalid input, try again: ", seer_input);
+} // seer_input
+
+
+
+// Send the seer the role of the player they chose
+void seer_sees(game_t *game, int seer_id, int target, role_t role)
+{
+  msg_buf_t message;
+  msg_init(&message);
+  msg_append(&message, "%s\n", role_names[role]);
+  send_safe_message(&game->user_lst[seer_id], message.text);
+} // seer_sees
+
+
+
+// Prompt the seer to see one player's role
+void seer(game_t *game, int seer_id)
+{
+  // Ouput all the options, not themself, and get the one whose role they'd like to see
+  bitset_t options;
+  engine_targets(&game->engine, seer_id, DECIDE_SEER, &options);
+  prompt_user(&game->user_lst[seer_id], player_list(game, "Type the name of a player you would like to check the role of: \n", &options), seer_input, decision_timeout);
+} // seer
+
+
+
+// Hand the werewolves' victim to the engine
+void werewolf_input(users_t *werewolf, char *message)
+{
+  // The engine refuses a dead player or another werewolf
+  decide(werewolf, DECIDE_WEREWOLF, parse_player(werewolf->game, message), "You have entered an invalid input. Please try again: \n", werewolf_input);
+} // werewolf_input
+
+
+
+// Called when the werewolves' discussion time runs out: ask one of them for a victim
+void werewolf_choice(void *game_info)
+{
+  game_t *game = game_info;
+  users_t *user_lst = game->user_lst;
+
+  record_time(game, STAT_WEREWOLF_DISCUSSION, game->phase_start);
+  game->step_start = monotonic_ms();
+
+  // Make sure no one is able to send/receive messages
+  set_phase(game, PHASE_NIGHT);
+
+  // The rest of the pack hear who speaks for them
+  bitset_t wolves;
+  bitset_and(&wolves, &game->engine.alive, &game->engine.by_role[ROLE_WEREWOLF]);
+  bitset_clear(&wolves, game->choosing_werewolf);
+  msg_buf_t notice;
+  msg_init(&notice);
+  msg_append(&notice, "%s will choose someone to die\n", user_lst[game->choosing_werewolf].name);
+  multicast_message(game, &wolves, notice.text);
+
+  // Find out who the werewolves wanna vote for and validate that input
+  prompt_user(&user_lst[game->choosing_werewolf], "Time is up. Choose one player to slaughter.\n", werewolf_input, decision_timeout);
+} // werewolf_choice
+
+
+
+/* Prompt the werewolves to kill a non-werewolf player, give them 10s to discuss
+   and one player will be called upon to make a decision
+   Notes: they cannot kill themselves */
+void werewolf_night_func(game_t *game, int chooser)
+{
+  engine_t *engine = &game->engine;
+
+  // List all the alive non-werewolves once
+  bitset_t wolves, victims;
+  bitset_and(&wolves, &engine->alive, &engine->by_role[ROLE_WEREWOLF]);
+  engine_targets(engine, chooser, DECIDE_WEREWOLF, &victims);
+  char *list = player_list(game, "You will be given 10 seconds to decide amongst yourselves who you would like to kill.\n Here are the users you may kill.\n", &victims);
+
+  // Send the werewolves the list. The engine picked who makes the choice.
+  game->choosing_werewolf = chooser;
+  multicast_message(game, &wolves, list);
+
+  // Give 10 seconds for the werewolves to discuss
+  reactor_add_timer(game->reactor, &game->phase_timer, DISCUSSION_TIME_NIGHT, werewolf_choice, game);
+} // were_wolf_night_func
+
+
+
+// Hand the guard's choice to the engine
+void guard_input(users_t *guard, char *message)
+{
+  decide(guard, DECIDE_GUARD, parse_player(guard->game, message), "You have entered an invalid input. Please try again.\n", guard_input);
+} // guard_input
+
+
+
+/* Calls the guard and prompt them to save one person
+   Notes: the guard cannot save themself and does not know who was killed by the wolves */
+void guard_night_func(game_t *game, int guard_id)
+{
+  // Send a list of alive players, then receive a choice and validate it
+  bitset_t options;
+  engine_targets(&game->engine, guard_id, DECIDE_GUARD, &options);
+  prompt_user(&game->user_lst[guard_id], player_list(game, "Choose a player you would like to save:\n", &options), guard_input, decision_timeout);
+} // guard_night_func
+
+
+
+// Inform the witch of the dying person, if any
+void witch_dying(game_t *game, int witch_id, int victim)
+{
+  // Sends witch information of potential death
+  msg_buf_t message;
+  msg_init(&message);
+  msg_append(&message, "%s is dying.\n", victim != NO_PLAYER ? game->user_lst[victim].name : "No one");
+  send_safe_message(&game->user_lst[witch_id], message.text);
+} // witch_dying
+
+
+
+// Ask the witch whether they want to save the dying player
+void witch_night_func_save(game_t *game, int witch_id)
+{
+  prompt_user(&game->user_lst[witch_id], "Do you want to save? (y/n)\n", witch_save_input, decision_timeout);
+} // witch_night_func_save
+
+
+
+// Handle the witch's answer on whether to save the dying player
+void witch_save_input(users_t *witch, char *choice)
+{
+  // If they save, the engine clears the dying player
+  int saved = strcmp(choice, "y") == 0 ? witch->game->engine.werewolf_k : NO_PLAYER;
+  decide(witch, DECIDE_WITCH_SAVE, saved, "Do you want to save? (y/n)\n", witch_save_input);
+} // witch_save_input
+
+
+
+// Ask the witch whether they want to kill someone
+void witch_night_func_kill(game_t *game, int witch_id)
+{
+  prompt_user(&game->user_lst[witch_id], "Do you want to kill? (y/n)\n", witch_kill_input, decision_timeout);
+} // witch_night_func_kill
+
+
+
+// Handle the witch's answer on whether to kill someone
+void witch_kill_input(users_t *witch, char *choice)
+{
+  // If they kill, ask for a name and validate, still before the deadline of the first question
+  if (strcmp(choice, "y") == 0)
+  {
+    follow_up_prompt(witch, "Who do you want to kill?\n", witch_kill_name_input);
+    return;
+  }
+  decide(witch, DECIDE_WITCH_KILL, NO_PLAYER, "Do you want to kill? (y/n)\n", witch_kill_input);
+} // witch_kill_input
+
+
+
+// Hand the name of the player the witch kills to the engine
+void witch_kill_name_input(users_t *witch, char *dying)
+{
+  // To the engine, nobody means she kills no one, so a name that is no player is asked again here
+  int victim = parse_player(witch->game, dying);
+  if (victim == NO_PLAYER)
+  {
+    retry_prompt(witch, "Invalid username, please re-enter.\n", witch_kill_name_input);
+    return;
+  }
+  decide(witch, DECIDE_WITCH_KILL, victim, "Invalid username, please re-enter.\n", witch_kill_name_input);
+} // witch_kill_name_input
+
+
+
+// Tell the witch a potion she would be asked about is used up
+void witch_no_potion(game_t *game, int witch_id, decision_t potion)
+{
+  if (potion == DECIDE_WITCH_SAVE)
+    send_safe_message(&game->user_lst[witch_id], "You used your save potion.\n");
+  else
+    send_safe_message(&game->user_lst[witch_id], "You used your kill potion.\n");
+} // witch_no_potion
+
+
+
+// Hand the hunter's mark to the engine
+void hunter_input(users_t *hunter, char *dead_guy)
+{
+  // Whether the hunter dies is only known once the night is resolved
+  decide(hunter, DECIDE_HUNTER, parse_player(hunter->game, dead_guy), "Invalid username, please re-enter.\n", hunter_input);
+} // hunter_input
+
+
+
+// Prompt the hunter to pick one person to die with them if they are killed
+void hunter_func(game_t *game, int hunter_id)
+{
+  // Prompt the choice
+  prompt_user(&game->user_lst[hunter_id], "The night has arrived. You now have a chance to mark an unfortunate victim who will join you in Death if the chance ever arise!\n", hunter_input, decision_timeout);
+} // hunter_func
+
+
+
+/*-------------------------Day Phase Function------------------------*/
+
+
+
+// Prompt all users to discuss then vote on one player to be killed
+void day_func(game_t *game)
+{
+  phase_begin(game);
+  set_phase(game, PHASE_DAY_TALK);
+
+  // Prompt all user to discuss
+  broadcast_message(game, "You will be given 20 seconds to discuss who you would like to vote out.\n");
+  spectate(game, "The village discusses who to vote out.\n");
+
+  reactor_add_timer(game->reactor, &game->phase_timer, DISCUSSION_TIME_DAY, vote_func, game);
+} // day_func
+
+
+
+// Called when the day's discussion time runs out: the engine asks every alive player to vote
+void vote_func(void *game_info)
+{
+  game_t *game = game_info;
+
+  record_time(game, STAT_DISCUSSION, game->phase_start);
+  game->step_start = monotonic_ms();
+
+  set_phase(game, PHASE_VOTE);
+  journal_game(game, JOURNAL_VOTE_START, 0, NO_PLAYER, NO_PLAYER, 0, NULL, 0);
+  engine_start_vote(&game->engine);
+  game_step(game);
+} // vote_func
+
+
+
+/* Prompt every voter at once with one message
+   They share one deadline, PROMPT_TIME from now, and the vote ends early once everyone has voted */
+void vote_prompt(game_t *game)
+{
+  bitset_t *voters = &game->engine.voters;
+  if (bitset_next(voters, 0) == -1)
+    return;
+
+  // One prompt, encoded once, for every voter
+  multicast_message(game, voters, "Please enter a player's name:\n");
+  for (int i = bitset_next(voters, 0); i != -1; i = bitset_next(voters, i + 1))
+    expect_answer(&game->user_lst[i], vote_input, NULL);
+  reactor_add_timer(game->reactor, &game->phase_timer, PROMPT_TIME, vote_deadline, game);
+} // vote_prompt
+
+
+
+// Hand a vote to the engine
+void vote_input(users_t *voter, char *message)
+{
+  decide(voter, DECIDE_VOTE, parse_player(voter->game, message), "Invalid input, enter a real player's name who is alive:\n", vote_input);
+} // vote_input
+
+
+
+// Called when the vote's deadline passes: everyone who has not voted abstains
+void vote_deadline(void *game_info)
+{
+  game_t *game = game_info;
+  bitset_t *voters = &game->engine.voters;
+
+  for (int i = bitset_next(voters, 0); i != -1; i = bitset_next(voters, i + 1))
+  {
+    game->players.prompt[i] = NULL;
+    game->stats->prompt_timeouts++;
+  }
+  multicast_message(game, voters, "Time is up, you did not answer in time.\n");
+  journal_game(game, JOURNAL_VOTE_END, 0, NO_PLAYER, NO_PLAYER, 0, NULL, 0);
+  engine_end_vote(&game->engine);
+  game_step(game);
+} // vote_deadline
+
+
+
+// Announce who was voted out, or that there was a tie
+void day_end(game_t *game, engine_event_t *event)
+{
+  // The last vote can come in before the deadline
+  reactor_cancel_timer(game->reactor, &game->phase_timer);
+  record_time(game, STAT_VOTE, game->step_start);
+
+  // If it's a tie, or nobody voted, nobody dies
+  if (event->kind == EVENT_TIE)
+  {
+    broadcast_message(game, "There was a tie, no one will die.\n");
+    spectate(game, "There was a tie, no one will die.\n");
+  }
+  else // else announce the player with the most votes_against
+  {
+    msg_buf_t message;
+    msg_init(&message);
+    msg_append(&message, "%s has been voted out. They were a: %s\n", game->user_lst[event->target].name, role_names[event->value]);
+    broadcast_message(game, message.text);
+
+    // Spectators learn who is out, never a role
+    msg_init(&message);
+    msg_append(&message, "%s has been voted out.\n", game->user_lst[event->target].name);
+    spectate(game, message.text);
+  }
+} // day_end
+
+
+
+// Hand the finished game back to its owner. announce_winner has already told everyone who won.
+void game_over(game_t *game)
+{
+  game->stats->games_ended++;
+  journal_game(game, JOURNAL_END, 0, NO_PLAYER, NO_PLAYER, 0, NULL, 0);
+
+  // There is nothing left to restore, so nobody holds a seat any more
+  if (game->checkpoints != NULL)
+    checkpoint_remove(game->checkpoints, game->id);
+  frame_t *release = frame_create_control_arg(PROTO_TOKEN, "");
+  if (release != NULL)
+  {
+    for (int i = 0; i < game->joined; i++)
+      send_safe_frame(&game->user_lst[i], release);
+    frame_unref(release);
+  }
+  reactor_cancel_timer(game->reactor, &game->phase_timer);
+  for (int i = 0; i < game->joined; i++)
+    reactor_cancel_timer(game->reactor, &game->user_lst[i].prompt_timer);
+  game->on_over(game);
+} // game_over
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "bitset.h"
+#include "checkpoint.h"
+#include "conn.h"
+#include "engine.h"
+#include "journal.h"
+#include "reactor.h"
+#include "spectator.h"
+#include "stats.h"
+#include "timer_wheel.h"
+
+
+/*-----------------------------------------MACROS-----------------------------------------*/
+
+
+#define MAX_NAME_LEN 20 // Room for "Player ", any seat number and the NUL
+#define DISCUSSION_TIME_NIGHT 10000
+#define DISCUSSION_TIME_DAY 20000
+#define PROMPT_TIME 15000 // Milliseconds a player has to answer a prompt before the default is taken
+#define PHASE_ARENA_BLOCK 1024 // Bytes the phase arena grows by
+#define CHECKPOINT_MAGIC "WWCKPT1\n" // What a game's checkpoint starts with
+#define CHECKPOINT_MAGIC_LEN 8
+
+
+/*-----------------------------------------TYPES-----------------------------------------*/
+
+
+struct user;
+struct game;
+
+// Handler for the answer to a prompt. Called with the player's message, which is only valid until
+// the handler returns.
+typedef void (*prompt_fn)(struct user *user, char *message);
+
+// What happens for a player who does not answer a prompt in time: abstain, or a random valid choice
+typedef void (*timeout_fn)(struct user *user);
+
+// What the table is doing, as far as who may talk is concerned
+typedef enum phase
+{
+  PHASE_LOBBY,      // waiting for its players, or for them to come back after a restart
+  PHASE_NIGHT_TALK, // the werewolves discuss tonight's victim
+  PHASE_NIGHT,      // the night's choices are made in silence
+  PHASE_DAY_TALK,   // everyone discusses who to vote out
+  PHASE_VOTE,       // the vote, in silence
+  PHASE_OVER,       // the game has ended
+} phase_t;
+
+// Where a player's chat goes
+typedef enum channel
+{
+  CHANNEL_NONE,     // nowhere: the player may not talk now
+  CHANNEL_PUBLIC,   // to everyone at the table
+  CHANNEL_WEREWOLF, // to the pack
+  CHANNEL_GHOST,    // to the dead, who talk among themselves whatever the phase
+  CHANNEL_COUNT
+} channel_t;
+
+// struct that stores user's connection. The rest of their state is in the game's player table
+// and, for what the rules look at, in its engine.
+typedef struct user
+{
+  int id;                     // seat number, which indexes the player table
+  char name[MAX_NAME_LEN];    // "Player " and the seat number counted from 1
+  conn_t conn;                // this user's socket and its queued output
+  reactor_handle_t handle;    // registration of this user's socket with the reactor
+  wheel_timer_t prompt_timer; // deadline for the answer this user owes, if any
+  uint64_t prompt_ms;         // when they were sent the prompt they owe an answer to
+  uint64_t token;             // secret the client sends back to take the seat again after a restart
+  struct game *game;          // the game this user plays in
+} users_t;
+
+// What the server keeps for every player, as arrays indexed by player id. Membership is kept
+// in bitsets so counts and checks are a popcount or a mask. Roles and who is alive are the engine's.
+typedef struct players
+{
+  prompt_fn prompt[MAX_USERS];      // handler for the prompt each player owes an answer to, NULL if none
+  timeout_fn on_timeout[MAX_USERS]; // default taken for that prompt when its deadline passes
+
+  bitset_t seated;    // every player who joined, dead or alive
+  bitset_t connected; // players whose connection has not failed
+  bitset_t leaving;   // connected players whose connection failed during this tick, taken out once it ends
+
+  // Where each player's chat goes, a channel_t, settled when the phase begins so a line needs no other lookup
+  uint8_t route[MAX_USERS];
+
+  // Who hears each channel: everyone connected in public, the connected living werewolves and the connected dead.
+  // Set up when the game starts and kept up as players die or leave, so a line goes straight to its subscribers.
+  bitset_t subscribers[CHANNEL_COUNT];
+} players_t;
+
+_Static_assert(MAX_USERS <= BITSET_CAPACITY, "every seat needs a bit in the player sets");
+
+/* Everything one table needs. A game is only ever touched by the worker thread that owns it.
+   The rules live in the engine: answers are handed to it, and the events it queues in return are
+   turned into messages, prompts and timers. */
+typedef struct game
+{
+  int id;
+  int joined;                // number of users that have connected so far
+  engine_t engine;           // the rules, the deal and everything they decide. Its config is the table's.
+
+  // Array of all users, one per seat, and what the server keeps about them
+  users_t *user_lst;
+  players_t players;
+
+  // The current phase. Like the routes it opens, only the owning worker reads or writes it.
+  phase_t phase;
+
+  // Text built for the current phase, freed at once when the next one starts
+  arena_t phase_arena;
+
+  // The deaths of the night, written as the engine reports them and announced at dawn
+  msg_buf_t dawn;
+
+  // When the current phase started, and the step within it that is being timed
+  uint64_t phase_start;
+  uint64_t step_start;
+
+  // Index of the werewolf picking tonight's victim
+  int choosing_werewolf;
+
+  reactor_t *reactor;        // event loop of the worker that owns this game
+  stats_t *stats;            // where the worker that owns this game records what happens
+  journal_buf_t *journal;    // where it journals every input and event of the game
+  checkpointer_t *checkpoints; // where the game is saved at the start of every phase, NULL for nowhere
+  bool restored;             // loaded from a checkpoint, waiting for its players to come back
+  feed_t *feed;              // where spectators watch the game's public events, NULL if nobody can
+  wheel_timer_t phase_timer; // deadline of the current discussion phase or of the vote
+  void (*on_over)(struct game *game); // called once the game has ended
+  void (*on_leaving)(struct game *game); // called when the first player of a tick is queued to leave
+  void *owner;               // the worker running this game
+
+  struct game *next;         // link in a worker's queue of incoming games
+  struct game *next_leaving; // link in a worker's list of games with players to take out
+} game_t;
+
+
+/*-----------------------------------------FUNCTIONS HEADERS-----------------------------------------*/
+
+
+// Allocate an empty game waiting for players to fill config's seats. Returns NULL if allocation fails.
+game_t *game_create(int id, const game_config_t *config);
+
+// Close every player's socket and free the game
+void game_destroy(game_t *game);
+
+// Add a newly connected player to the game, welcome them and deal their role. What buffered has read from the socket
+// already, if not NULL, is handled once the game starts. Returns false if the welcome could not be sent.
+bool game_join(game_t *game, int client_socket_fd, msg_reader_t *buffered);
+
+// Whether every seat of the game is taken
+bool game_full(game_t *game);
+
+/* Set up a game saved by a checkpoint of len bytes, as it was at the start of its phase. Nobody
+   is connected to it yet: players take their seats back with game_rejoin, and the seats nobody
+   takes back by the time it starts count as disconnected. Returns NULL if data is not a checkpoint of game id. */
+game_t *game_restore(int id, const char *data, size_t len);
+
+// Split a token sent with PROTO_RESUME into its game, seat and secret. Returns false if it is not a token.
+bool game_parse_token(const char *token, int *game, int *seat, uint64_t *secret);
+
+/* Give seat back to a player of a restored game who proved it is theirs with secret, and welcome them back. What
+   buffered has read from the socket after the token is handled once the game starts.
+   Returns false if the seat is not theirs to take or the welcome could not be sent. */
+bool game_rejoin(game_t *game, int seat, uint64_t secret, int client_socket_fd, msg_reader_t *buffered);
+
+// Whether every player who was connected when a restored game was saved has taken their seat back
+bool game_reclaimed(game_t *game);
+
+// Register every player's socket with reactor and start the first night, or carry on from the checkpoint of a restored game.
+// Output is queued on flush_list, which the caller must flush after every batch of events.
+// Timings and traffic are recorded in stats, and what happens in the journal, which only the reactor's thread may touch.
+void game_start(game_t *game, reactor_t *reactor, conn_t **flush_list, stats_t *stats, journal_buf_t *journal);
+
+// The phase the game is in. Only the worker that owns the game may ask.
+phase_t game_phase(game_t *game);
+
+/* Take every player queued by user_leave out of the game and tell the others with one notice, then
+   carry on at once with whatever the leavers owed settled as if their time was up. The owner calls
+   this once per batch of events after on_leaving, before flushing the batch's output.
+   Connections that fail while that is flushed are queued again, for the owner to take out in turn. */
+void game_take_leavers(game_t *game);
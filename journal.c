@@ -0,0 +1,169 @@
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define JOURNAL_GROUP_IOV 256  // Batches written by one writev
+
+// Write all of a group with as few system calls as the iovec limit allows
+static int journal_write_group(int fd, journal_chunk_t* group) {
+  struct iovec iov[JOURNAL_GROUP_IOV];
+  while (group != NULL) {
+    int count = 0;
+    for (journal_chunk_t* c = group; c != NULL && count < JOURNAL_GROUP_IOV; c = c->next) {
+      iov[count].iov_base = c->data;
+      iov[count].iov_len = c->len;
+      count++;
+    }
+
+    // Short writes leave the rest of the iovec to go
+    struct iovec* next = iov;
+    while (count > 0) {
+      ssize_t wrote = writev(fd, next, count);
+      if (wrote < 0) return -1;
+      while (count > 0 && (size_t)wrote >= next->iov_len) {
+        wrote -= next->iov_len;
+        next++;
+        count--;
+      }
+      if (count > 0) {
+        next->iov_base = (char*)next->iov_base + wrote;
+        next->iov_len -= wrote;
+      }
+    }
+
+    for (int i = 0; i < JOURNAL_GROUP_IOV && group != NULL; i++) group = group->next;
+  }
+  return 0;
+}
+
+// Thread function for the writer: write out whatever is queued, one group at a time
+static void* journal_main(void* arg) {
+  journal_t* journal = arg;
+
+  while (true) {
+    pthread_mutex_lock(&journal->lock);
+    while (journal->head == NULL) pthread_cond_wait(&journal->ready, &journal->lock);
+    journal_chunk_t* group = journal->head;
+    journal->head = NULL;
+    journal->tail = &journal->head;
+    journal->queued = 0;
+    pthread_mutex_unlock(&journal->lock);
+
+    // Everything queued while the last group was being synced goes out together
+    uint64_t records = 0;
+    for (journal_chunk_t* c = group; c != NULL; c = c->next) records += c->records;
+    if (journal_write_group(journal->fd, group) != 0 || fdatasync(journal->fd) != 0) {
+      perror("Failed to write journal");
+      atomic_fetch_add(&journal->dropped, records);
+    } else {
+      atomic_fetch_add(&journal->written, records);
+      atomic_fetch_add(&journal->groups, 1);
+    }
+
+    while (group != NULL) {
+      journal_chunk_t* next = group->next;
+      free(group);
+      group = next;
+    }
+  }
+  return NULL;
+}
+
+// Open path for appending and start the writer thread
+int journal_open(journal_t* journal, const char* path) {
+  memset(journal, 0, sizeof(journal_t));
+  journal->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (journal->fd == -1) return -1;
+
+  // A new journal starts with the magic. An existing one is appended to as it is.
+  struct stat st;
+  if (fstat(journal->fd, &st) != 0 ||
+      (st.st_size == 0 && write(journal->fd, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != JOURNAL_MAGIC_LEN)) {
+    // Keep the error for the caller to report, whatever closing does to errno
+    int error = errno;
+    close(journal->fd);
+    errno = error;
+    return -1;
+  }
+
+  journal->head = NULL;
+  journal->tail = &journal->head;
+  atomic_init(&journal->written, 0);
+  atomic_init(&journal->groups, 0);
+  atomic_init(&journal->dropped, 0);
+  pthread_mutex_init(&journal->lock, NULL);
+  pthread_cond_init(&journal->ready, NULL);
+  int error = pthread_create(&journal->thread, NULL, journal_main, journal);
+  if (error != 0) {
+    pthread_cond_destroy(&journal->ready);
+    pthread_mutex_destroy(&journal->lock);
+    close(journal->fd);
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+// Start an empty batch for a worker writing to journal
+void journal_buf_init(journal_buf_t* buf, journal_t* journal) {
+  buf->journal = journal;
+  buf->chunk = NULL;
+}
+
+// Add a record and its payload to a worker's batch
+void journal_append(journal_buf_t* buf, const journal_record_t* record, const void* payload) {
+  if (buf->journal == NULL) return;
+
+  // A record that does not fit closes the batch. The longest, a restored engine, is far below a chunk.
+  size_t size = JOURNAL_RECORD_SIZE(record->length);
+  if (buf->chunk != NULL && buf->chunk->len + size > JOURNAL_CHUNK_SIZE) journal_commit(buf);
+  if (buf->chunk == NULL) {
+    buf->chunk = malloc(sizeof(journal_chunk_t));
+    if (buf->chunk == NULL) {
+      atomic_fetch_add(&buf->journal->dropped, 1);
+      return;
+    }
+    buf->chunk->next = NULL;
+    buf->chunk->len = 0;
+    buf->chunk->records = 0;
+  }
+
+  char* at = buf->chunk->data + buf->chunk->len;
+  memcpy(at, record, sizeof(journal_record_t));
+  if (record->length > 0) memcpy(at + sizeof(journal_record_t), payload, record->length);
+  memset(at + sizeof(journal_record_t) + record->length, 0, size - sizeof(journal_record_t) - record->length);
+  buf->chunk->len += size;
+  buf->chunk->records++;
+}
+
+// Hand a worker's batch to the writer thread
+void journal_commit(journal_buf_t* buf) {
+  journal_chunk_t* chunk = buf->chunk;
+  if (chunk == NULL) return;
+  buf->chunk = NULL;
+  journal_t* journal = buf->journal;
+
+  // A writer that cannot keep up costs records, never the game thread's time or unbounded memory
+  pthread_mutex_lock(&journal->lock);
+  bool full = journal->queued + chunk->len > JOURNAL_MAX_QUEUED;
+  if (!full) {
+    *journal->tail = chunk;
+    journal->tail = &chunk->next;
+    journal->queued += chunk->len;
+    pthread_cond_signal(&journal->ready);
+  }
+  pthread_mutex_unlock(&journal->lock);
+
+  if (full) {
+    atomic_fetch_add(&journal->dropped, chunk->records);
+    free(chunk);
+  }
+}
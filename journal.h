@@ -0,0 +1,99 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+// A journal file is JOURNAL_MAGIC followed by records, each a journal_record_t and its payload,
+// padded so that every record starts 8-byte aligned. Records are only ever appended, so a reader
+// can map a journal and walk it in place while the server is still writing to it.
+#define JOURNAL_MAGIC "WWJRNL1\n"
+#define JOURNAL_MAGIC_LEN 8
+#define JOURNAL_CHUNK_SIZE (64 * 1024)           // Bytes a worker batches before handing them to the writer
+#define JOURNAL_MAX_QUEUED (64 * 1024 * 1024)    // Bytes waiting for the writer before new batches are dropped
+
+// Bytes a record with a payload of length bytes takes in the file
+#define JOURNAL_RECORD_SIZE(length) ((sizeof(journal_record_t) + (length) + 7) & ~(size_t)7)
+
+// What a record is about
+typedef enum journal_kind {
+  JOURNAL_GAME,        // a game started with value players. The payload is a journal_game_t.
+  JOURNAL_JOIN,        // player took their seat and was dealt role value
+  JOURNAL_ACT,         // player made decision detail, on target
+  JOURNAL_TIMEOUT,     // player let the deadline pass while owing decision detail
+  JOURNAL_VOTE_START,  // the day's discussion ended and the vote was called
+  JOURNAL_VOTE_END,    // the vote's deadline passed
+  JOURNAL_LEAVE,       // player disconnected
+  JOURNAL_CHAT,        // player said the payload to whoever could hear them
+  JOURNAL_EVENT,       // the engine reported event detail, with its player, target and value
+  JOURNAL_END,         // the game is over
+  JOURNAL_RESTORE,     // a restarted server restored the game with value players from its checkpoint.
+                       // The payload is the engine as engine_save wrote it.
+  JOURNAL_KIND_COUNT
+} journal_kind_t;
+
+// One record. Player and target are seats, -1 for nobody.
+typedef struct journal_record {
+  uint64_t time_ms;  // wall clock when it was recorded
+  uint32_t game;
+  uint8_t kind;      // a journal_kind_t
+  uint8_t detail;    // the decision_t or event_kind_t, depending on kind
+  uint16_t length;   // bytes of payload following the record, not counting the padding
+  int16_t player;
+  int16_t target;
+  int32_t value;
+} journal_record_t;
+
+_Static_assert(sizeof(journal_record_t) == 24, "journal records are laid out without holes");
+
+// Payload of JOURNAL_GAME: everything needed to deal the game again and replay it
+typedef struct journal_game {
+  uint64_t seed;
+  int32_t roles[ROLE_COUNT];  // players dealt each role
+} journal_game_t;
+
+// A batch of records on its way to the file
+typedef struct journal_chunk {
+  struct journal_chunk* next;
+  size_t len;
+  uint64_t records;
+  char data[JOURNAL_CHUNK_SIZE];
+} journal_chunk_t;
+
+// An open journal and the thread that writes it. Batches are queued by the workers and written
+// out in groups: one write and one fdatasync for everything queued since the last group.
+typedef struct journal {
+  int fd;
+  pthread_t thread;
+  pthread_mutex_t lock;   // protects the queue
+  pthread_cond_t ready;   // signalled when a batch is queued
+  journal_chunk_t* head;  // batches waiting to be written, oldest first
+  journal_chunk_t** tail;
+  size_t queued;          // bytes in the queue
+
+  atomic_uint_fast64_t written;  // records on disk
+  atomic_uint_fast64_t groups;   // group commits done
+  atomic_uint_fast64_t dropped;  // records lost because the writer fell too far behind
+} journal_t;
+
+// What one worker has recorded but not handed over yet. Only the worker's thread touches it.
+typedef struct journal_buf {
+  journal_t* journal;      // NULL if the server keeps no journal
+  journal_chunk_t* chunk;  // batch being filled, NULL if there is none yet
+} journal_buf_t;
+
+// Open path for appending, writing the magic if it is new, and start the writer thread.
+// Returns -1 if an error occurs.
+int journal_open(journal_t* journal, const char* path);
+
+// Start an empty batch for a worker writing to journal, which may be NULL
+void journal_buf_init(journal_buf_t* buf, journal_t* journal);
+
+// Add a record and its payload of record->length bytes to a worker's batch. Never blocks on I/O.
+void journal_append(journal_buf_t* buf, const journal_record_t* record, const void* payload);
+
+// Hand a worker's batch to the writer thread, if anything was recorded
+void journal_commit(journal_buf_t* buf);
@@ -5,8 +5,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+// Marks a control message, after the leading NUL
+#define CONTROL_MAGIC "WW2"
+
 // Send a across a socket with a header that includes the message length.
 int send_message(int fd, char* message) {
   // If the message is NULL, set errno to EINVAL and return an error
@@ -74,3 +79,341 @@ char* receive_message(int fd) {
 
   return result;
 }
+
+// Write all of buf, retrying short writes. Returns non-zero value if an error occurs.
+static int write_all(int fd, const void* buf, size_t len) {
+  size_t bytes_written = 0;
+  while (bytes_written < len) {
+    ssize_t rc = write(fd, (const char*)buf + bytes_written, len - bytes_written);
+    if (rc == -1 && errno == EINTR) continue;
+    if (rc <= 0) return -1;
+    bytes_written += rc;
+  }
+  return 0;
+}
+
+// Encode value as a varint into out
+size_t varint_encode(uint64_t value, uint8_t* out) {
+  size_t len = 0;
+  while (value >= 0x80) {
+    out[len++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  out[len++] = (uint8_t)value;
+  return len;
+}
+
+// Decode a varint from the first len bytes of in
+int varint_decode(const uint8_t* in, size_t len, uint64_t* value) {
+  uint64_t result = 0;
+  for (size_t i = 0; i < len && i < MAX_VARINT_LEN; i++) {
+    result |= (uint64_t)(in[i] & 0x7f) << (7 * i);
+    if ((in[i] & 0x80) == 0) {
+      *value = result;
+      return i + 1;
+    }
+  }
+  return len >= MAX_VARINT_LEN ? -1 : 0;
+}
+
+// Send a message in v2 framing
+int send_message_v2(int fd, char* message) {
+  if (message == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // v2 messages leave out the NUL, so the longest one is a byte shorter than in v1
+  size_t len = strlen(message);
+  if (len >= MAX_MESSAGE_LENGTH) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // Send the header and the message with one write
+  uint8_t frame[MAX_VARINT_LEN + MAX_MESSAGE_LENGTH];
+  size_t header = varint_encode((uint64_t)len << 1 | FRAME_MESSAGE, frame);
+  memcpy(frame + header, message, len);
+  return write_all(fd, frame, header + len);
+}
+
+// Fill out the payload of a PROTO_* control message
+void encode_control(char kind, char* payload) {
+  payload[0] = '\0';
+  memcpy(payload + 1, CONTROL_MAGIC, 3);
+  payload[4] = kind;
+}
+
+// Send a PROTO_* control message
+int send_control(int fd, char kind) {
+  return send_control_arg(fd, kind, "");
+}
+
+// Send a PROTO_* control message carrying an argument
+int send_control_arg(int fd, char kind, const char* arg) {
+  size_t arg_len = strlen(arg);
+  if (PROTO_CONTROL_LEN + arg_len >= MAX_MESSAGE_LENGTH) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  // A v1 frame whose string ends with a NUL like any other message
+  size_t len = PROTO_CONTROL_LEN + arg_len + 1;
+  char frame[sizeof(size_t) + MAX_MESSAGE_LENGTH];
+  memcpy(frame, &len, sizeof(size_t));
+  encode_control(kind, frame + sizeof(size_t));
+  memcpy(frame + sizeof(size_t) + PROTO_CONTROL_LEN, arg, arg_len + 1);
+  return write_all(fd, frame, sizeof(size_t) + len);
+}
+
+// Return the kind of a control message, or 0 for an ordinary message
+static char control_kind(const char* payload, size_t len) {
+  if (len < PROTO_CONTROL_LEN || payload[0] != '\0') return 0;
+  if (memcmp(payload + 1, CONTROL_MAGIC, 3) != 0) return 0;
+  return payload[4];
+}
+
+// Note the kind of a control message in a view and leave only its argument as the text
+static void reader_control(msg_view_t* view, char** text, size_t* len) {
+  view->control = control_kind(*text, *len);
+  if (view->control == 0) return;
+  *text += PROTO_CONTROL_LEN;
+  *len -= PROTO_CONTROL_LEN;
+}
+
+// Index into the ring of a stream position
+#define RING_MASK (MSG_RING_SIZE - 1)
+
+// Set up a reader for a socket whose peer starts out in v1 framing
+void msg_reader_init(msg_reader_t* reader, int fd) {
+  reader->fd = fd;
+  reader->version = FRAMING_V1;
+  reader->head = 0;
+  reader->tail = 0;
+  reader->scratch = NULL;
+  reader->batch = NULL;
+  reader->batch_pos = 0;
+  reader->batch_end = 0;
+  reader->batch_frame = 0;
+  reader->release = 0;
+  reader->term = NULL;
+}
+
+// Free the reader's scratch space
+void msg_reader_destroy(msg_reader_t* reader) {
+  free(reader->scratch);
+  reader->scratch = NULL;
+}
+
+// Finish with the last view: put back the byte under its terminator and consume its frame if
+// that was the frame's last message
+static void reader_settle(msg_reader_t* reader) {
+  if (reader->term != NULL) {
+    *reader->term = reader->term_saved;
+    reader->term = NULL;
+  }
+  reader->head += reader->release;
+  reader->release = 0;
+}
+
+// Read as many bytes as the socket has and the ring has room for, with one system call
+ssize_t msg_reader_fill(msg_reader_t* reader) {
+  reader_settle(reader);
+
+  size_t room = MSG_RING_SIZE - (reader->tail - reader->head);
+  if (room == 0) {
+    errno = ENOBUFS;
+    return -1;
+  }
+
+  // The free space wraps around the end of the ring, so read into both pieces
+  size_t start = reader->tail & RING_MASK;
+  size_t first = MSG_RING_SIZE - start < room ? MSG_RING_SIZE - start : room;
+  struct iovec iov[2] = {
+    {.iov_base = reader->ring + start, .iov_len = first},
+    {.iov_base = reader->ring, .iov_len = room - first},
+  };
+
+  ssize_t n;
+  do {
+    n = readv(reader->fd, iov, room > first ? 2 : 1);
+  } while (n == -1 && errno == EINTR);
+
+  if (n > 0) reader->tail += n;
+  return n;
+}
+
+// Copy len bytes at stream position pos out of the ring
+static void ring_copy(msg_reader_t* reader, size_t pos, void* out, size_t len) {
+  size_t start = pos & RING_MASK;
+  size_t first = MSG_RING_SIZE - start < len ? MSG_RING_SIZE - start : len;
+  memcpy(out, reader->ring + start, first);
+  memcpy((char*)out + first, reader->ring, len - first);
+}
+
+// Where the byte after a span that ends at end lives. Only the ring wraps.
+static char* reader_term(msg_reader_t* reader, char* end) {
+  return end == reader->ring + MSG_RING_SIZE ? reader->ring : end;
+}
+
+// Point at len bytes at stream position pos: straight into the ring when they are contiguous,
+// otherwise at a copy in scratch. Returns NULL if scratch cannot be allocated.
+static char* reader_span(msg_reader_t* reader, size_t pos, size_t len) {
+  size_t start = pos & RING_MASK;
+  if (start + len <= MSG_RING_SIZE) return reader->ring + start;
+
+  if (reader->scratch == NULL) {
+    // One spare byte for the terminator
+    reader->scratch = malloc(MAX_BATCH_LENGTH + 1);
+    if (reader->scratch == NULL) return NULL;
+  }
+  ring_copy(reader, pos, reader->scratch, len);
+  return reader->scratch;
+}
+
+// Parse a frame header from the first avail bytes of in. Returns 1 when the header is complete,
+// 0 if more bytes are needed, or -1 if the header is malformed.
+static int parse_header(int version, const uint8_t* in, size_t avail, size_t* header,
+                        size_t* payload, int* type) {
+  if (version == FRAMING_V1) {
+    if (avail < sizeof(size_t)) return 0;
+    memcpy(payload, in, sizeof(size_t));
+    if (*payload > MAX_MESSAGE_LENGTH) return -1;
+    *header = sizeof(size_t);
+    *type = FRAME_MESSAGE;
+    return 1;
+  }
+
+  uint64_t tag;
+  int rc = varint_decode(in, avail, &tag);
+  if (rc <= 0) return rc;
+  *header = rc;
+  *type = tag & 1;
+  *payload = tag >> 1;
+  if (*payload > (*type == FRAME_BATCH ? MAX_BATCH_LENGTH : MAX_MESSAGE_LENGTH - 1)) return -1;
+  return 1;
+}
+
+// Hand out len bytes at text as a view, NUL-terminated at term until the next call
+static int reader_yield(msg_reader_t* reader, msg_view_t* view, char* text, size_t len,
+                        char* term) {
+  reader->term = term;
+  reader->term_saved = *term;
+  *term = '\0';
+  view->text = text;
+  view->len = len;
+  return 1;
+}
+
+// Take the next message out of the batch being unpacked
+static int reader_batch_view(msg_reader_t* reader, msg_view_t* view) {
+  const uint8_t* in = (const uint8_t*)reader->batch + reader->batch_pos;
+  size_t avail = reader->batch_end - reader->batch_pos;
+
+  // A batch holds complete message frames and nothing else
+  uint64_t tag;
+  int header = varint_decode(in, avail, &tag);
+  size_t len = tag >> 1;
+  if (header <= 0 || (tag & 1) != FRAME_MESSAGE || len > avail - header ||
+      len >= MAX_MESSAGE_LENGTH) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  char* text = reader->batch + reader->batch_pos + header;
+  char* end = text + len;
+  reader->batch_pos += header + len;
+  if (reader->batch_pos == reader->batch_end) reader->release = reader->batch_frame;
+  reader_control(view, &text, &len);
+  return reader_yield(reader, view, text, len, reader_term(reader, end));
+}
+
+// Take the next complete message from what has been read
+int msg_reader_view(msg_reader_t* reader, msg_view_t* view) {
+  reader_settle(reader);
+
+  while (true) {
+    view->control = 0;
+    if (reader->batch_pos < reader->batch_end) return reader_batch_view(reader, view);
+
+    // Headers are short, so parse them from a copy rather than caring where the ring wraps
+    uint8_t peek[MAX_VARINT_LEN];
+    size_t avail = reader->tail - reader->head;
+    ring_copy(reader, reader->head, peek, avail < sizeof(peek) ? avail : sizeof(peek));
+
+    size_t header, len;
+    int type;
+    int rc = parse_header(reader->version, peek, avail < sizeof(peek) ? avail : sizeof(peek),
+                          &header, &len, &type);
+    if (rc < 0) errno = EINVAL;
+    if (rc <= 0) return rc;
+    if (avail < header + len) return 0;
+
+    char* payload = reader_span(reader, reader->head + header, len);
+    if (payload == NULL) return -1;
+
+    // Unpack a batch and go around again for its first message. Its bytes stay in the ring
+    // until the last message has been handed out.
+    if (type == FRAME_BATCH) {
+      if (len == 0) {
+        reader->head += header;
+        continue;
+      }
+      reader->batch = payload;
+      reader->batch_pos = 0;
+      reader->batch_end = len;
+      reader->batch_frame = header + len;
+      continue;
+    }
+    reader->release = header + len;
+
+    char* text = payload;
+    reader_control(view, &text, &len);
+    if (reader->version == FRAMING_V1) {
+      // The framing only ever changes on a v1 control message
+      if (view->control == PROTO_ACCEPT || view->control == PROTO_SWITCH) {
+        reader->version = FRAMING_V2;
+      }
+
+      // v1 strings carry their own NUL
+      if (len > 0 && text[len - 1] == '\0') len--;
+    }
+    return reader_yield(reader, view, text, len, reader_term(reader, text + len));
+  }
+}
+
+// Put the message of the last view back
+void msg_reader_unread(msg_reader_t* reader) {
+  reader->release = 0;
+  reader_settle(reader);
+}
+
+// Move what one reader has read but not handed out yet into another, fresh reader
+void msg_reader_move(msg_reader_t* from, msg_reader_t* to) {
+  reader_settle(from);
+  size_t len = from->tail - from->head;
+  ring_copy(from, from->head, to->ring, len);
+  to->version = from->version;
+  to->head = 0;
+  to->tail = len;
+  from->head = from->tail;
+}
+
+// Return the next message, blocking until it has arrived
+char* msg_reader_next(msg_reader_t* reader, char* control) {
+  while (true) {
+    msg_view_t view;
+    int rc = msg_reader_view(reader, &view);
+    if (rc < 0) return NULL;
+
+    if (rc > 0) {
+      char* result = malloc(view.len + 1);
+      if (result == NULL) return NULL;
+      memcpy(result, view.text, view.len + 1);
+      if (control != NULL) *control = view.control;
+      return result;
+    }
+
+    if (msg_reader_fill(reader) <= 0) return NULL;
+  }
+}
@@ -1,7 +1,86 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
 #define MAX_MESSAGE_LENGTH 2048
 
+/* Framing versions.
+ *
+ * v1 prefixes every message with a host-endian size_t holding its length, NUL included.
+ *
+ * v2 prefixes every frame with a little-endian base-128 varint tag of (length << 1) | type.
+ * A FRAME_MESSAGE frame carries one message without its NUL. A FRAME_BATCH frame carries a
+ * sequence of complete FRAME_MESSAGE frames, so several messages arrive with one read.
+ *
+ * Every connection starts in v1. The server offers v2 with a PROTO_OFFER control message, a
+ * client that understands it answers PROTO_ACCEPT and sends v2 from then on, and the server
+ * replies PROTO_SWITCH and sends v2 from then on. Control messages start with a NUL byte, so
+ * v1-only clients print nothing for them and keep talking v1.
+ *
+ * A control message may carry an argument after its kind, and may come in either framing once
+ * the framing has been agreed. The server hands every player a PROTO_TOKEN naming their seat,
+ * and an empty one once the game is over. A client that lost its connection while it still
+ * held a token can reconnect and send it back as PROTO_RESUME, before anything else, to take
+ * its seat again in a game the server restored from a checkpoint.
+ */
+#define FRAMING_V1 1
+#define FRAMING_V2 2
+
+#define FRAME_MESSAGE 0
+#define FRAME_BATCH 1
+
+#define MAX_BATCH_LENGTH 16384
+#define MAX_VARINT_LEN 10
+
+#define PROTO_OFFER 'o'
+#define PROTO_ACCEPT 'a'
+#define PROTO_SWITCH 's'
+#define PROTO_TOKEN 't'
+#define PROTO_RESUME 'r'
+#define PROTO_CONTROL_LEN 5
+#define PROTO_TOKEN_MAX 64  // Room for the longest seat token and its NUL
+
+// Bytes buffered per connection. A power of two with room for the largest frame and then some.
+#define MSG_RING_SIZE 32768
+
+// One decoded message. text points into the reader and is NUL-terminated; it stays valid, and
+// may be modified, until the next call on the reader.
+typedef struct msg_view {
+  char* text;
+  size_t len;
+  char control;  // kind of a control message, 0 for every other message
+} msg_view_t;
+
+// Incremental decoder for a socket's incoming frames, in either framing. Bytes are read into a
+// ring buffer and messages are handed out as views into it; a frame is only copied when it
+// wraps around the end of the ring.
+typedef struct msg_reader {
+  int fd;
+  int version;  // framing of incoming frames
+
+  // Stream positions of the first unconsumed byte and the end of what has been read
+  size_t head;
+  size_t tail;
+  char ring[MSG_RING_SIZE];
+
+  // Holds a frame that wraps around the end of the ring, allocated on first use
+  char* scratch;
+
+  // Messages left in the batch frame being unpacked
+  char* batch;
+  size_t batch_pos;
+  size_t batch_end;
+  size_t batch_frame;  // bytes of the whole batch frame, consumed once it is unpacked
+
+  // Left over from the last view, settled at the start of the next call
+  size_t release;  // bytes to consume
+  char* term;  // byte overwritten to NUL-terminate the view
+  char term_saved;
+} msg_reader_t;
+
 // Send a across a socket with a header that includes the message length. Returns non-zero value if
 // an error occurs.
 int send_message(int fd, char* message);
@@ -9,3 +88,53 @@ int send_message(int fd, char* message);
 // Receive a message from a socket and return the message string (which must be freed later).
 // Returns NULL when an error occurs.
 char* receive_message(int fd);
+
+// Send a message in v2 framing. Returns non-zero value if an error occurs.
+int send_message_v2(int fd, char* message);
+
+// Send a PROTO_* control message. Control messages are always in v1 framing.
+// Returns non-zero value if an error occurs.
+int send_control(int fd, char kind);
+
+// Send a PROTO_* control message with a NUL-terminated argument, in v1 framing.
+// Returns non-zero value if an error occurs.
+int send_control_arg(int fd, char kind, const char* arg);
+
+// Fill out the payload of a PROTO_* control message, which is PROTO_CONTROL_LEN bytes long
+void encode_control(char kind, char* payload);
+
+// Encode value as a varint into out, which must hold MAX_VARINT_LEN bytes. Returns its length.
+size_t varint_encode(uint64_t value, uint8_t* out);
+
+// Decode a varint from the first len bytes of in. Returns the number of bytes used, 0 if more
+// bytes are needed, or -1 if the varint is malformed.
+int varint_decode(const uint8_t* in, size_t len, uint64_t* value);
+
+// Set up a reader for a socket whose peer starts out in v1 framing
+void msg_reader_init(msg_reader_t* reader, int fd);
+
+// Free the reader's scratch space. Does not close the socket.
+void msg_reader_destroy(msg_reader_t* reader);
+
+// Read as many bytes as the socket has and the ring has room for, with one system call.
+// Returns the number of bytes read, 0 at end of file, or -1 if an error occurs (EAGAIN when a
+// non-blocking socket has nothing to read).
+ssize_t msg_reader_fill(msg_reader_t* reader);
+
+// Take the next complete message from what has been read. Control messages come back with
+// view->control set to their kind and their argument, often empty, as the text; a PROTO_ACCEPT
+// or PROTO_SWITCH moves the reader to v2. Returns 1 with *view filled, 0 if more bytes are needed, or -1 if an error
+// occurs (EINVAL for a malformed frame).
+int msg_reader_view(msg_reader_t* reader, msg_view_t* view);
+
+// Put the message of the last view back, so the next call hands it out again. Not for a view
+// taken out of a batch.
+void msg_reader_unread(msg_reader_t* reader);
+
+// Move what one reader has read but not handed out yet into another, freshly set up reader of
+// the same socket, leaving the first one empty. The first must not be unpacking a batch.
+void msg_reader_move(msg_reader_t* from, msg_reader_t* to);
+
+// Return the next message (which must be freed later), blocking until it has arrived. *control
+// is set like view->control. Returns NULL when an error occurs.
+char* msg_reader_next(msg_reader_t* reader, char* control);
@@ -0,0 +1,144 @@
+#include "reactor.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "util.h"
+
+#define REACTOR_MAX_EVENTS 64
+
+// Fire every timer that is due. Called when the timerfd expires.
+static void reactor_timer_tick(void* ctx, int fd) {
+  reactor_t* r = ctx;
+
+  // Drain the expiration count so the timerfd stops being readable
+  uint64_t expirations;
+  if (read(fd, &expirations, sizeof(expirations)) == -1 && errno != EAGAIN) {
+    perror("Failed to read timerfd");
+  }
+
+  r->armed_tick = UINT64_MAX;
+  timer_wheel_advance(&r->wheel, monotonic_ms());
+}
+
+// Point the timerfd at the wheel's next expiry, if that changed
+static void reactor_arm(reactor_t* r) {
+  uint64_t next = timer_wheel_next(&r->wheel);
+  if (next == r->armed_tick) return;
+
+  // An all-zero it_value disarms the timerfd. The monotonic clock is never at zero,
+  // so an armed deadline always has a non-zero value.
+  struct itimerspec spec = {0};
+  if (next != UINT64_MAX) {
+    spec.it_value.tv_sec = next / 1000;
+    spec.it_value.tv_nsec = (next % 1000) * 1000000;
+  }
+
+  if (timerfd_settime(r->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) == -1) {
+    perror("Failed to arm timerfd");
+    return;
+  }
+  r->armed_tick = next;
+}
+
+// Set up a reactor
+int reactor_init(reactor_t* r) {
+  r->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (r->epoll_fd == -1) return -1;
+
+  r->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (r->timer_fd == -1) {
+    close(r->epoll_fd);
+    return -1;
+  }
+
+  r->running = false;
+  r->armed_tick = UINT64_MAX;
+  r->on_idle = NULL;
+  r->idle_ctx = NULL;
+  timer_wheel_init(&r->wheel, monotonic_ms());
+
+  r->timer_handle.fd = r->timer_fd;
+  r->timer_handle.on_readable = reactor_timer_tick;
+  r->timer_handle.on_writable = NULL;
+  r->timer_handle.ctx = r;
+  if (reactor_add(r, &r->timer_handle) != 0) {
+    reactor_destroy(r);
+    return -1;
+  }
+  return 0;
+}
+
+// Start watching handle->fd for readability
+int reactor_add(reactor_t* r, reactor_handle_t* handle) {
+  struct epoll_event ev = {.events = EPOLLIN, .data.ptr = handle};
+  return epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, handle->fd, &ev);
+}
+
+// Start or stop also watching handle->fd for writability
+int reactor_watch_writable(reactor_t* r, reactor_handle_t* handle, bool watch) {
+  struct epoll_event ev = {.events = watch ? EPOLLIN | EPOLLOUT : EPOLLIN, .data.ptr = handle};
+  return epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, handle->fd, &ev);
+}
+
+// Stop watching handle->fd
+int reactor_remove(reactor_t* r, reactor_handle_t* handle) {
+  return epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, handle->fd, NULL);
+}
+
+// Run fn(ctx) once, ms milliseconds from now
+void reactor_add_timer(reactor_t* r, wheel_timer_t* t, uint64_t ms, void (*fn)(void* ctx),
+                       void* ctx) {
+  // Only the timerfd tick fires timers, so a callback never runs inside whoever scheduled one
+  timer_wheel_add(&r->wheel, t, monotonic_ms(), ms, fn, ctx);
+}
+
+// Cancel a timer
+void reactor_cancel_timer(reactor_t* r, wheel_timer_t* t) {
+  timer_wheel_cancel(&r->wheel, t);
+}
+
+// Dispatch events until reactor_stop is called
+void reactor_run(reactor_t* r) {
+  struct epoll_event events[REACTOR_MAX_EVENTS];
+
+  r->running = true;
+  while (r->running) {
+    // Timers may have been added or cancelled by the last batch of callbacks
+    reactor_arm(r);
+
+    int n = epoll_wait(r->epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait failed");
+      return;
+    }
+
+    for (int i = 0; i < n && r->running; i++) {
+      // Hang-ups and errors go to the read side, which finds out what happened
+      reactor_handle_t* handle = events[i].data.ptr;
+      if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        handle->on_readable(handle->ctx, handle->fd);
+      }
+      if ((events[i].events & EPOLLOUT) && handle->on_writable != NULL) {
+        handle->on_writable(handle->ctx, handle->fd);
+      }
+    }
+
+    if (r->on_idle != NULL) r->on_idle(r->idle_ctx);
+  }
+}
+
+// Make reactor_run return after the current event
+void reactor_stop(reactor_t* r) {
+  r->running = false;
+}
+
+// Release the reactor's resources
+void reactor_destroy(reactor_t* r) {
+  close(r->timer_fd);
+  close(r->epoll_fd);
+}
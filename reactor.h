@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "timer_wheel.h"
+
+// Callback invoked by the reactor when a registered file descriptor is ready
+typedef void (*reactor_fn)(void* ctx, int fd);
+
+// Registration record for one file descriptor. Owned by the caller and must stay alive while
+// the descriptor is registered.
+typedef struct reactor_handle {
+  int fd;
+  reactor_fn on_readable;
+  reactor_fn on_writable;  // only called while writability is watched, may be NULL otherwise
+  void* ctx;
+} reactor_handle_t;
+
+// A single-threaded epoll event loop. Timers live in a timing wheel whose next expiry is
+// armed on a timerfd, so the loop sleeps in epoll_wait until there is real work to do.
+typedef struct reactor {
+  int epoll_fd;
+  bool running;
+
+  int timer_fd;
+  reactor_handle_t timer_handle;
+  uint64_t armed_tick;  // tick the timerfd is armed for, UINT64_MAX when disarmed
+  timer_wheel_t wheel;
+
+  // Called after every batch of events, once no callback is running. This is the safe place
+  // to free state that registered handles or timers point to.
+  void (*on_idle)(void* ctx);
+  void* idle_ctx;
+} reactor_t;
+
+// Set up a reactor. Returns non-zero value if an error occurs.
+int reactor_init(reactor_t* r);
+
+// Start watching handle->fd for readability. Returns non-zero value if an error occurs.
+int reactor_add(reactor_t* r, reactor_handle_t* handle);
+
+// Start or stop also watching handle->fd for writability. Returns non-zero value if an error
+// occurs.
+int reactor_watch_writable(reactor_t* r, reactor_handle_t* handle, bool watch);
+
+// Stop watching handle->fd. Returns non-zero value if an error occurs.
+int reactor_remove(reactor_t* r, reactor_handle_t* handle);
+
+// Run fn(ctx) once, ms milliseconds from now. Reschedules the timer if it is already pending.
+void reactor_add_timer(reactor_t* r, wheel_timer_t* t, uint64_t ms, void (*fn)(void* ctx),
+                       void* ctx);
+
+// Cancel a timer. Does nothing if it is not pending.
+void reactor_cancel_timer(reactor_t* r, wheel_timer_t* t);
+
+// Dispatch events until reactor_stop is called
+void reactor_run(reactor_t* r);
+
+// Make reactor_run return after the current event
+void reactor_stop(reactor_t* r);
+
+// Release the reactor's resources
+void reactor_destroy(reactor_t* r);
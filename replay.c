@@ -0,0 +1,382 @@
+// Reads the journals the server writes with -j. Every journal is mapped into memory and walked in
+// place, so filtering runs at the speed of the page cache or the disk.
+//
+// By default every record that passes the filters is printed as one line of key=value pairs.
+// With -c only the number of matching records of each kind is printed. With -V every game is
+// played again through the rules engine, from its seed and the inputs the journal recorded, and
+// each event the engine reports must be the one the server journaled: a journal that verifies is
+// exactly what the rules made of what the players did. A game a restarted server restored from
+// its checkpoint is played on from the engine its restore record holds.
+//
+// A summary line with the volume read and the time it took goes to stderr.
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "journal.h"
+
+static const char* const kind_names[JOURNAL_KIND_COUNT] = {
+    "game", "join", "act", "timeout", "vote_start", "vote_end", "leave", "chat", "event", "end", "restore",
+};
+
+static const char* const decision_names[] = {
+    "nothing", "seer", "werewolf", "guard", "witch_save", "witch_kill", "hunter", "vote",
+};
+
+static const char* const event_names[] = {
+    "night", "ask", "seen", "dying", "no_potion", "task_done", "died",
+    "dawn", "day", "vote", "voted_out", "tie", "game_over",
+};
+
+// Which records to look at, and what to do with them
+typedef struct filter {
+  long game;    // only this game, or -1 for all
+  int player;   // only records about this player, as player or target, or NO_PLAYER for all
+  int kind;     // only this journal_kind_t, or -1 for all
+  bool count;   // count the matches instead of printing them
+  bool verify;  // play every game again through the engine
+} filter_t;
+
+// A game being played again
+typedef struct replay_game {
+  engine_t engine;
+  bool started;  // players can leave between the deal and the first night
+} replay_game_t;
+
+// Games being played again, indexed by game id
+typedef struct replay {
+  replay_game_t** games;  // NULL where a game has not started, has ended or has diverged
+  size_t capacity;
+  uint64_t verified;
+  uint64_t diverged;
+  uint64_t restored;  // games cut off by a restart and picked up again from their checkpoint
+} replay_t;
+
+// Everything a run adds up
+typedef struct totals {
+  uint64_t bytes;
+  uint64_t records;
+  uint64_t matched;
+  uint64_t kinds[JOURNAL_KIND_COUNT];
+} totals_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static const char* name_of(const char* const* names, size_t count, int value) {
+  return value >= 0 && (size_t)value < count ? names[value] : "unknown";
+}
+
+// Print one record as a line of key=value pairs
+static void print_record(const journal_record_t* r, const char* payload) {
+  printf("time_ms=%llu game=%u kind=%s", (unsigned long long)r->time_ms, r->game, kind_names[r->kind]);
+  switch (r->kind) {
+    case JOURNAL_GAME: {
+      journal_game_t table;
+      memcpy(&table, payload, sizeof(table));
+      printf(" players=%d seed=%llu", r->value, (unsigned long long)table.seed);
+      for (int i = 0; i < ROLE_COUNT; i++) printf(" %s=%d", role_names[i], table.roles[i]);
+      break;
+    }
+    case JOURNAL_JOIN:
+      printf(" player=%d role=%s", r->player, name_of(role_names, ROLE_COUNT, r->value));
+      break;
+    case JOURNAL_ACT:
+    case JOURNAL_TIMEOUT:
+      printf(" player=%d decision=%s target=%d", r->player, name_of(decision_names, 8, r->detail), r->target);
+      break;
+    case JOURNAL_LEAVE:
+      printf(" player=%d", r->player);
+      break;
+    case JOURNAL_RESTORE:
+      printf(" players=%d", r->value);
+      break;
+    case JOURNAL_CHAT:
+      printf(" player=%d text=%.*s", r->player, (int)r->length, payload);
+      break;
+    case JOURNAL_EVENT:
+      printf(" event=%s player=%d target=%d value=%d", name_of(event_names, 13, r->detail), r->player, r->target,
+             r->value);
+      break;
+    default:
+      break;
+  }
+  putchar('\n');
+}
+
+// The game being played again with a given id, growing the table to fit it
+static replay_game_t** replay_slot(replay_t* replay, uint32_t game) {
+  if (game >= replay->capacity) {
+    size_t capacity = replay->capacity == 0 ? 64 : replay->capacity;
+    while (capacity <= game) capacity *= 2;
+    replay_game_t** games = realloc(replay->games, capacity * sizeof(replay_game_t*));
+    if (games == NULL) {
+      perror("Failed to grow the replay table");
+      exit(EXIT_FAILURE);
+    }
+    memset(games + replay->capacity, 0, (capacity - replay->capacity) * sizeof(replay_game_t*));
+    replay->games = games;
+    replay->capacity = capacity;
+  }
+  return &replay->games[game];
+}
+
+// Stop playing a game again, counting it as verified or not
+static void replay_finish(replay_t* replay, replay_game_t** slot, bool verified) {
+  if (verified)
+    replay->verified++;
+  else
+    replay->diverged++;
+  free(*slot);
+  *slot = NULL;
+}
+
+// Feed one record to the engine playing its game again. Returns false if the game diverges.
+static bool replay_step(replay_game_t* game, const journal_record_t* r) {
+  engine_t* engine = &game->engine;
+
+  // The server starts the game once every seat is registered, which a player can fail
+  if (!game->started && r->kind != JOURNAL_JOIN && r->kind != JOURNAL_LEAVE) {
+    engine_start(engine);
+    game->started = true;
+  }
+
+  engine_event_t event;
+  switch (r->kind) {
+    case JOURNAL_JOIN:
+      return r->player >= 0 && r->player < engine->config.players && engine->role[r->player] == (role_t)r->value;
+    case JOURNAL_ACT:
+      return engine_act(engine, r->player, r->detail, r->target) == ENGINE_OK;
+    case JOURNAL_TIMEOUT:
+      engine_timeout(engine, r->player);
+      return true;
+    case JOURNAL_VOTE_START:
+      engine_start_vote(engine);
+      return true;
+    case JOURNAL_VOTE_END:
+      engine_end_vote(engine);
+      return true;
+    case JOURNAL_LEAVE:
+      engine_leave(engine, r->player);
+      return true;
+    case JOURNAL_EVENT:
+      return engine_next_event(engine, &event) && event.kind == r->detail && event.player == r->player &&
+             event.target == r->target && event.value == r->value;
+    case JOURNAL_END:
+      return engine->over && !engine_next_event(engine, &event);
+    default:
+      return true;
+  }
+}
+
+// Play the game a record belongs to one step further
+static void replay_record(replay_t* replay, const journal_record_t* r, const char* payload, const char* path,
+                          size_t offset) {
+  replay_game_t** slot = replay_slot(replay, r->game);
+
+  // A game is dealt again from its seed
+  if (r->kind == JOURNAL_GAME) {
+    journal_game_t table;
+    memcpy(&table, payload, sizeof(table));
+    game_config_t config = {.players = r->value};
+    memcpy(config.roles, table.roles, sizeof(config.roles));
+
+    if (*slot != NULL) replay_finish(replay, slot, false);
+    *slot = malloc(sizeof(replay_game_t));
+    if (*slot == NULL) {
+      perror("Failed to allocate engine");
+      exit(EXIT_FAILURE);
+    }
+    engine_init(&(*slot)->engine, &config, table.seed);
+    (*slot)->started = false;
+    return;
+  }
+
+  // A restored game carries on from its checkpoint. What the journal holds of it from before the
+  // restart may go past the checkpoint, or stop short of it, so that part is left unverified.
+  if (r->kind == JOURNAL_RESTORE) {
+    if (*slot != NULL) {
+      free(*slot);
+      *slot = NULL;
+    }
+    replay->restored++;
+    *slot = malloc(sizeof(replay_game_t));
+    if (*slot == NULL) {
+      perror("Failed to allocate engine");
+      exit(EXIT_FAILURE);
+    }
+    (*slot)->started = true;
+    if (!engine_load(&(*slot)->engine, payload, r->length)) {
+      fprintf(stderr, "%s: game %u has a restore record that is not a saved engine, at offset %zu\n", path, r->game,
+              offset);
+      replay_finish(replay, slot, false);
+    }
+    return;
+  }
+
+  if (*slot == NULL) return;
+  if (!replay_step(*slot, r)) {
+    fprintf(stderr, "%s: game %u diverges at offset %zu, a %s record\n", path, r->game, offset, kind_names[r->kind]);
+    replay_finish(replay, slot, false);
+  } else if (r->kind == JOURNAL_END) {
+    replay_finish(replay, slot, true);
+  }
+}
+
+// Whether a record passes the filters
+static bool matches(const filter_t* filter, const journal_record_t* r) {
+  if (filter->game != -1 && r->game != filter->game) return false;
+  if (filter->kind != -1 && r->kind != filter->kind) return false;
+  if (filter->player != NO_PLAYER && r->player != filter->player && r->target != filter->player) return false;
+  return true;
+}
+
+// Map one journal and walk every record in it. Returns -1 if it cannot be read.
+static int read_journal(const char* path, const filter_t* filter, replay_t* replay, totals_t* totals) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    perror(path);
+    return -1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    perror(path);
+    close(fd);
+    return -1;
+  }
+  size_t size = st.st_size;
+  if (size < JOURNAL_MAGIC_LEN) {
+    fprintf(stderr, "%s: not a journal\n", path);
+    close(fd);
+    return -1;
+  }
+
+  const char* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror(path);
+    return -1;
+  }
+  madvise((void*)map, size, MADV_SEQUENTIAL);
+  if (memcmp(map, JOURNAL_MAGIC, JOURNAL_MAGIC_LEN) != 0) {
+    fprintf(stderr, "%s: not a journal\n", path);
+    munmap((void*)map, size);
+    return -1;
+  }
+
+  // Records are 8-byte aligned in the file, and so in the mapping
+  size_t offset = JOURNAL_MAGIC_LEN;
+  while (offset + sizeof(journal_record_t) <= size) {
+    const journal_record_t* r = (const journal_record_t*)(map + offset);
+    size_t record_size = JOURNAL_RECORD_SIZE(r->length);
+    bool valid = r->kind < JOURNAL_KIND_COUNT && (r->kind != JOURNAL_GAME || r->length == sizeof(journal_game_t));
+    if (!valid || offset + record_size > size) {
+      // The server may be in the middle of a write, or have died in one
+      fprintf(stderr, "%s: stopped at offset %zu, the rest is not a whole record\n", path, offset);
+      break;
+    }
+    const char* payload = map + offset + sizeof(journal_record_t);
+
+    totals->records++;
+    if (filter->verify) replay_record(replay, r, payload, path, offset);
+    if (matches(filter, r)) {
+      totals->matched++;
+      totals->kinds[r->kind]++;
+      if (!filter->count && !filter->verify) print_record(r, payload);
+    }
+    offset += record_size;
+  }
+
+  totals->bytes += offset;
+  munmap((void*)map, size);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  filter_t filter = {.game = -1, .player = NO_PLAYER, .kind = -1, .count = false, .verify = false};
+
+  int opt;
+  while ((opt = getopt(argc, argv, "g:p:k:cV")) != -1) {
+    switch (opt) {
+      case 'g':
+        filter.game = atol(optarg);
+        break;
+      case 'p':
+        // Seats are numbered from 1 in player names, and from 0 in the journal
+        filter.player = atoi(optarg) - 1;
+        break;
+      case 'k':
+        for (int k = 0; k < JOURNAL_KIND_COUNT; k++)
+          if (strcmp(optarg, kind_names[k]) == 0) filter.kind = k;
+        if (filter.kind == -1) {
+          fprintf(stderr, "Unknown kind %s\n", optarg);
+          exit(EXIT_FAILURE);
+        }
+        break;
+      case 'c':
+        filter.count = true;
+        break;
+      case 'V':
+        filter.verify = true;
+        break;
+      default:
+        optind = argc + 1;
+        break;
+    }
+  }
+  if (optind >= argc) {
+    fprintf(stderr, "Usage: %s [-g game] [-p player number] [-k kind] [-c] [-V] journal...\n", argv[0]);
+    exit(EXIT_FAILURE);
+  }
+
+  // Printing every record is the slow part, so it is buffered in large blocks
+  static char out[1 << 16];
+  setvbuf(stdout, out, _IOFBF, sizeof(out));
+
+  totals_t totals;
+  memset(&totals, 0, sizeof(totals));
+  replay_t replay;
+  memset(&replay, 0, sizeof(replay));
+  int failures = 0;
+  uint64_t start = now_ns();
+  for (int i = optind; i < argc; i++) {
+    if (read_journal(argv[i], &filter, &replay, &totals) != 0) failures++;
+  }
+  double elapsed = (now_ns() - start) / 1e9;
+
+  if (filter.count) {
+    printf("matched=%llu", (unsigned long long)totals.matched);
+    for (int k = 0; k < JOURNAL_KIND_COUNT; k++) printf(" %s=%llu", kind_names[k], (unsigned long long)totals.kinds[k]);
+    putchar('\n');
+  }
+  if (filter.verify) {
+    // Games still being played again when the journal ends were cut off, not proven wrong
+    uint64_t unfinished = 0;
+    for (size_t g = 0; g < replay.capacity; g++) {
+      if (replay.games[g] != NULL) unfinished++;
+      free(replay.games[g]);
+    }
+    free(replay.games);
+    printf("verified=%llu diverged=%llu unfinished=%llu restored=%llu\n", (unsigned long long)replay.verified,
+           (unsigned long long)replay.diverged, (unsigned long long)unfinished, (unsigned long long)replay.restored);
+    if (replay.diverged > 0) failures++;
+  }
+  fflush(stdout);
+
+  fprintf(stderr, "replay files=%d bytes=%llu records=%llu matched=%llu elapsed_s=%.3f mb_per_s=%.0f\n", argc - optind,
+          (unsigned long long)totals.bytes, (unsigned long long)totals.records, (unsigned long long)totals.matched,
+          elapsed, elapsed > 0 ? totals.bytes / elapsed / 1e6 : 0.0);
+  return failures == 0 ? 0 : EXIT_FAILURE;
+}
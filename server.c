@@ -1,7 +1,10 @@
 /*-----------------------------------------LIBRARY-----------------------------------------*/
 
 
+#include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,937 +13,470 @@
 
 #include "socket.h"
 #include "message.h"
+#include "checkpoint.h"
+#include "game.h"
+#include "journal.h"
+#include "spectator.h"
+#include "stats.h"
 #include "util.h"
+#include "worker.h"
 
 
 /*-----------------------------------------MACROS-----------------------------------------*/
 
 
-#define ALIVE 0
-#define DEAD 1
-#define DISCONNECTED 2
-#define MAX_NAME_LEN 9
-#define MAX_ROLE_LEN 12
-#define MAX_WEREWOLF_COUNT 2
-#define DISCUSSION_TIME_NIGHT 10000
-#define DISCUSSION_TIME_DAY 20000
-#define USERS 7 // Number of users connected this specific client
+#define STATS_INTERVAL_MS 5000 // Default time between stats snapshots
+#define REATTACH_WINDOW_MS 1000 // How long the players of games restored after a restart have to take their seats back
+#define RESUME_WAIT_MS 250 // How long a connection has to send its token during that window before it is seated as a new player
+#define MAX_PENDING 1024 // Connections waiting to send their token at once
 
 
-/*-----------------------------------------GLOBAL VALUES-----------------------------------------*/
+/*-----------------------------------------TYPES-----------------------------------------*/
 
 
-bool witch_kill = true; // whether the witch has used her kill potion
-bool witch_save = true; // whether the witch has used her save potion
-
-// All 7 roles and their availability
-char roles[][USERS][MAX_ROLE_LEN] = {{"werewolf", "werewolf", "guard", "witch", "hunter", "seer", "villager"},
-                                     {"available", "available", "available", "available", "available", "available", "available"}};
-
-// All player names
-char names[][MAX_NAME_LEN] = {"Player 1", "Player 2", "Player 3", "Player 4", "Player 5", "Player 6", "Player 7"};
-
-// struct that stores user's info
-typedef struct user
+// Where and how often the stats of a worker pool are written out
+typedef struct stats_writer
 {
-  char player_name[MAX_NAME_LEN];
-  int socket;
-  char role[MAX_ROLE_LEN];
-  int status;        // whether they're dead or alive
-  int votes_against; // tally of their votes during the day function
-  char *message;
-} users_t;
-
-// Array of all users
-users_t user_lst[USERS];
-
-// Dictates who to receive and broadcast message to
-// When active_roles is 'public', everyone gets to talk
-// Otherwise, active_roles will be modified to reflect who gets to communicate
-char *active_roles;
+  FILE *out;
+  int interval_ms;
+  worker_t *pool;
+  int workers;
+  journal_t *journal; // NULL if the server keeps no journal
+  checkpointer_t *checkpoints; // NULL if games are not checkpointed
+  spectator_hub_t *spectators; // NULL if nobody can watch
+} stats_writer_t;
+
+// Where new players are seated, and the games restored after a restart that wait for theirs
+typedef struct lobby
+{
+  game_t *game;                // table filling up, NULL until the next player arrives
+  int next_id;                 // id of the next table opened
+  const game_config_t *config; // how every table is laid out
+  checkpointer_t *checkpoints; // where games are checkpointed, NULL for nowhere
+  spectator_hub_t *spectators; // where games can be watched from, NULL if nobody can
+  game_t *restored;            // games restored from checkpoints, linked through next
+  worker_t *pool;
+  int workers;
+} lobby_t;
+
+// A connection made while restored games wait for their players, not known yet to be one of them
+typedef struct pending
+{
+  int fd;
+  uint64_t since;       // when it was accepted
+  msg_reader_t *reader; // what it has sent so far
+} pending_t;
 
 
 /*-----------------------------------------FUNCTIONS HEADERS-----------------------------------------*/
 
 
-/*----------Connections----------*/
-
-// Thread function for each player that check active status then receive message if appropriate
-void *user_input(void *user_info);
-
-// Loop and accept connections from 7 users before starting the game
-void accept_connections(int socket);
-
-/*----------Messages----------*/
-
-// Check whether message was sent, if not, call fail_message
-void send_safe_message(users_t user_x, char *message);
-
-// Check whether user has disconnected, if so, kill them and mute them
-void fail_message(users_t *user_to_kill);
-
-// Receive miscellaneous from users and discard them
-void dump();
-
-/*----------User Set-up and Check----------*/
-
-// Send welcoming messages and inform users of their name and roles
-void welcome_user(int user_port, int i);
-
-// Function to determine if a given name is an alive player name
-bool check_name(char *name);
-
-/*----------Status Updates----------*/
-
-/* Check game's current state to see if they match any of the ending criteria
-   Returns true if the game continues, false if otherwise. */
-bool check_game_status();
+// Accept connections forever, seating users at a new game and handing it to a worker once full
+void accept_connections(int server_socket_fd, lobby_t *lobby);
 
-// Inform users of what happened last night, and whether there are any deaths
-void night_status_update(char *witch_k, char *werewolf_k, char *hunter_k);
+/* Seat a newly connected player at the table filling up, and hand the table over once it is full. What buffered has
+   read from the socket already, if not NULL, is handed to the seat. */
+void seat_player(lobby_t *lobby, int client_socket_fd, msg_reader_t *buffered);
 
-/*----------Role Functions----------*/
+/* Give the players of restored games a short window to take their seats back. A restored game is
+   handed to a worker as soon as all its players are back, or with the seats left empty once the window is over. */
+void reattach_players(int server_socket_fd, lobby_t *lobby);
 
-/* Calls seer(), then prompt the werewolves to kill a non-werewolf player, give them 10s to discuss 
-   and one player will be called upon to make a decision
-   Returns player to be killed
-   Notes: they cannot kill themselves */
-char *werewolf_night_func();
+// Read what a pending connection sent. Returns true once it is settled: back in its seat, seated as a new player or closed.
+bool pending_input(lobby_t *lobby, pending_t *pending);
 
-/* Calls the guard and prompt them to save one person
-   If they happen to save a dying person, an empty string will be returned
-   Else, return the person killed by the werewolves
-   Notes: the guard cannot save themself and does not know who was killed by the wolves */
-char *guard_night_func();
+// Hand a restored game over to a worker, which carries on from its checkpoint
+void resume_game(lobby_t *lobby, game_t *game);
 
-/* Inform the witch of the dying person, if any, then ask whether they want to save
-   Returns appropriate dying player if they are not saved
-   Otherwise, return an empty string if they are saved
-   Notes: the witch can only save once */
-char *witch_night_func_save();
+// Called for every checkpoint found at startup: restore its game and hold it until its players are back
+void restore_game(void *lobby_info, int id, const char *data, size_t len);
 
-/* Ask the witch whether they want to kill someone
-   If yes, return the player's name, else return an empty string
-   Notes: the witch can only kill once */
-char *witch_night_func_kill();
+// Give a new or restored game what the server keeps for every game: where it is checkpointed and watched from
+void equip_game(lobby_t *lobby, game_t *game);
 
-// Prompt the seer to see one player's role
-void seer();
-
-/* Prompt the hunter to pick one person to die with them if they are killed
-   If they are killed by either the witch or the werewolves, return the name of the player they pick 
-   Else, return an empty string */
-char *hunter_func(char *witch_s, char *witch_k);
-
-/*----------Day Phase Function----------*/
-
-// Prompt all users to discuss then take turn to vote on one player to be killed
-void day_func();
+// Thread function that appends a snapshot of every worker's stats to a file at a fixed interval
+void *stats_writer_main(void *arg);
 
 
 /*-----------------------------------------FUNCTIONS-----------------------------------------*/
 
 
-/*-------------------------Connections-------------------------*/
-
-
-// Thread function for each player that check active status then receive message if appropriate
-void *user_input(void *user_info)
+// Accept connections forever, seating users at a new game and handing it to a worker once full
+void accept_connections(int server_socket_fd, lobby_t *lobby)
 {
-  users_t *my_user = (users_t *)user_info;
+  // Players of games restored after a restart get the first moments to take their seats back
+  reattach_players(server_socket_fd, lobby);
 
-  // Wait on message from user
   while (true)
-  { 
-    char *message = receive_message(my_user->socket);
-    if (message == NULL)
-    {
-      perror("Failed to read message from client");
-      // exit(EXIT_FAILURE);
-    }
-
-    for (int i = 0; i < USERS; i++)
-    {
-      // Check if active_roles is appropriate
-      if (strcmp(user_lst[i].player_name, my_user->player_name) != 0 &&
-          ((strcmp(user_lst[i].role, my_user->role) == 0) || strcmp("public", active_roles) == 0) && my_user->status == ALIVE)
-      {
-        send_safe_message(user_lst[i], my_user->player_name);
-        send_safe_message(user_lst[i], ": ");
-        send_safe_message(user_lst[i], message);
-        send_safe_message(user_lst[i], "\n");
-      }
-    }
-    free(message);
-  } // while loop
-
-  return NULL;
-
-} // user_input
-
-
-
-// Loop and accept connections from 7 users before starting the game
-void accept_connections(int server_socket_fd)
-{
-  int i = 0;
-
-  // Loop till all 7 players are connected
-  while (i < USERS)
   {
     //  create socket and accept connection
     int client_socket_fd = server_socket_accept(server_socket_fd);
     if (client_socket_fd == -1) // Wait for a client to connect
     {
       perror("accept failed");
-      exit(EXIT_FAILURE);
+      continue;
     }
-
-    // Set up player's initial status
-    strcpy(user_lst[i].player_name, names[i]);
-    user_lst[i].socket = client_socket_fd;
-    user_lst[i].status = ALIVE;
-    user_lst[i].votes_against = 0;
-    welcome_user(client_socket_fd, i);
-
-    i++;
+    seat_player(lobby, client_socket_fd, NULL);
   } // while loop
 
-} // accept_connecttions
-
-
+} // accept_connections
 
-/*-------------------------Messages-------------------------*/
 
 
-
-// Check whether message was sent, if not, call fail_message
-void send_safe_message(users_t receiver, char *message)
+// Seat a newly connected player at the table filling up, and hand the table over once it is full
+void seat_player(lobby_t *lobby, int client_socket_fd, msg_reader_t *buffered)
 {
-  int rc = send_message(receiver.socket, message);
-  if (rc == -1)
+  // Open a new table once the last one has filled up
+  if (lobby->game == NULL)
   {
-    fail_message(&receiver);
-  }
-} // send_safe_messages
-
-
-
-// Check whether user has disconnected, if so, kill them and mute them
-void fail_message(users_t *user_to_kill)
-{
-  // Check whether user is connected
-  if (user_to_kill->status != DISCONNECTED)
-  {
-    // Change the given user's status to be DISCONNECTED
-    user_to_kill->status = DISCONNECTED;
-    // Transmit a message to all other users in the network that our given user has disconnected and run again if a message fails cause another user disconnected
-    for (int i = 0; i < USERS; i++)
+    lobby->game = game_create(lobby->next_id++, lobby->config);
+    if (lobby->game == NULL)
     {
-      if (user_lst[i].status != DISCONNECTED)
-      {
-        int rc = send_message(user_lst[i].socket, user_to_kill->player_name);
-        rc = send_message(user_lst[i].socket, " has disconnected and will be considered dead for the rest of the game, if not already.");
-        if (rc == -1)
-        {
-          fail_message(&user_lst[i]);
-        }
-      }
+      perror("Failed to create game");
+      exit(EXIT_FAILURE);
     }
-  } // for loop
-} // fail_message
-
-
+    equip_game(lobby, lobby->game);
+  }
 
-// Receive all the miscellaneous from users and discard them
-// This is neccessary since every users' thread listen for their messages all the time and sometimes unwanted messages get mixed in
-void dump()
-{
-  pthread_t thread[USERS];
-  active_roles = "dump time";
-  for (int z = 0; z < USERS; z++)
+  // Seat the player. If the welcome fails, the seat stays open for the next one.
+  if (!game_join(lobby->game, client_socket_fd, buffered))
   {
-    if (pthread_create(&thread[z], NULL, user_input, &user_lst[z]) != 0) // create the thread for user_input for the new connection
-    {
-      perror("failed to create thread.\n");
-      exit(1);
-    }
+    close(client_socket_fd);
+    return;
   }
-  int wakeup_time = time_ms() + 500; // Give it 0.5s to dump
-  while ((int)time_ms() < wakeup_time)
-    ;
-  for (int i = 0; i < USERS; i++)
+
+  if (game_full(lobby->game))
   {
-    if (pthread_cancel(thread[i]) != 0)
-    {
-      perror("Failed to join thread.\n");
-      exit(1);
-    }
+    printf("Game %d is full, starting it\n", lobby->game->id);
+    worker_pool_submit(lobby->pool, lobby->workers, lobby->game);
+    lobby->game = NULL;
   }
-} // dump
-
-
-
-/*-------------------------User Set-Up and Name Check-------------------------*/
+} // seat_player
 
 
 
-// Send welcoming messages and inform users of their name and roles
-void welcome_user(int user_port, int i)
+/* Give the players of restored games a short window to take their seats back
+   A reconnecting client sends its token as soon as it is connected, so a connection that stays
+   quiet for RESUME_WAIT_MS is a new player and is seated like after the window. */
+void reattach_players(int server_socket_fd, lobby_t *lobby)
 {
-  // Welcome message and assign username
-  int rc = send_message(user_port, "Hello Player!\nWelcome to Werewolf!\nThe horror will start soon but for now. Your username will be: ");
-  if (rc == -1)
-  {
-    perror("Failed to send message to client");
-    exit(EXIT_FAILURE);
-  }
-  rc = send_message(user_port, user_lst[i].player_name);
-  send_message(user_port, "\n");
-  if (rc == -1)
-  {
-    perror("Failed to send message to client");
-    exit(EXIT_FAILURE);
-  }
+  static pending_t pending[MAX_PENDING];
+  static struct pollfd fds[MAX_PENDING + 1];
+  int count = 0;
+  uint64_t deadline = monotonic_ms() + REATTACH_WINDOW_MS;
 
-  // Assign their role 
-  while (true)
+  while (lobby->restored != NULL && monotonic_ms() < deadline)
   {
-    time_t t;
-    srand(time(&t));
-    int role_index = rand() % 7;
-    if (strcmp(roles[1][role_index], "available") == 0)
+    // Wake up for the end of the window or for the first connection that has waited long enough
+    uint64_t now = monotonic_ms();
+    int timeout = deadline - now;
+    for (int i = 0; i < count; i++)
     {
-      strcpy(roles[1][role_index], "taken");
-      strcpy(user_lst[i].role, roles[0][role_index]);
-      break;
+      fds[i] = (struct pollfd){.fd = pending[i].fd, .events = POLLIN};
+      uint64_t due = pending[i].since + RESUME_WAIT_MS;
+      if (due <= now)
+        timeout = 0;
+      else if (due - now < (uint64_t)timeout)
+        timeout = due - now;
     }
-    else
-      continue;
-  } // while loop
-
-  send_message(user_port, "Your role is: ");
-  send_message(user_port, user_lst[i].role);
-  send_message(user_port, "\n");
-  send_message(user_port, "The Game will start shortly!\n");
-
-} // welcome_user
-
 
-
-// Function to determine if a given name is an alive player name
-bool check_name(char *name)
-{
-  for (int i = 0; i < USERS; i++)
-  {
-    if (strcmp(name, user_lst[i].player_name) == 0 && user_lst[i].status == ALIVE)
+    // While every pending slot is taken, new connections wait in the backlog
+    int listening = count;
+    fds[listening] = (struct pollfd){.fd = count < MAX_PENDING ? server_socket_fd : -1, .events = POLLIN};
+    if (poll(fds, listening + 1, timeout) == -1 && errno != EINTR)
     {
-      return true;
+      perror("poll failed");
+      break;
     }
-  }
-  return false;
-} // check_name
-
-
-
-/*-------------------------Status Updates-------------------------*/
 
-
-
-/* Check game's current state to see if they match any of the ending criteria
-   Returns true if the game continues, false if otherwise. */
-bool check_game_status()
-{
-
-  int aliveCount = 0;
-  int werewolfCount = 0;
-
-  // Tally alive werewolves and villagers
-  for (int i = 0; i < USERS; i++)
-    if (user_lst[i].status == ALIVE)
+    // Settle every connection that has sent something or run out of time, keeping the rest in order
+    now = monotonic_ms();
+    int kept = 0;
+    for (int i = 0; i < count; i++)
     {
-      aliveCount++;
-      if (strcmp(user_lst[i].role, "werewolf") == 0)
-        werewolfCount++;
-    }
-
-  // If everyone is dead
-  if (werewolfCount == 0 && aliveCount == 0)
-  {
-    for (int i = 0; i < USERS; i++)
-      send_safe_message(user_lst[i], "No one wins! All are dead.");
-    return false;
-  }
-
-  // If all werewolves are dead
-  else if (werewolfCount == 0)
-  {
-    for (int i = 0; i < USERS; i++)
-      send_safe_message(user_lst[i], "Villagers win! All werewolves are dead.");
-    return false;
-  }
-
-  // If werewolves >= villagers
-  else if (werewolfCount >= (aliveCount + 1) / 2)
-  {
-    for (int i = 0; i < USERS; i++)
-      send_safe_message(user_lst[i], "Werewolves win! Werewolves are at least half of the remainings.");
-    return false;
-  }
-
-  // The game continues otherwise
-  return true;
-
-} // check_game_status
-
-
+      bool settled = false;
+      if (fds[i].revents != 0)
+        settled = pending_input(lobby, &pending[i]);
+      else if (now >= pending[i].since + RESUME_WAIT_MS)
+      {
+        seat_player(lobby, pending[i].fd, pending[i].reader);
+        settled = true;
+      }
 
-// Inform users of what happened last night, and whether there are any deaths
-void night_status_update(char *witch_k, char *werewolf_k, char *hunter_k)
-{
-  // Loop through all users
-  for (int i = 0; i < USERS; i++)
-  {
-    // Check and mark whether user is dead
-    if (strcmp(hunter_k, user_lst[i].player_name) == 0 || strcmp(witch_k, user_lst[i].player_name) == 0 || strcmp(werewolf_k, user_lst[i].player_name) == 0)
-    {
-      user_lst[i].status = DEAD;
+      if (settled)
+      {
+        msg_reader_destroy(pending[i].reader);
+        free(pending[i].reader);
+      }
+      else
+        pending[kept++] = pending[i];
     }
+    count = kept;
 
-    // If nobody dies
-    if ((strcmp(witch_k, "") == 0) && (strcmp(werewolf_k, "") == 0) && (strcmp(hunter_k, "") == 0)) {
-      send_safe_message(user_lst[i], "It has been a peaceful night, nobody dies.\n");
+    if (fds[listening].revents == 0)
       continue;
-    }
-
-    // If there are deaths, send users the deaths
-    send_safe_message(user_lst[i], "The following users died: \n");
-    if (strcmp(witch_k, "") != 0)
-    {
-      send_safe_message(user_lst[i], witch_k);
-      send_safe_message(user_lst[i], "\n");
-    }
-    if (strcmp(werewolf_k, "") != 0)
+    int client_socket_fd = server_socket_accept(server_socket_fd);
+    if (client_socket_fd == -1)
     {
-      send_safe_message(user_lst[i], werewolf_k);
-      send_safe_message(user_lst[i], "\n");
+      perror("accept failed");
+      continue;
     }
-    if (strcmp(hunter_k, "") != 0)
+    msg_reader_t *reader = malloc(sizeof(msg_reader_t));
+    if (reader == NULL || socket_set_nonblocking(client_socket_fd) != 0)
     {
-      send_safe_message(user_lst[i], hunter_k);
-      send_safe_message(user_lst[i], "\n");
+      free(reader);
+      seat_player(lobby, client_socket_fd, NULL);
+      continue;
     }
+    msg_reader_init(reader, client_socket_fd);
+    pending[count++] = (pending_t){.fd = client_socket_fd, .since = now, .reader = reader};
+  } // while loop
 
-  } //for loop
-
-} // night_status_update
-
-
+  // The window is over: whoever is still pending is a new player, and empty seats stay empty
+  for (int i = 0; i < count; i++)
+  {
+    seat_player(lobby, pending[i].fd, pending[i].reader);
+    msg_reader_destroy(pending[i].reader);
+    free(pending[i].reader);
+  }
+  while (lobby->restored != NULL)
+    resume_game(lobby, lobby->restored);
 
-/*-------------------------Role Functions-------------------------*/
+} // reattach_players
 
 
 
-/* Calls seer(), then prompt the werewolves to kill a non-werewolf player, give them 10s to discuss 
-   and one player will be called upon to make a decision
-   Notes: they cannot kill themselves */
-char *werewolf_night_func()
+// Read what a pending connection sent. Returns true once it is settled: back in its seat, seated as a new player or closed.
+bool pending_input(lobby_t *lobby, pending_t *pending)
 {
-  seer(); // seer is called
-  dump();
-
-  // Make werewolves able to communicate
-  active_roles = "werewolf";
-  // Find the two werewolves
-  int werewolves[MAX_WEREWOLF_COUNT];
-  werewolves[0] = -1;
-  werewolves[1] = -1;
-  int w = 0;
-  pthread_t thread[MAX_WEREWOLF_COUNT];
-
-  // Find the werewolves and send them a list of all the non-werewolves
-  for (int i = 0; i < USERS; i++)
-  {
-    if (strcmp(user_lst[i].role, "werewolf") == 0 && user_lst[i].status == ALIVE)
-    {
-      send_safe_message(user_lst[i], "You will be given 10 seconds to decide amongst yourselves who you would like to kill.\n Here are the users you may kill.\n");
-      werewolves[w] = i;
-      if (pthread_create(&thread[w], NULL, user_input, &user_lst[werewolves[w]]) != 0) // create the thread for user_input for the new connection
-      {
-        perror("failed to create thread.\n");
-        exit(1);
-      }
-      w++;
+  ssize_t rc = msg_reader_fill(pending->reader);
+  if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return false;
 
-      // Send them the alive players
-      for (int z = 0; z < USERS; z++)
-      {
-        if (strcmp(user_lst[z].role, "werewolf") != 0 && (user_lst[z].status == ALIVE))
-        {
-          send_safe_message(user_lst[i], user_lst[z].player_name);
-          send_safe_message(user_lst[i], "\n");
-        }
-      } // for loop for alive players
-    }    
-  } // for loop to prompt the killing
-
-
-  // Give 10 seconds for the werewolves to discuss
-  int wakeup_time = time_ms() + DISCUSSION_TIME_NIGHT;
-  char *message;
-  while ((int)time_ms() < wakeup_time)
-    ;
-  if (werewolves[0] != -1 && pthread_cancel(thread[0]) != 0) // create the thread for user_input for the new connection
-  {
-    perror("failed to cancel thread.\n");
-    exit(1);
-  }
-  if (werewolves[1] != -1 && pthread_cancel(thread[1]) != 0) // create the thread for user_input for the new connection
+  msg_view_t view;
+  int got = rc > 0 ? msg_reader_view(pending->reader, &view) : -1;
+  if (got < 0)
   {
-    perror("failed to cancel thread.\n");
-    exit(1);
+    close(pending->fd);
+    return true;
   }
+  if (got == 0)
+    return false;
 
-
-  // Make sure no one is able to send/receive messages
-  active_roles = "Everyone shut up";
-  int alive_werewolf = 0;
-  if (werewolves[alive_werewolf] == -1)
-    alive_werewolf++;
-  send_safe_message(user_lst[werewolves[alive_werewolf]], "Time is up. Choose one player to slaughter.\n");
-  if (alive_werewolf == 0)
-    send_safe_message(user_lst[werewolves[1]], "The other werewolf will choose someone to die\n");
-  else
-    send_safe_message(user_lst[werewolves[0]], "The other werewolf will choose someone to die\n");
-
-
-  // Find out who the werewolves wanna vote for and validate that input
-  message = receive_message(user_lst[werewolves[alive_werewolf]].socket);
-  while (!check_name(message) || strcmp(user_lst[werewolves[0]].player_name, message) == 0 || strcmp(user_lst[werewolves[1]].player_name, message) == 0)
+  // A player of a restored game sends the token of their seat before anything else
+  int id, seat;
+  uint64_t secret;
+  if (view.control == PROTO_RESUME && game_parse_token(view.text, &id, &seat, &secret))
   {
-    send_safe_message(user_lst[werewolves[alive_werewolf]], "You have entered an invalid input. Please try again: \n");
-    char *temp = message;
-    free(temp);
-    message = receive_message(user_lst[werewolves[alive_werewolf]].socket);
+    for (game_t *game = lobby->restored; game != NULL; game = game->next)
+    {
+      if (game->id != id || !game_rejoin(game, seat, secret, pending->fd, pending->reader))
+        continue;
+      printf("Player %d is back in game %d\n", seat + 1, id);
+      if (game_reclaimed(game))
+        resume_game(lobby, game);
+      return true;
+    }
   }
 
-  return message;
-} // were_wolf_night_func
+  // Anyone else, or a seat that is not to be had, gets a seat at a new table, and what they sent is read there
+  msg_reader_unread(pending->reader);
+  seat_player(lobby, pending->fd, pending->reader);
+  return true;
+} // pending_input
 
 
 
-/* Calls werewolf_night_func()then prompt the guard to save one person
-   If they save a dying person, an empty string will be returned
-   Else, return the person killed by the werewolves
-   Notes: the guard cannot save themself and does not know who was killed by the wolves */
-char *guard_night_func()
+// Hand a restored game over to a worker, which carries on from its checkpoint
+void resume_game(lobby_t *lobby, game_t *game)
 {
-  dump();
-  char *name = werewolf_night_func(); // Werewolves are called here
-
-  for (int i = 0; i < USERS; i++)
+  for (game_t **link = &lobby->restored; *link != NULL; link = &(*link)->next)
   {
-    // Find the guard
-    if (strcmp(user_lst[i].role, "guard") == 0 && user_lst[i].status == ALIVE)
+    if (*link == game)
     {
-      send_safe_message(user_lst[i], "Choose a player you would like to save:\n");
-      for (int z = 0; z < USERS; z++) // Send a list of alive players
-      {
-        if (i != z && (user_lst[z].status == ALIVE))
-        {
-          send_safe_message(user_lst[i], user_lst[z].player_name);
-          send_safe_message(user_lst[i], "\n");
-        }
-      }
-
-      // Receive a choice and validate it
-      char *message = receive_message(user_lst[i].socket);
-      while (!check_name(message) || strcmp(user_lst[i].player_name, message) == 0)
-      {
-        send_safe_message(user_lst[i], "You have entered an invalid input. Please try again.\n");
-        char *temp = message;
-        free(temp);
-        message = receive_message(user_lst[i].socket);
-      }
-
-      // If they save the player the werewolves killed, return an empty string
-      if (strcmp(name, message) == 0)
-      {
-        free(message);
-        free(name);
-        return "";
-      }
-      free(message);
+      *link = game->next;
+      break;
     }
-  } // for loop
-
-  // If they save someone who wasn't killed by werewolves, return the name of the player killed by werewolves
-  return name;
-} // guard_night_func
+  }
+  printf("Game %d is back, resuming it\n", game->id);
+  worker_pool_submit(lobby->pool, lobby->workers, game);
+} // resume_game
 
 
 
-/* Inform the witch of the dying person, if any, then ask whether they want to save
-   Returns appropriate dying player if they are not saved
-   Otherwise, return an empty string if they are saved
-   Notes: the witch can only save once */
-char *witch_night_func_save()
+// Called for every checkpoint found at startup: restore its game and hold it until its players are back
+void restore_game(void *lobby_info, int id, const char *data, size_t len)
 {
-  dump();
-
-  // Gets index of witch player
-  int index = 0;
-  for (; index < USERS; index++)
-    if (strcmp(user_lst[index].role, "witch") == 0)
-      break;
+  lobby_t *lobby = lobby_info;
 
-  // Sends witch information of potential death
-  char *dying = guard_night_func();
-  char message[50];
-  strcpy(message, dying);
-  if (!strlen(dying))
-    strcat(message, "No one");
-  strcat(message, " is dying.");
-  send_safe_message(user_lst[index], message);
-  send_safe_message(user_lst[index], "\n");
-
-  // If there is a potential death
-  if (strlen(dying))
+  // A checkpoint that cannot be restored is removed, so it is not tried again at the next restart
+  game_t *game = game_restore(id, data, len);
+  if (game == NULL)
   {
-    // If save potion is unavailable, they can't use it
-    if (!witch_save)
-      send_safe_message(user_lst[index], "You used your save potion.\n");
-    // If save potion is available, ask them if they want to save
-    else
-    {
-      send_safe_message(user_lst[index], "Do you want to save? (y/n)\n");
-      char *choice = receive_message(user_lst[index].socket);
-      if (choice != NULL)
-      {
-        // If they save, return an empty string
-        if (strcmp(choice, "y") == 0)
-        {
-          witch_save = false;
-          free(choice);
-          free(dying);
-          return "";
-        }
-        free(choice);
-      }
-    }
+    fprintf(stderr, "Checkpoint of game %d cannot be restored, removing it\n", id);
+    checkpoint_remove(lobby->checkpoints, id);
+    return;
   }
 
-  // If the witch does not save, return the dying player
-  return dying;
-} // witch_night_func_save
+  equip_game(lobby, game);
+  game->next = lobby->restored;
+  lobby->restored = game;
+  if (id >= lobby->next_id)
+    lobby->next_id = id + 1;
+  printf("Restored game %d, waiting for its players\n", id);
+} // restore_game
 
 
-/* Ask the witch whether they want to kill someone
-   If yes, return the player's name, else return an empty string
-   Notes: the witch can only kill once */
-char *witch_night_func_kill()
-{
-  dump();
-
-  // Gets index of witch player
-  int index = 0;
-  for (; index < USERS; index++)
-    if (strcmp(user_lst[index].role, "witch") == 0)
-      break;
 
-  // If kill potion is unavailable, they can't use it
-  if (!witch_kill)
-    send_safe_message(user_lst[index], "You used your kill potion.\n");
+// Give a new or restored game what the server keeps for every game: where it is checkpointed and watched from
+void equip_game(lobby_t *lobby, game_t *game)
+{
+  game->checkpoints = lobby->checkpoints;
 
-  // If kill potion is available
-  else
-  { // Ask whether they want to kill
-    send_safe_message(user_lst[index], "Do you want to kill? (y/n)\n");
-    char *choice = receive_message(user_lst[index].socket);
-    if (choice != NULL)
-    {
-      // If they kill, ask for a name and validae
-      if (strcmp(choice, "y") == 0)
-      {
-        send_safe_message(user_lst[index], "Who do you want to kill?\n");
-        char *dying;
-        while (true)
-        {
-          dying = receive_message(user_lst[index].socket);
-          if (!check_name(dying))
-          {
-            send_safe_message(user_lst[index], "Invalid username, please re-enter.)\n");
-            char *temp = dying;
-            free(temp);
-            continue;
-          }
-          else
-          {
-            int i = 0;
-            for (; i < USERS; i++)
-            {
-              if (strcmp(dying, user_lst[i].player_name) == 0)
-                break;
-            }
-            if (user_lst[i].status != ALIVE)
-            {
-              send_safe_message(user_lst[index], "User is no longer with us, please re-enter.\n");
-              char *temp2 = dying;
-              free(temp2);
-              continue;
-            }
-          }
-          break; 
-        } // while loop
-
-        // Return player killed by the witch
-        witch_kill = false;
-        free(choice);
-        return dying;
-      } // if kill
-
-      free(choice);
-
-    } // if (choice != NULL)
+  // A game without a feed is still played, only nobody can watch it
+  if (lobby->spectators != NULL)
+  {
+    game->feed = spectator_hub_feed(lobby->spectators, game->id);
+    if (game->feed == NULL)
+      perror("Failed to open spectator feed");
   }
-  // Return an empty string if no killing happened
-  return "";
-} // witch_night_func_kill
+} // equip_game
 
 
 
-// Prompt the seer to see one player's role
-void seer()
+/* Thread function that appends a snapshot of every worker's stats to a file at a fixed interval
+   Values are totals since the server started, so rates come from the difference of two snapshots.
+   Every line starts with the snapshot's number, then comes the total over all workers, each
+   worker's counters and one line per histogram of the total. */
+void *stats_writer_main(void *arg)
 {
-  // Mute other players
-  active_roles = "Shhhhhhhh";
+  stats_writer_t *writer = arg;
+  uint64_t start = monotonic_ms();
+  stats_t total, one;
 
-  // Find the seer
-  for (int i = 0; i < USERS; i++)
+  for (unsigned long long snapshot = 1;; snapshot++)
   {
-    if (strcmp(user_lst[i].role, "seer") == 0)
-    {
-      if (user_lst[i].status != ALIVE)
-        return;
-
-      // Ouput all the options, not themself
-      send_safe_message(user_lst[i], "Type the name of a player you would like to check the role of: \n");
-      for (int z = 0; z < USERS; z++)
-      {
-        if (strcmp(user_lst[i].player_name, user_lst[z].player_name) != 0 && user_lst[z].status == ALIVE)
-        {
-          send_safe_message(user_lst[i], user_lst[z].player_name);
-          send_safe_message(user_lst[i], "\n");
-        }
-      }
-
-      // Get input from the seer to see who's role they'd like to see.
-      // Validation check to see if they want to check themselves or someone who doesnt exist
-      char *mess = receive_message(user_lst[i].socket);
-      dump();
-      while (!check_name(mess) || strcmp(user_lst[i].player_name, mess) == 0)
-      {
-        send_safe_message(user_lst[i], "You have entered an invalid input, try again: ");
-        char *temp = mess;
-        free(temp);
-        mess = receive_message(user_lst[i].socket);
-      }
-
-      // Find the designated user chosen by the seer and send them their role.
-      for (int z = 0; z < USERS; z++)
-      {
-        if (strcmp(user_lst[z].player_name, mess) == 0)
-        {
-          send_safe_message(user_lst[i], user_lst[z].role);
-          send_safe_message(user_lst[i], "\n");
-        }
-      }
-      free(mess);
-    }
-  }
-  return;
-} // seer
-
+    sleep_ms(writer->interval_ms);
 
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "snapshot=%llu uptime_ms=%llu", snapshot, (unsigned long long)(monotonic_ms() - start));
 
-/* Prompt the hunter to pick one person to die with them if they are killed
-   If they are killed by either the witch or the werewolves, return the name of the player they pick 
-   Else, return an empty string */
-char *hunter_func(char *witch_s, char *witch_k)
-{
-  dump();
-
-  // Gets index of hunter player
-  int index = 0;
-  int i = 0;
-  char *dead_guy;
-  for (; index < USERS; index++)
-    if (strcmp(user_lst[index].role, "hunter") == 0)
+    // Per-worker counters first, summing them up on the way
+    stats_init(&total);
+    for (int i = 0; i < writer->workers; i++)
     {
-      if (user_lst[index].status != ALIVE)
-      {
-        return "";
-      }
-      break;
-    }
-
-  // Prompt the choice
-  send_safe_message(user_lst[index], "The night has arrived. You now have a chance to mark an unfortunate victim who will join you in Death if the chance ever arise!\n");
+      worker_stats(&writer->pool[i], &one);
+      stats_merge(&total, &one);
 
-  // Receive the choice and validate
-  while (true)
-  {
-    dead_guy = receive_message(user_lst[index].socket);
-    if (!check_name(dead_guy))
-    {
-      send_safe_message(user_lst[index], "Invalid username, please re-enter.\n");
-      char *temp = dead_guy;
-      free(temp);
-      continue;
+      char worker_prefix[96];
+      snprintf(worker_prefix, sizeof(worker_prefix), "%s worker=%d", prefix, i);
+      stats_write_counters(writer->out, worker_prefix, &one);
     }
-    else
-    {
-      for (; i < USERS; i++)
-      {
-        if (strcmp(dead_guy, user_lst[i].player_name) == 0)
-          break;
-      }
-      if (user_lst[i].status != ALIVE)
-      {
-        send_safe_message(user_lst[index], "User is no longer with us, please re-enter.\n");
-        char *temp2 = dead_guy;
-        free(temp2);
-        continue;
-      }
-    }
-    break;
-  } // while loop
 
-  // If hunter is killed during the night, return his choice
-  if (strcmp(witch_k, user_lst[index].player_name) == 0 || strcmp(witch_s, user_lst[index].player_name) == 0)
-  {
-    return dead_guy;
+    char total_prefix[96];
+    snprintf(total_prefix, sizeof(total_prefix), "%s worker=all", prefix);
+    stats_write_counters(writer->out, total_prefix, &total);
+    stats_write_hists(writer->out, total_prefix, &total);
+    if (writer->journal != NULL)
+      fprintf(writer->out, "%s journal_records=%llu journal_groups=%llu journal_dropped=%llu\n", prefix,
+              (unsigned long long)atomic_load(&writer->journal->written), (unsigned long long)atomic_load(&writer->journal->groups),
+              (unsigned long long)atomic_load(&writer->journal->dropped));
+    if (writer->checkpoints != NULL)
+      fprintf(writer->out, "%s checkpoints_written=%llu checkpoints_replaced=%llu checkpoints_failed=%llu\n", prefix,
+              (unsigned long long)atomic_load(&writer->checkpoints->written), (unsigned long long)atomic_load(&writer->checkpoints->replaced),
+              (unsigned long long)atomic_load(&writer->checkpoints->failed));
+    if (writer->spectators != NULL)
+      fprintf(writer->out, "%s spectators=%llu spectators_shed=%llu spectator_events_skipped=%llu\n", prefix,
+              (unsigned long long)atomic_load(&writer->spectators->watching), (unsigned long long)atomic_load(&writer->spectators->shed),
+              (unsigned long long)atomic_load(&writer->spectators->skipped));
+    fflush(writer->out);
   }
+  return NULL;
+} // stats_writer_main
 
-  // Else, return an empty string
-  free(dead_guy);
-  return "";
-}
-
-
-
-/*-------------------------Day Phase Function------------------------*/
 
+/*-----------------------------------------MAIN-----------------------------------------*/
 
 
-// Prompt all users to discuss then take turn to vote on one player to be killed
-void day_func()
+int main(int argc, char **argv)
 {
+  // By default run one worker thread per core
+  int workers = sysconf(_SC_NPROCESSORS_ONLN);
 
-  active_roles = "public";
-  pthread_t thread[USERS];
+  // Stats snapshots are only written if a file is given
+  char *stats_path = NULL;
+  int stats_interval = STATS_INTERVAL_MS;
 
-  // Prompt all user to discuss
-  for (int z = 0; z < USERS; z++)
-  {
-    send_safe_message(user_lst[z], "You will be given 20 seconds to discuss who you would like to vote out.\n");
-    if (pthread_create(&thread[z], NULL, user_input, &user_lst[z]) != 0) // create the thread for user_input for the new connection
-    {
-      perror("failed to create thread.\n");
-      exit(1);
-    }
-  } // for loop
+  // Games are only journaled if a file is given
+  char *journal_path = NULL;
 
-  int wakeup_time = time_ms() + DISCUSSION_TIME_DAY;
-  while ((int)time_ms() < wakeup_time)
-    ;
-  for (int i = 0; i < USERS; i++)
-  {
-    if (pthread_cancel(thread[i]) != 0)
-    {
-      perror("Failed to join thread.\n");
-      exit(1);
-    }
-  } // for loop
+  // Games are only checkpointed if a directory is given, and a restarted server needs its old port back
+  char *checkpoint_dir = NULL;
+  unsigned short port = 0;
 
-  // User takes turn to vote
-  active_roles = "shut up";
-  for (int z = 0; z < USERS; z++)
-  {
-    if (user_lst[z].status == ALIVE)
-    {
-      send_safe_message(user_lst[z], "Please enter a player's name:\n");
-      char *message = receive_message(user_lst[z].socket);
-      while (!check_name(message))
-      {
-        send_safe_message(user_lst[z], "Invalid input, enter a real player's name who is alive:\n");
-        char *temp = message;
-        free(temp);
-        message = receive_message(user_lst[z].socket);
-      }
-      for (int i = 0; i < USERS; i++)
-      {
-        if (strcmp(user_lst[i].player_name, message) == 0)
-        {
-          user_lst[i].votes_against++;
-        }
-      }
-      free(message);
-    }
-  } // for loop
+  // Spectators are only let in if a port is given for them
+  int spectator_port = -1;
+  int spectator_delay = SPECTATE_DELAY_MS;
 
-  // tally votes
-  bool tie = false;
-  users_t *to_die = &user_lst[0];
-  for (int z = 1; z < USERS; z++)
-  {
-    if (to_die->votes_against < user_lst[z].votes_against)
-    {
-      tie = false;
-      to_die = &user_lst[z];
-    }
-    else if (to_die->votes_against == user_lst[z].votes_against)
-    {
-      tie = true;
-    }
-  }
+  // Every table seats the same players and deals the same roles
+  int players = DEFAULT_USERS;
+  char *roles = NULL;
 
-  // If it's a tie, nobody dies
-  if (tie)
+  int opt;
+  while ((opt = getopt(argc, argv, "w:s:i:p:r:j:C:P:S:D:")) != -1)
   {
-    for (int i = 0; i < USERS; i++)
+    switch (opt)
     {
-      send_safe_message(user_lst[i], "There was a tie, no one will die.\n");
-    }
-  }
-  else // else kill off the player with the most votes_against
-  {
-    to_die->status = DEAD;
-    for (int i = 0; i < USERS; i++)
-    {
-      send_safe_message(user_lst[i], to_die->player_name);
-      send_safe_message(user_lst[i], " has been voted out. They were a: ");
-      send_safe_message(user_lst[i], to_die->role);
-      send_safe_message(user_lst[i], "\n");
+    case 'w':
+      workers = atoi(optarg);
+      break;
+    case 'p':
+      players = atoi(optarg);
+      break;
+    case 'r':
+      roles = optarg;
+      break;
+    case 's':
+      stats_path = optarg;
+      break;
+    case 'i':
+      stats_interval = atoi(optarg);
+      break;
+    case 'j':
+      journal_path = optarg;
+      break;
+    case 'C':
+      checkpoint_dir = optarg;
+      break;
+    case 'P':
+      port = atoi(optarg);
+      break;
+    case 'S':
+      spectator_port = atoi(optarg);
+      break;
+    case 'D':
+      spectator_delay = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Usage: %s [-w worker threads] [-s stats file] [-i stats interval ms] [-p players per table] [-r role=count,...] [-j journal file] [-C checkpoint dir] [-P port] [-S spectator port] [-D spectator delay ms]\n", argv[0]);
+      exit(EXIT_FAILURE);
     }
   }
+  if (workers < 1)
+    workers = 1;
+  if (stats_interval < 1)
+    stats_interval = STATS_INTERVAL_MS;
+  if (spectator_delay < 0)
+    spectator_delay = SPECTATE_DELAY_MS;
+
+  game_config_t config;
+  if (!game_config_parse(&config, players, roles))
+    exit(EXIT_FAILURE);
 
-  // Set votes_against back to 0
-  for (int i = 0; i < USERS; i++)
-  {
-    user_lst[i].votes_against = 0;
-  }
-} // day_func
-
-
-
-/*-----------------------------------------MAIN-----------------------------------------*/
-
+  // A player hanging up must not take every other game down with a SIGPIPE
+  signal(SIGPIPE, SIG_IGN);
 
-int main()
-{
   //  Set up a server socket to accept incoming connections
-  unsigned short port = 0;
   int server_socket_fd = server_socket_open(&port);
   if (server_socket_fd == -1)
   {
@@ -948,8 +484,8 @@ int main()
     exit(EXIT_FAILURE);
   }
 
-  // Listen for connections, with a maximum of 1 connection in queue
-  if (listen(server_socket_fd, 1)) 
+  // Listen for connections. A whole lobby may connect at once, so let the kernel queue as many as it allows.
+  if (listen(server_socket_fd, SOMAXCONN))
   {
     perror("listen failed");
     exit(EXIT_FAILURE);
@@ -957,45 +493,75 @@ int main()
 
   printf("SERVER PORT: %u\n", port);
 
-  // Thread is created to begin accepting new connections
-  accept_connections(server_socket_fd);
-  active_roles = "Shhhhh";
+  // Every input and event of every game is appended to the journal by a thread of its own, so no
+  // game ever waits on the disk
+  static journal_t journal;
+  if (journal_path != NULL && journal_open(&journal, journal_path) != 0)
+  {
+    perror("Failed to open journal");
+    exit(EXIT_FAILURE);
+  }
 
-  while (check_game_status()) // Game loop: While ending state is not reached, the game continues
+  // Each worker runs its own event loop for the games it is given
+  worker_t *pool = worker_pool_start(workers, journal_path != NULL ? &journal : NULL);
+  if (pool == NULL)
   {
-    // All roles function is called in order of seer, werewolves, guard, witch, and hunter
-    // Seer is called within werewolves
-    // Werewolves are called within guard
-    // Guard is called within witch_save
-    // Witch_kill calls itself
-    // Hunter calls itself
-    char *werewolf_k = witch_night_func_save(); 
-    char *witch_k = witch_night_func_kill();
-    char *hunter_k = hunter_func(werewolf_k, witch_k);
-    
-    night_status_update(witch_k, werewolf_k, hunter_k);
-
-    // Free memory malloc-ed by receive message
-    char *werewolf_temp = werewolf_k;
-    char *witch_temp = witch_k;
-    char *hunter_temp = hunter_k;
-    if (strcmp(werewolf_temp, "") != 0)
-      free(werewolf_temp);
-    if (strcmp(witch_temp, "") != 0)
-      free(witch_temp);
-    if (strcmp(hunter_temp, "") != 0)
-      free(hunter_temp);
-    
-    // If ending state is not reached, move on to day phase
-    if (check_game_status())
+    perror("Failed to start worker threads");
+    exit(EXIT_FAILURE);
+  }
+
+  // Spectators are served by a thread of their own from what the games publish, so however many
+  // watch, and however slowly they read, no game ever writes to one of them
+  static spectator_hub_t spectators;
+  lobby_t lobby = {.next_id = 1, .config = &config, .pool = pool, .workers = workers};
+  if (spectator_port != -1)
+  {
+    unsigned short watch_port = spectator_port;
+    int watch_socket_fd = server_socket_open(&watch_port);
+    if (watch_socket_fd == -1 || listen(watch_socket_fd, SOMAXCONN) || spectator_hub_start(&spectators, watch_socket_fd, spectator_delay) != 0)
     {
-      dump();
-      day_func();
-    } // Night phase follows if ending state is not reached
+      perror("Failed to start serving spectators");
+      exit(EXIT_FAILURE);
+    }
+    lobby.spectators = &spectators;
+    printf("SPECTATOR PORT: %u\n", watch_port);
+  }
 
-    else
+  // Every game in progress is saved at the start of each phase by a thread of its own. Games a
+  // server left behind when it stopped are restored and wait for their players to come back.
+  static checkpointer_t checkpoints;
+  if (checkpoint_dir != NULL)
+  {
+    lobby.checkpoints = &checkpoints;
+    if (checkpointer_start(&checkpoints, checkpoint_dir) != 0 || checkpoint_load_all(checkpoint_dir, restore_game, &lobby) == -1)
     {
-      break;
+      perror("Failed to open checkpoint directory");
+      exit(EXIT_FAILURE);
     }
   }
-}
\ No newline at end of file
+
+  // Snapshots are appended, so a restarted server adds to the same file
+  if (stats_path != NULL)
+  {
+    static stats_writer_t writer;
+    writer.out = fopen(stats_path, "a");
+    writer.interval_ms = stats_interval;
+    writer.pool = pool;
+    writer.workers = workers;
+    writer.journal = journal_path != NULL ? &journal : NULL;
+    writer.checkpoints = checkpoint_dir != NULL ? &checkpoints : NULL;
+    writer.spectators = lobby.spectators;
+
+    pthread_t stats_thread;
+    if (writer.out == NULL || pthread_create(&stats_thread, NULL, stats_writer_main, &writer) != 0)
+    {
+      perror("Failed to start writing stats");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  accept_connections(server_socket_fd, &lobby);
+
+  close(server_socket_fd);
+  return 0;
+}
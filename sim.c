@@ -0,0 +1,177 @@
+// Plays whole games against the rules engine, with no sockets or timers, to measure how fast the
+// rules run and to check that they still play out the same way. Every seat is a random agent:
+// they answer what they are asked in a random order, pick random valid targets and now and then
+// let the deadline pass. Prints one line of key=value pairs.
+//
+// Given the same options, every run makes the same decisions, so the checksum of all the events
+// only changes when the rules do.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "util.h"
+
+#define SIM_DEFAULT_GAMES 10000
+#define SIM_TIMEOUT_ONE_IN 16  // chance of an agent letting a deadline pass is one in this
+
+// A decision an agent owes
+typedef struct ask {
+  int player;
+  decision_t decision;
+} ask_t;
+
+// Everything one run adds up
+typedef struct sim_totals {
+  uint64_t games;
+  uint64_t outcomes[3];  // indexed by outcome_t
+  uint64_t days;
+  uint64_t events;
+  uint64_t checksum;
+} sim_totals_t;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Take every queued event: fold it into the checksum and note what the agents now owe.
+// Returns true if the day's discussion has started and the vote should be called.
+static bool sim_drain(engine_t* engine, ask_t* asks, int* ask_count, sim_totals_t* totals) {
+  bool day = false;
+  engine_event_t event;
+  while (engine_next_event(engine, &event)) {
+    uint64_t word = (uint64_t)event.kind << 48 ^ (uint64_t)(uint16_t)event.player << 32 ^
+                    (uint64_t)(uint16_t)event.target << 16 ^ (uint16_t)event.value;
+    totals->checksum = (totals->checksum ^ word) * 0x100000001b3;
+    totals->events++;
+
+    switch (event.kind) {
+      case EVENT_ASK:
+        asks[(*ask_count)++] = (ask_t){event.player, event.value};
+        break;
+      case EVENT_VOTE:
+        for (int i = bitset_next(&engine->voters, 0); i != -1; i = bitset_next(&engine->voters, i + 1))
+          asks[(*ask_count)++] = (ask_t){i, DECIDE_VOTE};
+        break;
+      case EVENT_DAY:
+        totals->days++;
+        day = true;
+        break;
+      case EVENT_GAME_OVER:
+        totals->outcomes[event.value]++;
+        break;
+      default:
+        break;
+    }
+  }
+  return day;
+}
+
+// Play one game to its end
+static void sim_game(const game_config_t* config, uint64_t seed, uint64_t* rng, ask_t* asks,
+                     sim_totals_t* totals) {
+  engine_t* engine = malloc(sizeof(engine_t));
+  if (engine == NULL) {
+    perror("Failed to allocate engine");
+    exit(EXIT_FAILURE);
+  }
+  engine_init(engine, config, seed);
+  engine_start(engine);
+
+  int ask_count = 0;
+  while (true) {
+    // The day's discussion needs no decisions, so the vote is called as soon as it starts
+    while (sim_drain(engine, asks, &ask_count, totals)) engine_start_vote(engine);
+    if (engine->over) break;
+
+    // Nothing owed while the game goes on would mean the rules are stuck
+    if (ask_count == 0) {
+      fprintf(stderr, "Game with seed %llu is stuck\n", (unsigned long long)seed);
+      exit(EXIT_FAILURE);
+    }
+
+    // Answer one of the owed decisions, chosen at random
+    int pick = rng_below(rng, ask_count);
+    ask_t ask = asks[pick];
+    asks[pick] = asks[--ask_count];
+    if (engine->owed[ask.player] != ask.decision) continue;
+
+    if (rng_below(rng, SIM_TIMEOUT_ONE_IN) == 0) {
+      engine_timeout(engine, ask.player);
+      continue;
+    }
+
+    // The witch passes half the time; everyone else picks a random valid target
+    bitset_t targets;
+    engine_targets(engine, ask.player, ask.decision, &targets);
+    int target = engine_random_player(engine, &targets);
+    bool witch = ask.decision == DECIDE_WITCH_SAVE || ask.decision == DECIDE_WITCH_KILL;
+    if (witch && rng_below(rng, 2) == 0) target = NO_PLAYER;
+    if (engine_act(engine, ask.player, ask.decision, target) != ENGINE_OK) engine_timeout(engine, ask.player);
+  }
+
+  totals->games++;
+  free(engine);
+}
+
+int main(int argc, char** argv) {
+  uint64_t games = SIM_DEFAULT_GAMES;
+  int players = DEFAULT_USERS;
+  char* roles = NULL;
+  uint64_t seed = 1;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "n:p:r:S:")) != -1) {
+    switch (opt) {
+      case 'n':
+        games = strtoull(optarg, NULL, 10);
+        break;
+      case 'p':
+        players = atoi(optarg);
+        break;
+      case 'r':
+        roles = optarg;
+        break;
+      case 'S':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-n games] [-p players] [-r role=count,...] [-S seed]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+
+  game_config_t config;
+  if (!game_config_parse(&config, players, roles)) exit(EXIT_FAILURE);
+
+  // A vote asks every seat at once, on top of at most a handful of night decisions
+  ask_t* asks = malloc((2 * MAX_USERS) * sizeof(ask_t));
+  if (asks == NULL) {
+    perror("Failed to allocate asks");
+    exit(EXIT_FAILURE);
+  }
+
+  sim_totals_t totals;
+  memset(&totals, 0, sizeof(totals));
+  uint64_t rng = seed ^ 0x9e3779b97f4a7c15;
+  uint64_t start = now_ns();
+  for (uint64_t g = 0; g < games; g++) sim_game(&config, seed + g, &rng, asks, &totals);
+  double elapsed = (now_ns() - start) / 1e9;
+
+  printf("sim players=%d games=%llu elapsed_s=%.3f games_per_sec=%.0f events=%llu nobody=%llu villagers=%llu "
+         "werewolves=%llu mean_days=%.2f checksum=%016llx\n",
+         players, (unsigned long long)totals.games, elapsed, elapsed > 0 ? totals.games / elapsed : 0.0,
+         (unsigned long long)totals.events, (unsigned long long)totals.outcomes[OUTCOME_NOBODY],
+         (unsigned long long)totals.outcomes[OUTCOME_VILLAGERS],
+         (unsigned long long)totals.outcomes[OUTCOME_WEREWOLVES],
+         totals.games ? (double)totals.days / totals.games : 0.0, (unsigned long long)totals.checksum);
+  free(asks);
+  return 0;
+}
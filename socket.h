@@ -2,6 +2,7 @@
 #define SOCKET_H
 
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
@@ -77,6 +78,13 @@ static int server_socket_open(unsigned short* port) {
       .sin_port = htons(*port)        // Use the specified port (may be zero)
   };
 
+  // A restarted server takes its port back while connections to the last one are still closing
+  int reuse = 1;
+  if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse))) {
+    close(fd);
+    return -1;
+  }
+
   // Bind the server socket to the address. Return if there is an error.
   if (bind(fd, (struct sockaddr*)&addr, sizeof(struct sockaddr_in))) {
     close(fd);
@@ -122,4 +130,21 @@ static int server_socket_accept(int server_socket_fd) {
   return client_socket_fd;
 }
 
+/**
+ * Make a socket non-blocking, so reads and writes return EAGAIN instead of waiting.
+ *
+ * \param socket_fd  The socket to change.
+ *
+ * \returns   0 on success. In case of failure, returns -1 with errno set by the
+ *            failed fcntl call.
+ */
+static int socket_set_nonblocking(int socket_fd) {
+  int flags = fcntl(socket_fd, F_GETFL, 0);
+  if (flags == -1) {
+    return -1;
+  }
+
+  return fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK);
+}
+
 #endif
@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include "spectator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "util.h"
+
+// Oldest event a feed still has
+static uint64_t feed_oldest(const feed_t* feed) {
+  return feed->head > SPECTATE_FEED_EVENTS ? feed->head - SPECTATE_FEED_EVENTS : 0;
+}
+
+// Free a feed and the events it still holds
+static void feed_free(feed_t* feed) {
+  for (int i = 0; i < SPECTATE_FEED_EVENTS; i++) {
+    if (feed->ring[i].frame != NULL) frame_unref(feed->ring[i].frame);
+  }
+  pthread_mutex_destroy(&feed->lock);
+  free(feed);
+}
+
+// The first feed of the hub, from which the rest can be walked without the lock: other
+// threads only ever add feeds in front of it
+static feed_t* hub_feeds(spectator_hub_t* hub) {
+  pthread_mutex_lock(&hub->lock);
+  feed_t* feeds = hub->feeds;
+  pthread_mutex_unlock(&hub->lock);
+  return feeds;
+}
+
+// Called when a write to a spectator fails
+static void spectator_failed(void* ctx) {
+  spectator_t* spectator = ctx;
+  spectator->gone = true;
+  spectator->hub->sweep = true;
+}
+
+// Called when a spectator's socket fills up or drains, to watch it for writability meanwhile
+static void spectator_blocked(void* ctx, bool blocked) {
+  spectator_t* spectator = ctx;
+  if (blocked) spectator->since = monotonic_ms();
+  reactor_watch_writable(&spectator->hub->reactor, &spectator->handle, blocked);
+}
+
+// Reactor callback for a full socket that has become writable: write out the rest of its output
+static void spectator_writable(void* ctx, int fd) {
+  spectator_t* spectator = ctx;
+  conn_flush(&spectator->conn);
+}
+
+// Put a spectator on the feed of the game they asked for, from the oldest event it still has
+static void spectator_watch(spectator_hub_t* hub, spectator_t* spectator, const char* request) {
+  char* end;
+  long game = strtol(request, &end, 10);
+  feed_t* feed = NULL;
+  for (feed_t* f = end != request ? hub_feeds(hub) : NULL; f != NULL; f = f->next) {
+    if (f->game == game) {
+      feed = f;
+      break;
+    }
+  }
+
+  bool closed = true;
+  uint64_t oldest = 0;
+  if (feed != NULL) {
+    pthread_mutex_lock(&feed->lock);
+    closed = feed->closed;
+    oldest = feed_oldest(feed);
+    pthread_mutex_unlock(&feed->lock);
+  }
+
+  msg_buf_t msg;
+  msg_init(&msg);
+  if (closed) {
+    msg_append(&msg, "There is no game %.20s to watch.\n", request);
+    conn_send(&spectator->conn, msg.text);
+    spectator->done = true;
+    hub->sweep = true;
+    return;
+  }
+
+  for (spectator_t** link = &hub->waiting; *link != NULL; link = &(*link)->next_spectator) {
+    if (*link == spectator) {
+      *link = spectator->next_spectator;
+      break;
+    }
+  }
+  spectator->feed = feed;
+  spectator->next = oldest;
+  spectator->next_spectator = feed->spectators;
+  feed->spectators = spectator;
+
+  msg_append(&msg, "You are watching game %d, %llu seconds behind its players.\n", feed->game,
+             (unsigned long long)(hub->delay_ms / 1000));
+  conn_send(&spectator->conn, msg.text);
+}
+
+// Reactor callback for a spectator's socket. Their first message says which game they watch.
+// Anything after it is read and ignored: spectators have no say in the game.
+static void spectator_input(void* ctx, int fd) {
+  spectator_t* spectator = ctx;
+  spectator_hub_t* hub = spectator->hub;
+  msg_reader_t* reader = &spectator->conn.reader;
+
+  ssize_t rc = msg_reader_fill(reader);
+  if (rc == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return;
+
+  msg_view_t view;
+  int got = 0;
+  if (rc > 0) {
+    hub->io.bytes_in += rc;
+    while ((got = msg_reader_view(reader, &view)) > 0) {
+      hub->io.frames_in++;
+      if (view.control == 0 && spectator->feed == NULL && !spectator->done) spectator_watch(hub, spectator, view.text);
+    }
+  }
+
+  // The socket stays readable until it is closed once idle
+  if (rc <= 0 || got < 0) {
+    spectator->gone = true;
+    hub->sweep = true;
+  }
+}
+
+// Reactor callback for the listening socket: take every spectator waiting to be accepted
+static void hub_accept(void* ctx, int fd) {
+  spectator_hub_t* hub = ctx;
+
+  while (true) {
+    int client_fd = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (client_fd == -1) {
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK) perror("Failed to accept spectator");
+      return;
+    }
+
+    spectator_t* spectator = calloc(1, sizeof(spectator_t));
+    if (spectator == NULL) {
+      close(client_fd);
+      continue;
+    }
+    conn_init(&spectator->conn, client_fd);
+    spectator->conn.on_error = spectator_failed;
+    spectator->conn.on_blocked = spectator_blocked;
+    spectator->conn.ctx = spectator;
+    spectator->conn.counters = &hub->io;
+    conn_attach(&spectator->conn, &hub->dirty);
+    spectator->handle.fd = client_fd;
+    spectator->handle.on_readable = spectator_input;
+    spectator->handle.on_writable = spectator_writable;
+    spectator->handle.ctx = spectator;
+    spectator->hub = hub;
+    spectator->since = monotonic_ms();
+    if (reactor_add(&hub->reactor, &spectator->handle) != 0) {
+      perror("Failed to watch spectator socket");
+      conn_destroy(&spectator->conn);
+      close(client_fd);
+      free(spectator);
+      continue;
+    }
+    spectator->next_spectator = hub->waiting;
+    hub->waiting = spectator;
+    atomic_fetch_add(&hub->watching, 1);
+  }
+}
+
+// Close a spectator and free them
+static void spectator_close(spectator_hub_t* hub, spectator_t* spectator) {
+  reactor_remove(&hub->reactor, &spectator->handle);
+  close(spectator->conn.fd);
+  conn_destroy(&spectator->conn);
+  free(spectator);
+  atomic_fetch_sub(&hub->watching, 1);
+}
+
+// Close the spectators of a list who are gone, or done and have had everything written
+static void hub_sweep_list(spectator_hub_t* hub, spectator_t** list) {
+  spectator_t** link = list;
+  while (*link != NULL) {
+    spectator_t* spectator = *link;
+    if (spectator->gone || spectator->conn.failed || (spectator->done && spectator->conn.out_count == 0)) {
+      *link = spectator->next_spectator;
+      spectator_close(hub, spectator);
+      continue;
+    }
+    if (spectator->done) hub->sweep = true;
+    link = &spectator->next_spectator;
+  }
+}
+
+// Write out what the last batch of events queued, then close whoever is to be closed
+static void hub_idle(void* ctx) {
+  spectator_hub_t* hub = ctx;
+
+  conn_flush_all(&hub->dirty);
+  if (!hub->sweep) return;
+  hub->sweep = false;
+  hub_sweep_list(hub, &hub->waiting);
+  for (feed_t* feed = hub_feeds(hub); feed != NULL; feed = feed->next) hub_sweep_list(hub, &feed->spectators);
+}
+
+/* Queue for every spectator of a feed the events that have become due. The due events are taken
+   out of the ring under its lock as references, and only queued once it is released, so the
+   game's thread waits for a copy of at most SPECTATE_FEED_EVENTS pointers, never for a spectator.
+   Returns whether the feed is finished: closed, with nobody left watching it. */
+static bool hub_serve(spectator_hub_t* hub, feed_t* feed, uint64_t now) {
+  if (feed->spectators == NULL) {
+    pthread_mutex_lock(&feed->lock);
+    feed->finished = feed->closed;
+    pthread_mutex_unlock(&feed->lock);
+    return feed->finished;
+  }
+
+  // Only what the furthest behind still needs is taken
+  uint64_t from = UINT64_MAX;
+  for (spectator_t* s = feed->spectators; s != NULL; s = s->next_spectator) {
+    if (s->next < from) from = s->next;
+  }
+
+  static frame_t* due[SPECTATE_FEED_EVENTS];
+  pthread_mutex_lock(&feed->lock);
+  if (from < feed_oldest(feed)) from = feed_oldest(feed);
+  uint64_t end = from;
+  while (end < feed->head && feed->ring[end % SPECTATE_FEED_EVENTS].at + hub->delay_ms <= now) {
+    due[end - from] = frame_ref(feed->ring[end % SPECTATE_FEED_EVENTS].frame);
+    end++;
+  }
+  bool over = feed->closed && end == feed->head;
+  pthread_mutex_unlock(&feed->lock);
+
+  for (spectator_t* s = feed->spectators; s != NULL; s = s->next_spectator) {
+    if (s->gone) continue;
+
+    // A socket that stays full would hold on to events for ever
+    if (s->conn.blocked) {
+      if (now - s->since >= SPECTATE_STALL_MS) {
+        s->gone = true;
+        hub->sweep = true;
+        atomic_fetch_add(&hub->shed, 1);
+      }
+      continue;
+    }
+    if (s->done) continue;
+
+    // Whoever fell out of the ring carries on from the oldest event it has
+    if (s->next < from) {
+      msg_buf_t msg;
+      msg_init(&msg);
+      msg_append(&msg, "You fell behind and missed %llu events.\n", (unsigned long long)(from - s->next));
+      conn_send(&s->conn, msg.text);
+      atomic_fetch_add(&hub->skipped, from - s->next);
+      s->next = from;
+    }
+    for (; s->next < end; s->next++) conn_send_frame(&s->conn, due[s->next - from]);
+
+    if (over) {
+      conn_send(&s->conn, "The game is over.\n");
+      s->done = true;
+      hub->sweep = true;
+    }
+  }
+
+  for (uint64_t i = from; i < end; i++) frame_unref(due[i - from]);
+  return false;
+}
+
+// Hand out the events that have become due, drop whoever has been quiet or stuck too long,
+// and free the feeds that are finished, then do it again later
+static void hub_tick(void* ctx) {
+  spectator_hub_t* hub = ctx;
+  uint64_t now = monotonic_ms();
+
+  // Even the answer to someone who asked for no game in particular is written by then
+  for (spectator_t* s = hub->waiting; s != NULL; s = s->next_spectator) {
+    if (now - s->since >= SPECTATE_HELLO_MS) {
+      s->gone = true;
+      hub->sweep = true;
+    }
+  }
+
+  bool finished = false;
+  for (feed_t* feed = hub_feeds(hub); feed != NULL; feed = feed->next) finished |= hub_serve(hub, feed, now);
+
+  // Only this thread adds spectators, so a feed that is finished stays finished while it is unlinked
+  if (finished) {
+    pthread_mutex_lock(&hub->lock);
+    feed_t** link = &hub->feeds;
+    while (*link != NULL) {
+      feed_t* feed = *link;
+      if (feed->finished) {
+        *link = feed->next;
+        feed_free(feed);
+      } else {
+        link = &feed->next;
+      }
+    }
+    pthread_mutex_unlock(&hub->lock);
+  }
+
+  reactor_add_timer(&hub->reactor, &hub->tick, SPECTATE_TICK_MS, hub_tick, hub);
+}
+
+// Thread function for the hub: run its reactor forever
+static void* hub_main(void* arg) {
+  spectator_hub_t* hub = arg;
+  reactor_add_timer(&hub->reactor, &hub->tick, SPECTATE_TICK_MS, hub_tick, hub);
+  reactor_run(&hub->reactor);
+  return NULL;
+}
+
+// Start serving the spectators that connect to listen_fd
+int spectator_hub_start(spectator_hub_t* hub, int listen_fd, uint64_t delay_ms) {
+  memset(hub, 0, sizeof(spectator_hub_t));
+  hub->delay_ms = delay_ms;
+  atomic_init(&hub->watching, 0);
+  atomic_init(&hub->shed, 0);
+  atomic_init(&hub->skipped, 0);
+  pthread_mutex_init(&hub->lock, NULL);
+  wheel_timer_init(&hub->tick);
+
+  if (reactor_init(&hub->reactor) != 0) return -1;
+  hub->reactor.on_idle = hub_idle;
+  hub->reactor.idle_ctx = hub;
+
+  int flags = fcntl(listen_fd, F_GETFL);
+  if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) return -1;
+  hub->listen_handle.fd = listen_fd;
+  hub->listen_handle.on_readable = hub_accept;
+  hub->listen_handle.on_writable = NULL;
+  hub->listen_handle.ctx = hub;
+  if (reactor_add(&hub->reactor, &hub->listen_handle) != 0) return -1;
+
+  if (pthread_create(&hub->thread, NULL, hub_main, hub) != 0) return -1;
+  return 0;
+}
+
+// Open the feed of a game
+feed_t* spectator_hub_feed(spectator_hub_t* hub, int game) {
+  feed_t* feed = calloc(1, sizeof(feed_t));
+  if (feed == NULL) return NULL;
+  feed->game = game;
+  pthread_mutex_init(&feed->lock, NULL);
+
+  pthread_mutex_lock(&hub->lock);
+  feed->next = hub->feeds;
+  hub->feeds = feed;
+  pthread_mutex_unlock(&hub->lock);
+  return feed;
+}
+
+// Add an event to a feed, pushing the oldest one out of a full ring
+void feed_publish(feed_t* feed, const char* text, size_t len) {
+  frame_t* frame = frame_create_len(text, len);
+  if (frame == NULL) return;
+  uint64_t at = monotonic_ms();
+
+  pthread_mutex_lock(&feed->lock);
+  feed_entry_t* entry = &feed->ring[feed->head % SPECTATE_FEED_EVENTS];
+  frame_t* evicted = entry->frame;
+  entry->frame = frame;
+  entry->at = at;
+  feed->head++;
+  pthread_mutex_unlock(&feed->lock);
+
+  if (evicted != NULL) frame_unref(evicted);
+}
+
+// Mark a feed as finished once its game has ended
+void feed_close(feed_t* feed) {
+  pthread_mutex_lock(&feed->lock);
+  feed->closed = true;
+  pthread_mutex_unlock(&feed->lock);
+}
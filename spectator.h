@@ -0,0 +1,89 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "conn.h"
+#include "frame.h"
+#include "reactor.h"
+
+#define SPECTATE_FEED_EVENTS 1024 // Events a feed keeps, which must cover the delay. A spectator further behind skips ahead.
+#define SPECTATE_DELAY_MS 10000   // Default time between the players and the spectators seeing an event
+#define SPECTATE_TICK_MS 100      // How often the events that have become due are handed out
+#define SPECTATE_STALL_MS 5000    // How long a spectator's socket may stay full before they are dropped
+#define SPECTATE_HELLO_MS 5000    // How long a new spectator has to say which game they watch
+
+struct spectator;
+
+// An event of a feed: the text spectators get, encoded once, and when it happened
+typedef struct feed_entry {
+  frame_t* frame;
+  uint64_t at;
+} feed_entry_t;
+
+// The public events of one game, for its spectators. The game's thread publishes into a ring
+// of shared frames and never waits for a spectator: publishing costs the same whether a
+// thousand are watching or none. The hub's thread reads the ring at its own pace.
+typedef struct feed {
+  int game;
+  pthread_mutex_t lock;  // protects the ring, head and closed
+  feed_entry_t ring[SPECTATE_FEED_EVENTS];
+  uint64_t head;  // events published so far. Event n is in ring[n % SPECTATE_FEED_EVENTS].
+  bool closed;    // the game has ended and publishes nothing more
+
+  struct spectator* spectators;  // watching this game, only touched by the hub's thread
+  bool finished;                 // closed with nobody left watching, for the hub to free
+  struct feed* next;             // link in the hub's list of feeds
+} feed_t;
+
+// A read-only connection watching one game
+typedef struct spectator {
+  conn_t conn;
+  reactor_handle_t handle;
+  struct spectator_hub* hub;
+  feed_t* feed;    // NULL until they have said which game
+  uint64_t next;   // event of the feed they get next
+  uint64_t since;  // when they connected, then when their socket last filled up
+  bool gone;       // to be closed: the connection failed, hung up or fell too far behind
+  bool done;       // has everything there is to get, closed once it is written
+  struct spectator* next_spectator;
+} spectator_t;
+
+// A thread serving every spectator from its own reactor, so however many are watching and
+// however slowly they read, the games' threads never write to one of them
+typedef struct spectator_hub {
+  pthread_t thread;
+  reactor_t reactor;
+  reactor_handle_t listen_handle;
+  uint64_t delay_ms;
+
+  pthread_mutex_t lock;      // protects the list of feeds, which other threads add to
+  feed_t* feeds;
+  spectator_t* waiting;      // connected, but not said which game yet
+  conn_t* dirty;             // spectators with output to flush
+  bool sweep;                // some spectators are to be closed
+  wheel_timer_t tick;
+  io_counters_t io;
+
+  atomic_uint_fast64_t watching;  // spectators connected
+  atomic_uint_fast64_t shed;      // spectators dropped because their socket stayed full
+  atomic_uint_fast64_t skipped;   // events spectators missed because they fell too far behind
+} spectator_hub_t;
+
+// Start serving the spectators that connect to listen_fd, which must be listening, each event
+// delay_ms after it happened. Returns -1 if an error occurs.
+int spectator_hub_start(spectator_hub_t* hub, int listen_fd, uint64_t delay_ms);
+
+// Open the feed of a game, for spectators to watch once it has started. Safe to call from any
+// thread. Returns NULL if allocation fails.
+feed_t* spectator_hub_feed(spectator_hub_t* hub, int game);
+
+// Add the first len bytes of text to a feed as one event. Only the game's thread may publish.
+// Nothing is written to any spectator here.
+void feed_publish(feed_t* feed, const char* text, size_t len);
+
+// Mark a feed as finished once its game has ended. The game must not touch it afterwards: the
+// hub frees it once its spectators have got everything.
+void feed_close(feed_t* feed);
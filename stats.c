@@ -0,0 +1,117 @@
+#include "stats.h"
+
+#include <string.h>
+
+// Names of the histograms in snapshots
+static const char* const hist_names[STAT_HIST_COUNT] = {
+    "seer", "werewolf_discussion", "werewolf_choice", "guard", "witch",
+    "hunter", "night", "discussion", "vote", "response",
+};
+
+// Bucket of a value. Below HIST_SUB_BUCKETS every value has its own bucket; above, each power of
+// two is split into HIST_SUB_BUCKETS by the bits after the leading one.
+static int hist_index(uint64_t value) {
+  if (value > HIST_MAX) value = HIST_MAX;
+  if (value < HIST_SUB_BUCKETS) return value;
+  int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+  return (shift + 1) * HIST_SUB_BUCKETS + (int)((value >> shift) - HIST_SUB_BUCKETS);
+}
+
+// Largest value that lands in a bucket
+static uint64_t hist_bucket_top(int index) {
+  if (index < HIST_SUB_BUCKETS) return index;
+  int shift = index / HIST_SUB_BUCKETS - 1;
+  uint64_t sub = index % HIST_SUB_BUCKETS;
+  return ((HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+// Empty a histogram
+void hist_init(hist_t* h) {
+  memset(h, 0, sizeof(hist_t));
+}
+
+// Count one value
+void hist_record(hist_t* h, uint64_t value) {
+  h->buckets[hist_index(value)]++;
+  h->count++;
+  h->sum += value;
+  if (value > h->max) h->max = value;
+}
+
+// Add every value counted in src to dst
+void hist_merge(hist_t* dst, const hist_t* src) {
+  for (int i = 0; i < HIST_BUCKETS; i++) dst->buckets[i] += src->buckets[i];
+  dst->count += src->count;
+  dst->sum += src->sum;
+  if (src->max > dst->max) dst->max = src->max;
+}
+
+// Smallest value at least a fraction p of the recorded values are no greater than
+uint64_t hist_percentile(const hist_t* h, double p) {
+  if (h->count == 0) return 0;
+
+  // The rank of the value we are after, counting from 1
+  uint64_t rank = (uint64_t)(p * h->count + 0.5);
+  if (rank < 1) rank = 1;
+  if (rank > h->count) rank = h->count;
+
+  uint64_t seen = 0;
+  for (int i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= rank) {
+      // A bucket's top can overshoot the largest value actually recorded
+      uint64_t top = hist_bucket_top(i);
+      return top < h->max ? top : h->max;
+    }
+  }
+  return h->max;
+}
+
+// Empty a set of stats
+void stats_init(stats_t* s) {
+  memset(s, 0, sizeof(stats_t));
+}
+
+// Add everything recorded in src to dst
+void stats_merge(stats_t* dst, const stats_t* src) {
+  for (int i = 0; i < STAT_HIST_COUNT; i++) hist_merge(&dst->hist[i], &src->hist[i]);
+  dst->io.frames_in += src->io.frames_in;
+  dst->io.bytes_in += src->io.bytes_in;
+  dst->io.frames_out += src->io.frames_out;
+  dst->io.bytes_out += src->io.bytes_out;
+  dst->io.writes += src->io.writes;
+  dst->io.overflows += src->io.overflows;
+  dst->games_started += src->games_started;
+  dst->games_ended += src->games_ended;
+  dst->disconnects += src->disconnects;
+  dst->leave_notices += src->leave_notices;
+  dst->invalid_retries += src->invalid_retries;
+  dst->prompt_timeouts += src->prompt_timeouts;
+}
+
+// Write the counters of s as one line of key=value pairs
+void stats_write_counters(FILE* out, const char* prefix, const stats_t* s) {
+  fprintf(out,
+          "%s games_started=%llu games_ended=%llu frames_in=%llu bytes_in=%llu frames_out=%llu "
+          "bytes_out=%llu writes=%llu overflows=%llu disconnects=%llu leave_notices=%llu "
+          "invalid_retries=%llu prompt_timeouts=%llu\n",
+          prefix, (unsigned long long)s->games_started, (unsigned long long)s->games_ended,
+          (unsigned long long)s->io.frames_in, (unsigned long long)s->io.bytes_in,
+          (unsigned long long)s->io.frames_out, (unsigned long long)s->io.bytes_out,
+          (unsigned long long)s->io.writes, (unsigned long long)s->io.overflows,
+          (unsigned long long)s->disconnects,
+          (unsigned long long)s->leave_notices, (unsigned long long)s->invalid_retries,
+          (unsigned long long)s->prompt_timeouts);
+}
+
+// Write one key=value line per histogram of s
+void stats_write_hists(FILE* out, const char* prefix, const stats_t* s) {
+  for (int i = 0; i < STAT_HIST_COUNT; i++) {
+    const hist_t* h = &s->hist[i];
+    fprintf(out, "%s hist=%s count=%llu mean_ms=%.1f p50_ms=%llu p90_ms=%llu p99_ms=%llu p999_ms=%llu max_ms=%llu\n",
+            prefix, hist_names[i], (unsigned long long)h->count, h->count ? (double)h->sum / h->count : 0.0,
+            (unsigned long long)hist_percentile(h, 0.5), (unsigned long long)hist_percentile(h, 0.9),
+            (unsigned long long)hist_percentile(h, 0.99), (unsigned long long)hist_percentile(h, 0.999),
+            (unsigned long long)h->max);
+  }
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "conn.h"
+
+// Histograms keep 16 linear buckets per power of two, so every recorded value is within about 6%
+// of the bucket it lands in, from 0 up to HIST_MAX. Larger values are counted as HIST_MAX.
+#define HIST_SUB_BITS 4
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 32
+#define HIST_MAX ((UINT64_C(1) << HIST_MAX_BITS) - 1)
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+// A distribution of values, in milliseconds wherever the server records one
+typedef struct hist {
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint32_t buckets[HIST_BUCKETS];
+} hist_t;
+
+// What the server times, each in its own histogram
+typedef enum stat_hist {
+  STAT_SEER,                  // night start until the seer is done
+  STAT_WEREWOLF_DISCUSSION,   // night start until the werewolves are asked for a victim
+  STAT_WEREWOLF_CHOICE,       // that question until the victim is chosen
+  STAT_GUARD,                 // night start until the guard is done
+  STAT_WITCH,                 // night start until the witch is done
+  STAT_HUNTER,                // night start until the hunter is done
+  STAT_NIGHT,                 // the whole night, until it is resolved
+  STAT_DISCUSSION,            // the day's discussion
+  STAT_VOTE,                  // the day's vote, until it is tallied
+  STAT_RESPONSE,              // a prompt until the player's accepted answer
+  STAT_HIST_COUNT
+} stat_hist_t;
+
+// Everything one worker records. Only the worker's thread writes to it.
+typedef struct stats {
+  hist_t hist[STAT_HIST_COUNT];
+  io_counters_t io;
+  uint64_t games_started;
+  uint64_t games_ended;
+  uint64_t disconnects;      // players whose connection failed or closed mid-game
+  uint64_t leave_notices;    // notices announcing them, one per game per tick however many left
+  uint64_t invalid_retries;  // prompts asked again after an invalid answer
+  uint64_t prompt_timeouts;  // prompts that got their default because nobody answered
+} stats_t;
+
+// Empty a histogram
+void hist_init(hist_t* h);
+
+// Count one value
+void hist_record(hist_t* h, uint64_t value);
+
+// Add every value counted in src to dst
+void hist_merge(hist_t* dst, const hist_t* src);
+
+// Smallest value at least a fraction p of the recorded values are no greater than, give or take
+// the bucket width. 0 if nothing has been recorded.
+uint64_t hist_percentile(const hist_t* h, double p);
+
+// Empty a set of stats
+void stats_init(stats_t* s);
+
+// Add everything recorded in src to dst
+void stats_merge(stats_t* dst, const stats_t* src);
+
+// Write the counters of s as one line of key=value pairs, starting with prefix
+void stats_write_counters(FILE* out, const char* prefix, const stats_t* s);
+
+// Write one key=value line per histogram of s, each starting with prefix
+void stats_write_hists(FILE* out, const char* prefix, const stats_t* s);
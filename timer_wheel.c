@@ -0,0 +1,179 @@
+#include "timer_wheel.h"
+
+#include <stddef.h>
+
+#define ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+
+// Number of ticks covered by one slot of a level
+#define LEVEL_SHIFT(level) (WHEEL_ROOT_BITS + (level)*WHEEL_LEVEL_BITS)
+
+// Slot of a level that tick falls into
+#define LEVEL_INDEX(tick, level) (((tick) >> LEVEL_SHIFT(level)) & LEVEL_MASK)
+
+static void slot_init(wheel_slot_t* slot) {
+  slot->head.next = &slot->head;
+  slot->head.prev = &slot->head;
+}
+
+static bool slot_empty(wheel_slot_t* slot) {
+  return slot->head.next == &slot->head;
+}
+
+static void slot_push(wheel_slot_t* slot, wheel_timer_t* t) {
+  t->prev = slot->head.prev;
+  t->next = &slot->head;
+  slot->head.prev->next = t;
+  slot->head.prev = t;
+}
+
+static void unlink_timer(wheel_timer_t* t) {
+  t->prev->next = t->next;
+  t->next->prev = t->prev;
+  t->next = NULL;
+  t->prev = NULL;
+}
+
+// Put a timer in the slot matching its distance from the wheel's clock
+static void place(timer_wheel_t* w, wheel_timer_t* t) {
+  uint64_t expires = t->expires;
+
+  // Overdue timers go in the slot that is processed next
+  if (expires < w->next_tick) expires = w->next_tick;
+
+  uint64_t delta = expires - w->next_tick;
+  if (delta < WHEEL_ROOT_SIZE) {
+    slot_push(&w->root[expires & ROOT_MASK], t);
+    return;
+  }
+
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    if (delta < (1ULL << (LEVEL_SHIFT(level) + WHEEL_LEVEL_BITS)) || level == WHEEL_LEVELS - 1) {
+      slot_push(&w->levels[level][LEVEL_INDEX(expires, level)], t);
+      return;
+    }
+  }
+}
+
+// Move every timer in one slot of a level down to where it now belongs. Returns the index
+// so the caller knows whether the level above needs to cascade too.
+static int cascade(timer_wheel_t* w, int level) {
+  int index = LEVEL_INDEX(w->next_tick, level);
+  wheel_slot_t* slot = &w->levels[level][index];
+
+  wheel_timer_t* t = slot->head.next;
+  slot_init(slot);
+  while (t != &slot->head) {
+    wheel_timer_t* next = t->next;
+    place(w, t);
+    t = next;
+  }
+  return index;
+}
+
+// Set up an empty wheel whose clock starts at now
+void timer_wheel_init(timer_wheel_t* w, uint64_t now) {
+  w->next_tick = now;
+  w->pending = 0;
+  for (int i = 0; i < WHEEL_ROOT_SIZE; i++) slot_init(&w->root[i]);
+  for (int level = 0; level < WHEEL_LEVELS; level++)
+    for (int i = 0; i < WHEEL_LEVEL_SIZE; i++) slot_init(&w->levels[level][i]);
+}
+
+// Prepare a timer so that it can be scheduled and cancelled
+void wheel_timer_init(wheel_timer_t* t) {
+  t->next = NULL;
+  t->prev = NULL;
+}
+
+// Whether a timer is currently scheduled
+bool wheel_timer_pending(wheel_timer_t* t) {
+  return t->next != NULL;
+}
+
+// Schedule fn(ctx) to run delay ticks from now
+void timer_wheel_add(timer_wheel_t* w, wheel_timer_t* t, uint64_t now, uint64_t delay,
+                     void (*fn)(void* ctx), void* ctx) {
+  timer_wheel_cancel(w, t);
+
+  // An empty wheel has nothing to fire, so its clock can jump straight to now
+  if (w->pending == 0 && w->next_tick < now) w->next_tick = now;
+
+  // The wheel may lag behind now until its next advance. The delay still runs from now, but
+  // no timer is placed further from the wheel's clock than it can hold.
+  if (delay > WHEEL_MAX_DELAY) delay = WHEEL_MAX_DELAY;
+  t->expires = now + delay;
+  if (t->expires > w->next_tick + WHEEL_MAX_DELAY) t->expires = w->next_tick + WHEEL_MAX_DELAY;
+  t->fn = fn;
+  t->ctx = ctx;
+  place(w, t);
+  w->pending++;
+}
+
+// Cancel a timer
+void timer_wheel_cancel(timer_wheel_t* w, wheel_timer_t* t) {
+  if (!wheel_timer_pending(t)) return;
+  unlink_timer(t);
+  w->pending--;
+}
+
+// Fire every timer that expires at or before now
+void timer_wheel_advance(timer_wheel_t* w, uint64_t now) {
+  while (w->next_tick <= now) {
+    // Nothing is scheduled, so there is nothing to step through
+    if (w->pending == 0) {
+      w->next_tick = now + 1;
+      return;
+    }
+
+    int index = w->next_tick & ROOT_MASK;
+
+    // When the root level wraps, refill it from the level above, and so on up
+    if (index == 0) {
+      for (int level = 0; level < WHEEL_LEVELS; level++) {
+        if (cascade(w, level) != 0) break;
+      }
+    }
+
+    w->next_tick++;
+
+    // Fire the slot's timers. Each one is unlinked first so the callback may reschedule it.
+    wheel_slot_t* slot = &w->root[index];
+    while (!slot_empty(slot)) {
+      wheel_timer_t* t = slot->head.next;
+      unlink_timer(t);
+      w->pending--;
+      t->fn(t->ctx);
+    }
+  }
+}
+
+// Tick at which the wheel next needs to be advanced
+uint64_t timer_wheel_next(timer_wheel_t* w) {
+  if (w->pending == 0) return UINT64_MAX;
+
+  uint64_t best = UINT64_MAX;
+
+  // Root slots hold timers due within the next WHEEL_ROOT_SIZE ticks
+  for (uint64_t k = 0; k < WHEEL_ROOT_SIZE; k++) {
+    uint64_t tick = w->next_tick + k;
+    if (!slot_empty(&w->root[tick & ROOT_MASK])) {
+      best = tick;
+      break;
+    }
+  }
+
+  // Higher levels matter at the boundary where their slot cascades
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    uint64_t span = 1ULL << LEVEL_SHIFT(level);
+    uint64_t boundary = (w->next_tick + span - 1) & ~(span - 1);
+    for (int k = 0; k < WHEEL_LEVEL_SIZE && boundary < best; k++, boundary += span) {
+      if (!slot_empty(&w->levels[level][LEVEL_INDEX(boundary, level)])) {
+        best = boundary;
+        break;
+      }
+    }
+  }
+
+  return best;
+}
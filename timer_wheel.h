@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// The wheel has one 256-slot level of 1 ms ticks and three 64-slot levels above it, so a timer
+// can be scheduled up to 2^26 ms (about 18 hours) ahead. Longer delays are clamped.
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVELS 3
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_MAX_DELAY ((1ULL << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS)) - 1)
+
+// A timer. Owned by the caller, who must keep it alive while it is scheduled.
+typedef struct wheel_timer {
+  struct wheel_timer* next;
+  struct wheel_timer* prev;
+  uint64_t expires;  // tick at which the timer fires
+  void (*fn)(void* ctx);
+  void* ctx;
+} wheel_timer_t;
+
+// A slot is a circular doubly-linked list with a sentinel head
+typedef struct wheel_slot {
+  wheel_timer_t head;
+} wheel_slot_t;
+
+// Hierarchical timing wheel. Ticks are milliseconds on the monotonic clock.
+typedef struct timer_wheel {
+  uint64_t next_tick;  // first tick that has not been processed yet
+  uint64_t pending;    // number of scheduled timers
+  wheel_slot_t root[WHEEL_ROOT_SIZE];
+  wheel_slot_t levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+} timer_wheel_t;
+
+// Set up an empty wheel whose clock starts at now
+void timer_wheel_init(timer_wheel_t* w, uint64_t now);
+
+// Prepare a timer so that it can be scheduled and cancelled
+void wheel_timer_init(wheel_timer_t* t);
+
+// Schedule fn(ctx) to run delay ticks from now. Reschedules the timer if it was pending.
+// Never fires anything: timers only run from timer_wheel_advance, even when now is ahead of it.
+void timer_wheel_add(timer_wheel_t* w, wheel_timer_t* t, uint64_t now, uint64_t delay,
+                     void (*fn)(void* ctx), void* ctx);
+
+// Cancel a timer. Does nothing if it is not scheduled.
+void timer_wheel_cancel(timer_wheel_t* w, wheel_timer_t* t);
+
+// Whether a timer is currently scheduled
+bool wheel_timer_pending(wheel_timer_t* t);
+
+// Fire every timer that expires at or before now
+void timer_wheel_advance(timer_wheel_t* w, uint64_t now);
+
+// Tick at which the wheel next needs to be advanced, or UINT64_MAX if no timers are scheduled.
+// This is either the expiry of the earliest timer or a cascade that brings it closer.
+uint64_t timer_wheel_next(timer_wheel_t* w);
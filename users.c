@@ -1,70 +1,290 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdbool.h>
-#include <pthread.h>
+#include "bot.h"
 #include "message.h"
 #include "socket.h"
+#include "util.h"
 
 #define MAX_NAME_LEN 20
+#define OUTPUT_BUFFER 65536 // Bytes of server output gathered before it is written to the terminal
+#define REATTACH_INTERVAL_MS 100 // Time between attempts to reconnect to a server that went away mid-game
+#define REATTACH_TIMEOUT_MS 30000 // How long a restarting server has to come back before we give up
+#define REATTACH_ANSWER_MS 1000 // How long a server we reconnected to has to answer
 
 char *username;
 
-void *send_message_func(void *port)
+// Framing of the messages we send
+int send_version = FRAMING_V1;
+
+// Token of our seat, which takes it back if the server restarts. Empty once the game is over.
+char seat_token[PROTO_TOKEN_MAX];
+
+// The line being typed. A line too long for one message is sent in pieces.
+typedef struct line_buffer
+{
+  char text[MAX_MESSAGE_LENGTH];
+  size_t len;
+  bool closed; // the end of input has been reached
+} line_buffer_t;
+
+// Send one line to the server in the framing it expects. Returns non-zero if an error occurs.
+int send_line(int socket_fd, char *line)
 {
+  if (send_version == FRAMING_V2)
+    return send_message_v2(socket_fd, line);
+  return send_message(socket_fd, line);
+}
+
+/* Read what has been typed and send every complete line, without its newline
+   Returns 1 while there is more to read, 0 at the end of input and -1 if an error occurs */
+int read_input(int socket_fd, line_buffer_t *input)
+{
+  ssize_t rc = read(STDIN_FILENO, input->text + input->len, sizeof(input->text) - 1 - input->len);
+  if (rc == -1)
+    return errno == EINTR ? 1 : -1;
+
+  // Whatever was typed last still goes out at the end of input
+  if (rc == 0)
+  {
+    input->text[input->len] = '\0';
+    int sent = input->len == 0 ? 0 : send_line(socket_fd, input->text);
+    input->len = 0;
+    return sent == 0 ? 0 : -1;
+  }
+
+  // Send each line that is complete, then keep the start of the next one
+  char *start = input->text;
+  char *end = input->text + input->len + rc;
+  for (char *newline; (newline = memchr(start, '\n', end - start)) != NULL; start = newline + 1)
+  {
+    *newline = '\0';
+    if (send_line(socket_fd, start) != 0)
+      return -1;
+  }
+  input->len = end - start;
+  memmove(input->text, start, input->len);
+
+  // A line that fills the whole buffer is sent as it is
+  if (input->len == sizeof(input->text) - 1)
+  {
+    input->text[input->len] = '\0';
+    input->len = 0;
+    if (send_line(socket_fd, input->text) != 0)
+      return -1;
+  }
+  return 1;
+}
+
+/* Read what the server has sent and print every complete message. Output is only buffered here,
+   so everything that arrived together is written to the terminal at once.
+   Returns 1 while the connection is open, 0 once the server has closed it and -1 if an error occurs */
+int read_server(int socket_fd, msg_reader_t *reader)
+{
+  ssize_t rc = msg_reader_fill(reader);
+  if (rc == -1)
+    return errno == EINTR ? 1 : -1;
+  if (rc == 0)
+    return 0;
+
+  msg_view_t view;
+  int got;
+  while ((got = msg_reader_view(reader, &view)) > 0)
+  {
+    // Take up the server's offer of v2 framing. Everything we send after the answer uses it.
+    if (view.control == PROTO_OFFER)
+    {
+      if (send_control(socket_fd, PROTO_ACCEPT) != 0)
+        return -1;
+      send_version = FRAMING_V2;
+    }
+    else if (view.control == PROTO_TOKEN)
+      snprintf(seat_token, sizeof(seat_token), "%s", view.text);
+    else if (view.control == 0)
+      fputs(view.text, stdout);
+  }
+  return got < 0 ? -1 : 1;
+}
+
+// Relay the terminal to the server and the server to the terminal until the server hangs up
+int play(int socket_fd, line_buffer_t *input)
+{
+  msg_reader_t *reader = malloc(sizeof(msg_reader_t));
+  if (reader == NULL)
+  {
+    perror("malloc failed");
+    return -1;
+  }
+  msg_reader_init(reader, socket_fd);
+
+  static char output[OUTPUT_BUFFER];
+  setvbuf(stdout, output, _IOFBF, sizeof(output));
+
+  struct pollfd fds[2] = {
+      {.fd = socket_fd, .events = POLLIN},
+      {.fd = input->closed ? -1 : STDIN_FILENO, .events = POLLIN},
+  };
+
+  int result = 0;
   while (true)
   {
-    char message[MAX_MESSAGE_LENGTH];
-    int c;
-    int i = 0;
-    while ((c = getchar()) != '\n') {
-      message[i] = c;
-      i++;
+    if (poll(fds, 2, -1) == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      perror("poll failed");
+      result = -1;
+      break;
     }
-    message[i] = '\0';
 
-    int rc = send_message(*(int *)port, message);
+    // The server first, so a prompt is on screen before the answer to it is read
+    if (fds[0].revents != 0)
+    {
+      int rc = read_server(socket_fd, reader);
+      if (rc <= 0)
+      {
+        if (rc == 0)
+          printf("The server closed the connection.\n");
+        else
+          perror("Failed to read message from server");
+        result = rc;
+        break;
+      }
+    }
 
-    if (rc == -1)
+    // At the end of input we stop reading it, but keep showing the game until the server is done
+    if (fds[1].revents != 0)
     {
-      perror("Failed to send message to server");
-      exit(EXIT_FAILURE);
+      int rc = read_input(socket_fd, input);
+      if (rc == -1)
+      {
+        perror("Failed to send message to server");
+        result = -1;
+        break;
+      }
+      if (rc == 0)
+      {
+        input->closed = true;
+        fds[1].fd = -1;
+      }
     }
-    
+
+    fflush(stdout);
   }
-  return NULL;
+
+  fflush(stdout);
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  msg_reader_destroy(reader);
+  free(reader);
+  return result;
 }
 
-void *accept_message(void *port)
+/* Connect to a server that went away mid-game and ask for our seat back, trying every
+   REATTACH_INTERVAL_MS for as long as a restart may take. A server that is up answers at once, so
+   a connection that says nothing for REATTACH_ANSWER_MS was caught by one going down.
+   Returns the socket, or -1 if the server did not come back. */
+int reattach(char *server_name, unsigned short port)
 {
-  while (true) // continually loop until we receive a message successfully
-  {
-    char *message;
+  printf("Reconnecting to the server...\n");
+  fflush(stdout);
 
-    // Read a message from the client
-    message = receive_message(*(int *)port);
-    if (message != NULL)
+  uint64_t deadline = monotonic_ms() + REATTACH_TIMEOUT_MS;
+  while (monotonic_ms() < deadline)
+  {
+    int socket_fd = socket_connect(server_name, port);
+    if (socket_fd != -1)
     {
-      printf("%s", message);
-      fflush(stdout);
+      // The token goes first, and a new connection starts out in v1 framing again
+      send_version = FRAMING_V1;
+      struct pollfd answer = {.fd = socket_fd, .events = POLLIN};
+      char byte;
+      if (send_control_arg(socket_fd, PROTO_RESUME, seat_token) == 0 && poll(&answer, 1, REATTACH_ANSWER_MS) == 1 &&
+          recv(socket_fd, &byte, 1, MSG_PEEK) == 1)
+        return socket_fd;
+      close(socket_fd);
     }
-    free(message);
+    sleep_ms(REATTACH_INTERVAL_MS);
   }
-  return NULL;
+
+  printf("The server did not come back.\n");
+  return -1;
+}
+
+void usage(char *program)
+{
+  fprintf(stderr, "Usage: %s [-b bots] [-g games] [-t think ms] [-d fixed|uniform|exp] [-c chat lines per min] [-S seed] [-W game to watch] <server> <port>\n", program);
+  exit(EXIT_FAILURE);
 }
 
 int main(int argc, char **argv)
 {
-  if (argc != 3)
+  // With -b, this process plays as that many bots instead of relaying the terminal
+  bot_options_t bots;
+  bot_options_init(&bots);
+  bool bot_mode = false;
+
+  // With -W, this process watches a game from the server's spectator port instead of playing
+  char *watch = NULL;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "b:g:t:d:c:S:W:")) != -1)
   {
-    fprintf(stderr, "Usage: %s<port>\n", argv[0]);
-    exit(EXIT_FAILURE);
+    switch (opt)
+    {
+    case 'b':
+      bot_mode = true;
+      bots.bots = atoi(optarg);
+      break;
+    case 'g':
+      bots.games = atoi(optarg);
+      break;
+    case 't':
+      bots.think_ms = atoi(optarg);
+      break;
+    case 'd':
+      if (strcmp(optarg, "fixed") == 0)
+        bots.think_dist = THINK_FIXED;
+      else if (strcmp(optarg, "uniform") == 0)
+        bots.think_dist = THINK_UNIFORM;
+      else if (strcmp(optarg, "exp") == 0)
+        bots.think_dist = THINK_EXPONENTIAL;
+      else
+        usage(argv[0]);
+      break;
+    case 'c':
+      bots.chat_per_min = atof(optarg);
+      break;
+    case 'S':
+      bots.seed = strtoull(optarg, NULL, 10);
+      break;
+    case 'W':
+      watch = optarg;
+      break;
+    default:
+      usage(argv[0]);
+    }
   }
+  if (argc - optind != 2 || bots.bots < 1 || bots.games < 1)
+    usage(argv[0]);
 
   // Read command line arguments
-  char *server_name = argv[1];
-  unsigned short port = atoi(argv[2]);
+  char *server_name = argv[optind];
+  unsigned short port = atoi(argv[optind + 1]);
+
+  if (bot_mode)
+  {
+    if (bot_run(server_name, port, &bots) != 0)
+    {
+      perror("Failed to start bots");
+      exit(EXIT_FAILURE);
+    }
+    return 0;
+  }
 
   // Connect to the server
   int socket_fd = socket_connect(server_name, port);
@@ -73,12 +293,30 @@ int main(int argc, char **argv)
     perror("Failed to connect");
     exit(EXIT_FAILURE);
   }
-  pthread_t thread_accept_message, thread_send_message;
-  pthread_create(&thread_accept_message, NULL, accept_message, &socket_fd);
 
-  pthread_create(&thread_send_message, NULL, send_message_func, &socket_fd);
-  while (true)
+  // A server that hangs up while we write must not kill us before we can say so
+  signal(SIGPIPE, SIG_IGN);
+
+  // A spectator says which game they watch, then only reads
+  if (watch != NULL)
   {
+    line_buffer_t none = {.len = 0, .closed = true};
+    int result = send_message(socket_fd, watch) == 0 ? play(socket_fd, &none) : -1;
+    close(socket_fd);
+    return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
   }
-  return 0;
-}
\ No newline at end of file
+
+  // While we hold a seat, a server that hangs up is restarting and will give it back
+  line_buffer_t input = {.len = 0, .closed = false};
+  int result = play(socket_fd, &input);
+  while (seat_token[0] != '\0')
+  {
+    close(socket_fd);
+    socket_fd = reattach(server_name, port);
+    if (socket_fd == -1)
+      return EXIT_FAILURE;
+    result = play(socket_fd, &input);
+  }
+  close(socket_fd);
+  return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -66,3 +66,79 @@ size_t time_ms() {
   return tv.tv_sec * 1000 + tv.tv_usec / 1000;
 
 }
+
+
+/**
+
+ * Get the time in milliseconds on the monotonic clock. Unlike time_ms, this never jumps when the
+
+ * system clock is adjusted, so it is the one to use for deadlines.
+
+ */
+
+uint64_t monotonic_ms() {
+
+  struct timespec ts;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+
+    perror("clock_gettime");
+
+    exit(2);
+
+  }
+
+
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+}
+
+
+/**
+
+ * Get the next number from a splitmix64 generator. Any seed works, including zero.
+
+ * \param   state  The generator's state, which is advanced
+
+ */
+
+uint64_t rng_next(uint64_t *state) {
+
+  uint64_t z = (*state += 0x9e3779b97f4a7c15);
+
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+
+  return z ^ (z >> 31);
+
+}
+
+
+/**
+
+ * Get a number in [0, bound) without the bias of a plain modulo
+
+ * \param   state  The generator's state, which is advanced
+
+ * \param   bound  The number of possible results, which must not be zero
+
+ */
+
+uint64_t rng_below(uint64_t *state, uint64_t bound) {
+
+  // Draws past the last whole multiple of bound would favour small results, so draw again
+
+  uint64_t limit = UINT64_MAX - UINT64_MAX % bound;
+
+  uint64_t x;
+
+  do {
+
+    x = rng_next(state);
+
+  } while (x >= limit);
+
+  return x % bound;
+
+}
@@ -20,4 +20,19 @@ void sleep_ms(size_t ms);
 size_t time_ms();
 
 
+// Get the time in milliseconds on the monotonic clock, which never jumps backwards
+
+uint64_t monotonic_ms();
+
+
+// Get the next number from a splitmix64 generator and advance its state
+
+uint64_t rng_next(uint64_t *state);
+
+
+// Get a number in [0, bound) from a splitmix64 generator. bound must not be zero.
+
+uint64_t rng_below(uint64_t *state, uint64_t bound);
+
+
 #endif
\ No newline at end of file
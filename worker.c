@@ -0,0 +1,205 @@
+#include "worker.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Called by a game on its worker's thread once it has ended
+static void worker_game_over(game_t* game) {
+  worker_t* worker = game->owner;
+
+  // The game may still be referenced by events later in this batch, so free it once idle
+  game->next = worker->finished;
+  worker->finished = game;
+}
+
+// Called by a game on its worker's thread when the first of its players to leave in a batch is queued
+static void worker_game_leaving(game_t* game) {
+  worker_t* worker = game->owner;
+  game->next_leaving = worker->leaving;
+  worker->leaving = game;
+}
+
+// Take out the players who left during the batch, one notice per game, and write out the output queued
+// meanwhile, then free the games that ended. A flush that fails queues its player for another round, and
+// each player leaves once, so this ends. What the batch recorded goes to the journal's writer, which does
+// the I/O on its own thread.
+static void worker_idle(void* ctx) {
+  worker_t* worker = ctx;
+
+  do {
+    game_t* games = worker->leaving;
+    worker->leaving = NULL;
+    while (games != NULL) {
+      game_t* game = games;
+      games = game->next_leaving;
+      game_take_leavers(game);
+    }
+    conn_flush_all(&worker->dirty);
+  } while (worker->leaving != NULL);
+  journal_commit(&worker->journal);
+
+  while (worker->finished != NULL) {
+    game_t* game = worker->finished;
+    worker->finished = game->next;
+
+    printf("Game %d has ended\n", game->id);
+    game_destroy(game);
+    atomic_fetch_sub(&worker->games, 1);
+  }
+}
+
+// Start every game that has been handed to this worker
+static void worker_wake(void* ctx, int fd) {
+  worker_t* worker = ctx;
+
+  uint64_t count;
+  if (read(fd, &count, sizeof(count)) == -1) {
+    perror("Failed to read worker eventfd");
+  }
+
+  // A pool that failed to start wakes its workers once more to stop them
+  if (atomic_load(&worker->stopping)) {
+    reactor_stop(&worker->reactor);
+    return;
+  }
+
+  pthread_mutex_lock(&worker->lock);
+  game_t* games = worker->incoming;
+  worker->incoming = NULL;
+  pthread_mutex_unlock(&worker->lock);
+
+  while (games != NULL) {
+    game_t* game = games;
+    games = game->next;
+
+    game->owner = worker;
+    game->on_over = worker_game_over;
+    game->on_leaving = worker_game_leaving;
+    game_start(game, &worker->reactor, &worker->dirty, &worker->stats, &worker->journal);
+  }
+}
+
+// Copy out this worker's stats for other threads to read, then do it again later
+static void worker_publish_stats(void* ctx) {
+  worker_t* worker = ctx;
+
+  pthread_mutex_lock(&worker->stats_lock);
+  worker->published = worker->stats;
+  pthread_mutex_unlock(&worker->stats_lock);
+
+  reactor_add_timer(&worker->reactor, &worker->stats_timer, STATS_PUBLISH_MS, worker_publish_stats, worker);
+}
+
+// Thread function for a worker: run its reactor forever
+static void* worker_main(void* arg) {
+  worker_t* worker = arg;
+  reactor_add_timer(&worker->reactor, &worker->stats_timer, STATS_PUBLISH_MS, worker_publish_stats, worker);
+  reactor_run(&worker->reactor);
+  return NULL;
+}
+
+// Set up a worker's reactor and wake-up eventfd and start its thread. Returns -1, with nothing
+// left open, if an error occurs.
+static int worker_launch(worker_t* worker) {
+  if (reactor_init(&worker->reactor) != 0) return -1;
+  worker->reactor.on_idle = worker_idle;
+  worker->reactor.idle_ctx = worker;
+
+  worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (worker->wake_fd == -1) {
+    reactor_destroy(&worker->reactor);
+    return -1;
+  }
+  worker->wake_handle.fd = worker->wake_fd;
+  worker->wake_handle.on_readable = worker_wake;
+  worker->wake_handle.on_writable = NULL;
+  worker->wake_handle.ctx = worker;
+  if (reactor_add(&worker->reactor, &worker->wake_handle) != 0 ||
+      pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+    close(worker->wake_fd);
+    reactor_destroy(&worker->reactor);
+    return -1;
+  }
+  return 0;
+}
+
+// Stop and join the first started workers of a pool that failed to start, then free it. They
+// have no games yet, so only their own resources are left to release.
+static void worker_pool_abort(worker_t* pool, int started) {
+  for (int i = 0; i < started; i++) {
+    worker_t* worker = &pool[i];
+    atomic_store(&worker->stopping, true);
+    uint64_t one = 1;
+    if (write(worker->wake_fd, &one, sizeof(one)) == -1) {
+      perror("Failed to wake worker");
+    }
+    pthread_join(worker->thread, NULL);
+    close(worker->wake_fd);
+    reactor_destroy(&worker->reactor);
+  }
+  for (int i = 0; i <= started; i++) {
+    pthread_mutex_destroy(&pool[i].lock);
+    pthread_mutex_destroy(&pool[i].stats_lock);
+  }
+  free(pool);
+}
+
+// Start count worker threads, recording their games in journal unless it is NULL
+worker_t* worker_pool_start(int count, journal_t* journal) {
+  worker_t* pool = calloc(count, sizeof(worker_t));
+  if (pool == NULL) return NULL;
+
+  for (int i = 0; i < count; i++) {
+    worker_t* worker = &pool[i];
+    worker->id = i;
+    worker->incoming = NULL;
+    worker->finished = NULL;
+    worker->leaving = NULL;
+    worker->dirty = NULL;
+    journal_buf_init(&worker->journal, journal);
+    atomic_init(&worker->games, 0);
+    atomic_init(&worker->stopping, false);
+    pthread_mutex_init(&worker->lock, NULL);
+    stats_init(&worker->stats);
+    stats_init(&worker->published);
+    pthread_mutex_init(&worker->stats_lock, NULL);
+    wheel_timer_init(&worker->stats_timer);
+
+    // The workers already running would otherwise wait for games for ever
+    if (worker_launch(worker) != 0) {
+      worker_pool_abort(pool, i);
+      return NULL;
+    }
+  }
+
+  return pool;
+}
+
+// Hand a full game over to the least busy worker in the pool
+void worker_pool_submit(worker_t* pool, int count, game_t* game) {
+  worker_t* worker = &pool[0];
+  for (int i = 1; i < count; i++) {
+    if (atomic_load(&pool[i].games) < atomic_load(&worker->games)) worker = &pool[i];
+  }
+  atomic_fetch_add(&worker->games, 1);
+
+  pthread_mutex_lock(&worker->lock);
+  game->next = worker->incoming;
+  worker->incoming = game;
+  pthread_mutex_unlock(&worker->lock);
+
+  uint64_t one = 1;
+  if (write(worker->wake_fd, &one, sizeof(one)) == -1) {
+    perror("Failed to wake worker");
+  }
+}
+
+// Copy the stats a worker last published
+void worker_stats(worker_t* worker, stats_t* out) {
+  pthread_mutex_lock(&worker->stats_lock);
+  *out = worker->published;
+  pthread_mutex_unlock(&worker->stats_lock);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "game.h"
+#include "journal.h"
+#include "reactor.h"
+#include "stats.h"
+
+#define STATS_PUBLISH_MS 1000  // How often a worker copies out its stats for snapshots
+
+// A worker thread runs its own reactor and owns a shard of the server's games. Games are handed
+// over through a queue and from then on only the worker touches them.
+typedef struct worker {
+  int id;
+  pthread_t thread;
+  reactor_t reactor;
+
+  pthread_mutex_t lock;     // protects incoming
+  game_t* incoming;         // games handed over but not started yet
+  int wake_fd;              // eventfd written to when incoming changes
+  reactor_handle_t wake_handle;
+
+  game_t* finished;         // games that ended during the current batch of events
+  game_t* leaving;          // games with players whose connection failed during the current batch
+  conn_t* dirty;            // connections of this worker's games with output to flush
+  journal_buf_t journal;    // records of this worker's games, handed to the writer once idle
+  atomic_int games;         // number of games this worker is running
+  atomic_bool stopping;     // set before the last wake-up of a pool that failed to start
+
+  // What this worker's games record, and the copy of it readable by other threads
+  stats_t stats;
+  pthread_mutex_t stats_lock;  // protects published
+  stats_t published;
+  wheel_timer_t stats_timer;
+} worker_t;
+
+// Start count worker threads, recording their games in journal unless it is NULL.
+// Returns NULL if an error occurs.
+worker_t* worker_pool_start(int count, journal_t* journal);
+
+// Hand a full game over to the least busy worker in the pool, which will start it
+void worker_pool_submit(worker_t* pool, int count, game_t* game);
+
+// Copy the stats a worker last published, at most STATS_PUBLISH_MS old
+void worker_stats(worker_t* worker, stats_t* out);